@@ -1,24 +1,58 @@
 // simple implementation
 //  - doesn't support delayed output of y-dimension
-//  - simple interface (only one output format: 8-bit interleaved RGB)
+//  - simple interface (one output format: 8-bit interleaved RGB), or the
+//    component planes as they're coded (stbi_jpeg_load_planar*)
 //  - doesn't try to recover corrupt jpegs
 //  - doesn't allow partial loading, loading multiple at once
+//  - can decode just a rectangle of the image (stbi_jpeg_load_region*),
+//    skipping reconstruction outside it
+//  - an index of a single-scan baseline image (stbi_jpeg_build_index_*)
+//    lets a region load start near the region instead of the top
+//  - can show a progressive image after each of its scans
+//    (stbi_jpeg_load_progressive*)
+//  - can decode at 1/2, 1/4 or 1/8 size (stbi_jpeg_set_scale_denom) with
+//    reduced IDCTs, for thumbnails
 //  - still fast on x86 (copying globals into locals doesn't help x86)
-//  - allocates lots of intermediate memory (full size of all components)
+//  - allocates lots of intermediate memory (full size of all components),
+//    except for single-scan baseline images decoded on one thread or
+//    streamed (stbi_jpeg_stream_*), which only keep an MCU row of each and
+//    convert it while it's still in cache
 //    - non-interleaved case requires this anyway
 //    - allows good upsampling (see next)
 // high-quality
 //  - upsampled channels are bilinearly interpolated, even across blocks
 //  - quality integer IDCT derived from IJG's 'slow'
 // performance
-//  - fast huffman; reasonable integer IDCT
-//  - some SIMD kernels for common paths on targets with SSE2/NEON
-//  - uses a lot of intermediate memory, could cache poorly
+//  - fast huffman, with up to two baseline ACs per table lookup;
+//    reasonable integer IDCT
+//  - some SIMD kernels for common paths on targets with SSE2/NEON, and a
+//    two-block AVX2 IDCT picked at runtime
+//  - optional worker threads (STBI_JPEG_THREADS) for restart intervals,
+//    speculative huffman decoding of large scans, IDCT overlapped with
+//    huffman decoding, progressive IDCT, and colour conversion
+//  - uses a lot of intermediate memory for progressive and multi-scan
+//    images, could cache poorly
+//  - optional scratch files (STBI_JPEG_SCRATCH) for the coefficients of
+//    huge progressive images, which are then reconstructed in bands
+//  - a decoder object (stbi_jpeg_decoder_*) keeps huffman tables and
+//    buffers from one image to the next, for MJPEG frames and batches
+//  - stbi_jpeg_set_profile (or stbi_jpeg_load_profile* for one load, or
+//    stbi_jpeg_decoder_set_profile for one decoder) trades some accuracy
+//    for speed: replicated chroma, cheaper colour conversion with SIMD, and
+//    an AAN IDCT only in builds without a SIMD one
 
 #ifndef STBI_NO_JPEG
 
+// the entropy decoder's bit buffer
+#ifdef _MSC_VER
+typedef unsigned __int64 stbi__uint64;
+#else
+typedef uint64_t stbi__uint64;
+#endif
+
 // huffman decoding acceleration
 #define FAST_BITS 9 // larger handles more cases; smaller stomps less cache
+#define MULTI_BITS 11 // window for decoding up to two baseline ACs at once
 
 typedef struct
 {
@@ -31,13 +65,50 @@ typedef struct
 	int delta[17]; // old 'firstsymbol' - old 'firstcode'
 } stbi__huffman;
 
+typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
+												  int w, int hs);
+
+typedef struct
+{
+	resample_row_func resample;
+	stbi_uc *line0, *line1;
+	int hs, vs;  // expansion factor in each axis
+	int w_lores; // horizontal pixels pre-expansion
+	int x0;      // first pre-expansion pixel used
+	int xoff;    // expanded pixels to drop before the output region
+	int ystep;   // how far through vertical expansion we are
+	int ypos;    // which pre-expansion row we're on
+} stbi__resample;
+
+// everything needed to turn component planes into output scanlines
+typedef struct
+{
+	stbi__resample res_comp[4];
+	stbi_uc *output;
+	int req_comp;
+	int n, decode_n, is_rgb;
+	int transform; // the Adobe colour transform the output was set up for
+	int rows_done; // output rows already converted, from the top
+	// EXIF orientation (2-8) the output is being turned upright from, or 0.
+	// rows are converted into orow, just past the image, and copied to
+	// where they go from there a few at a time
+	int orient;
+	stbi_uc *orow;
+} stbi__jpeg_output;
+
+// buffers a decoder object holds on to between images: a plane, a
+// progressive coefficient block and a line buffer per component
+#define STBI__JPEG_SPARES 12
+
 typedef struct
 {
 	stbi__context *s;
 	stbi__huffman huff_dc[4];
 	stbi__huffman huff_ac[4];
 	stbi__uint16 dequant[4][64];
+	stbi__uint16 dequant_aan[4][64]; // with the AAN scale factors folded in
 	stbi__int16 fast_ac[4][1 << FAST_BITS];
+	stbi__uint32 multi_ac[4][1 << MULTI_BITS];
 
 	// sizes for components, interleaved MCUs
 	int img_h_max, img_v_max;
@@ -59,9 +130,23 @@ typedef struct
 		stbi_uc *linebuf;
 		short *coeff;         // progressive only
 		int coeff_w, coeff_h; // number of 8x8 coefficient blocks
+		size_t coeff_mapped;  // bytes of raw_coeff mapped from a scratch file, or 0
+		size_t coeff_released; // bytes of it let go in this pass over the rows
+		int coeff_fd;         // and the file, kept open to drop done rows from memory
+
+		// blocks reconstruct to 1 << bshift pixels square with this IDCT
+		int bshift;
+		void (*idct)(stbi_uc *out, int out_stride, short data[64]);
+		int aan; // idct is idct_aan_kernel, so blocks use dequant_aan
+
+		// blocks the output region depends on, as [bx0,bx1) x [by0,by1)
+		int bx0, by0, bx1, by1;
+
+		// plane row held in the first row of data; nonzero when streaming
+		int row0;
 	} img_comp[4];
 
-	stbi__uint32 code_buffer; // jpeg entropy-coded buffer
+	stbi__uint64 code_buffer; // jpeg entropy-coded buffer, from the top bit
 	int code_bits;            // number of valid bits
 	unsigned char marker;     // marker seen while filling entropy buffer
 	int nomore;               // flag if we saw a marker so must stop
@@ -79,12 +164,458 @@ typedef struct
 	int scan_n, order[4];
 	int restart_interval, todo;
 
+	// decode at 1/(1 << scale) size. every size set up by the frame header
+	// is the scaled one
+	int scale;
+
+	// region of the (scaled) image to output. crop_w == 0 asks for the whole
+	// image; the frame header clips it and fills it in either way
+	int crop_x, crop_y, crop_w, crop_h;
+
+	// output being produced by load_jpeg_image; lets a scan emit rows early
+	stbi__jpeg_output *out;
+
+	// set by stbi_jpeg_stream_open* and load_jpeg_image: component planes
+	// are windows onto the image until the first scan shows whether it can
+	// be streamed (1), and stay that way once it has been (2)
+	int stream;
+
+	// a streamed progressive image whose coefficients are big enough to go
+	// to a scratch file (stbi_jpeg_set_scratch_dir): the planes stay
+	// windows, and MCU rows are reconstructed as the output rows need them
+	// once every scan is in
+	int banded;
+
+	// set by stbi__jpeg_load_planar: the planes are all in one block, which
+	// is handed to the caller instead of being converted
+	int planar;
+
+	// set by stbi__jpeg_load_progressive: shown the image after each scan
+	// of a progressive image
+	stbi_jpeg_scan_callback preview;
+	void *preview_user;
+	int scans;
+
+	// set by stbi__jpeg_load_coefficients: every block is kept quantized in
+	// coeff, for baseline images too, and nothing is reconstructed
+	int coefficients;
+
+	// what to read from the EXIF APP1 segment, STBI__EXIF_* bits: the
+	// orientation tag from IFD0, for load_jpeg_image, and the JPEG thumbnail
+	// in IFD1, copied out to exif_thumb by stbi__jpeg_exif_thumbnail
+	int exif;
+	int orientation; // 1 (upright) unless the EXIF data says otherwise
+	stbi_uc *exif_thumb;
+	int exif_thumb_len;
+	// set by stbi__jpeg_load_thumbnail: the orientation of the image an EXIF
+	// thumbnail came from, which has no EXIF data of its own, or 0
+	int parent_orientation;
+
+	// set by stbi__jpeg_load_region_indexed: an index from
+	// stbi__jpeg_build_index, already checked to hold all its checkpoints,
+	// to start the streamed scan part way down
+	const stbi_uc *index;
+
+	// the DHT payload (16 counts, then the values) each huffman table was
+	// last built from, by class * 4 + id. tables whose bit is set in
+	// huff_valid are skipped when a later frame defines them the same way;
+	// huff_defined holds the ones this frame has defined
+	stbi_uc huff_spec[8][16 + 256];
+	int huff_valid, huff_defined;
+
+	// STBI_JPEG_* profile, from stbi_jpeg_set_profile or the decoder object
+	int profile;
+
+	// set by stbi_jpeg_decoder_create: buffers freed by one frame are kept
+	// in spare to be handed out again to the next
+	int keep;
+	stbi_uc *spare[STBI__JPEG_SPARES];
+
 	// kernels
 	void (*idct_block_kernel)(stbi_uc *out, int out_stride, short data[64]);
+	void (*idct_block2_kernel)(stbi_uc *out0, stbi_uc *out1, int out_stride, short *data0, short *data1); // optional
+	void (*idct_low_kernel)(stbi_uc *out, int out_stride, short data[64]); // coefficients in the top left 4x4
+	void (*idct_aan_kernel)(stbi_uc *out, int out_stride, short data[64]); // STBI_JPEG_FAST; NULL with a SIMD IDCT
 	void (*YCbCr_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
+	void (*YCbCr_to_RGB_fast_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step);
+	void (*CMYK_to_RGB_kernel)(stbi_uc *out, const stbi_uc *c, const stbi_uc *m, const stbi_uc *y, const stbi_uc *k, int count, int step);
+	void (*YCCK_to_RGB_kernel)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, const stbi_uc *k, int count, int step);
 	stbi_uc *(*resample_row_hv_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+	stbi_uc *(*resample_row_h_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+	stbi_uc *(*resample_row_v_2_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
+	stbi_uc *(*resample_row_generic_kernel)(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs);
 } stbi__jpeg;
 
+static int stbi__jpeg_scale_shift = 0;
+static int stbi__jpeg_orient_on_load = 0;
+
+// decode JPEGs at 1/denom of their size in each direction, rounded up, like
+// libjpeg's scale_denom. denom is 1, 2, 4 or 8; anything else rounds down
+// to one of those. only the loaders are affected, stbi_info still reports
+// the full size.
+STBIDEF void stbi_jpeg_set_scale_denom(int denom)
+{
+	stbi__jpeg_scale_shift = denom >= 8 ? 3 : denom >= 4 ? 2 : denom >= 2 ? 1 : 0;
+}
+
+// turn JPEGs upright as they're loaded, following their EXIF orientation
+// tag, so a portrait phone photo comes out portrait. the pixels are put in
+// place as they're colour converted, with no pass over the image after.
+// the size returned is the upright one; a region passed to
+// stbi_jpeg_load_region is still in the image as stored. stbi_info and the
+// other entry points (planar, streaming, coefficients) ignore this
+STBIDEF void stbi_jpeg_set_orient_on_load(int flag_true_if_should_orient)
+{
+	stbi__jpeg_orient_on_load = flag_true_if_should_orient;
+}
+
+// speed/accuracy trade-off for the loaders, for bulk decoding where a
+// little fidelity can go for throughput:
+//  - STBI_JPEG_ACCURATE (default): everything as described at the top
+//  - STBI_JPEG_FAST: 4:2:0 chroma is replicated instead of interpolated.
+//    the IDCT is the same as ACCURATE's in SSE2/NEON builds, where the
+//    SIMD one is already several times faster than an AAN one; only builds
+//    without it switch to the AAN integer IDCT
+//  - STBI_JPEG_FASTEST: all chroma is replicated, and SIMD builds convert
+//    colour with 8-bit fixed point constants
+// planar loads only get the IDCT change, and coefficient loads none.
+// like the other stbi_jpeg_set_* options this is one setting for the whole
+// process, read as each load starts, and isn't thread-safe: don't change it
+// while another thread is loading. to use different profiles from
+// different threads, pass one to stbi_jpeg_load_profile* for each load, or
+// give a decoder object its own with stbi_jpeg_decoder_set_profile
+#define STBI_JPEG_ACCURATE 0
+#define STBI_JPEG_FAST 1
+#define STBI_JPEG_FASTEST 2
+
+static int stbi__jpeg_profile = STBI_JPEG_ACCURATE;
+
+static int stbi__jpeg_clamp_profile(int profile)
+{
+	return profile < STBI_JPEG_ACCURATE ? STBI_JPEG_ACCURATE : profile > STBI_JPEG_FASTEST ? STBI_JPEG_FASTEST : profile;
+}
+
+STBIDEF void stbi_jpeg_set_profile(int profile)
+{
+	stbi__jpeg_profile = stbi__jpeg_clamp_profile(profile);
+}
+
+#ifdef STBI_JPEG_SCRATCH
+// optional out-of-core coefficients. define STBI_JPEG_SCRATCH, then call
+// stbi_jpeg_set_scratch_dir() with a directory on disk (not a RAM-backed
+// one like some /tmp), and progressive images whose coefficients take at
+// least STBI_JPEG_SCRATCH_MIN bytes keep them in a memory-mapped file
+// there, deleted as soon as it's created, instead of on the heap. each
+// block row is dropped from memory once a scan is past it. decoded on one
+// thread or streamed, such an image is also reconstructed a band of MCU
+// rows at a time as it's converted, so its planes are only that tall. if
+// the file can't be made the coefficients go on the heap as usual
+#ifdef _WIN32
+#include <windows.h>
+#else
+// only calls a strict -std still declares without a feature-test macro
+// (no mkstemp, ftruncate or madvise), as the system headers come first
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#ifndef STBI_JPEG_SCRATCH_MIN
+#define STBI_JPEG_SCRATCH_MIN (64 << 20)
+#endif
+
+static const char *stbi__jpeg_scratch_dir = NULL;
+
+// NULL (the default) keeps all coefficients on the heap. the string isn't
+// copied
+STBIDEF void stbi_jpeg_set_scratch_dir(const char *dir)
+{
+	stbi__jpeg_scratch_dir = dir;
+}
+
+// a zeroed, writable mapping of a new scratch file, or NULL. *fd is the
+// open file, or -1 on Windows where the view alone keeps it
+static void *stbi__jpeg_scratch_map(size_t size, int *fd)
+{
+#ifdef _WIN32
+	char path[MAX_PATH];
+	HANDLE f, m;
+	void *p = NULL;
+	*fd = -1;
+	if (!GetTempFileNameA(stbi__jpeg_scratch_dir, "sbj", 0, path))
+		return NULL;
+	f = CreateFileA(path, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_TEMPORARY | FILE_FLAG_DELETE_ON_CLOSE, NULL);
+	if (f == INVALID_HANDLE_VALUE)
+	{
+		DeleteFileA(path);
+		return NULL;
+	}
+	// the view keeps the file until it's unmapped
+	m = CreateFileMappingA(f, NULL, PAGE_READWRITE, (DWORD)((stbi__uint64)size >> 32), (DWORD)size, NULL);
+	if (m)
+	{
+		p = MapViewOfFile(m, FILE_MAP_ALL_ACCESS, 0, 0, size);
+		CloseHandle(m);
+	}
+	CloseHandle(f);
+	return p;
+#else
+	size_t n = strlen(stbi__jpeg_scratch_dir);
+	char *path = (char *)stbi__malloc(n + 64);
+	void *p = MAP_FAILED;
+	int i;
+	*fd = -1;
+	if (!path)
+		return NULL;
+	// the file is sized with an off_t, which may only be 32 bits
+	if (size - 1 > (size_t)(((stbi__uint64)1 << (sizeof(off_t) * 8 - 1)) - 1))
+	{
+		STBI_FREE(path);
+		return NULL;
+	}
+	// a name that isn't taken yet, like mkstemp() would pick. no other call
+	// that's running has the same path buffer, so the pid and its address
+	// keep threads and processes apart without anything shared between
+	// them; O_EXCL turns a clash with a stale file into another try
+	for (i = 0; i < 100 && *fd < 0; ++i)
+	{
+		sprintf(path, "%s/stbi_jpeg_%ld_%lx_%d", stbi__jpeg_scratch_dir, (long)getpid(), (unsigned long)(size_t)path, i);
+		*fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0600);
+		if (*fd < 0 && errno != EEXIST)
+			break;
+	}
+	if (*fd >= 0)
+	{
+		unlink(path);
+		// one byte at the end sets the size; the rest of the file reads as zeros
+		if (lseek(*fd, (off_t)size - 1, SEEK_SET) != (off_t)-1 && write(*fd, "", 1) == 1)
+			p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, *fd, 0);
+		if (p == MAP_FAILED)
+		{
+			close(*fd);
+			*fd = -1;
+		}
+	}
+	STBI_FREE(path);
+	return p == MAP_FAILED ? NULL : p;
+#endif
+}
+
+static void stbi__jpeg_scratch_unmap(void *p, size_t size, int fd)
+{
+#ifdef _WIN32
+	STBI_NOTUSED(size);
+	STBI_NOTUSED(fd);
+	UnmapViewOfFile(p);
+#else
+	munmap(p, size);
+	close(fd);
+#endif
+}
+#endif // STBI_JPEG_SCRATCH
+
+#ifdef STBI_JPEG_THREADS
+// optional worker threads. define STBI_JPEG_THREADS (and link against
+// pthreads on non-Windows targets), then call stbi_jpeg_set_thread_count()
+// to let the decoder split restart intervals and colour conversion
+// across that many threads. large scans without restart intervals are
+// split speculatively; smaller ones overlap IDCT and colour conversion
+// with huffman decoding, as does the end of a progressive image. the
+// output is identical to the serial path.
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE stbi__thread;
+typedef CRITICAL_SECTION stbi__mutex;
+typedef CONDITION_VARIABLE stbi__cond;
+#else
+#include <pthread.h>
+typedef pthread_t stbi__thread;
+typedef pthread_mutex_t stbi__mutex;
+typedef pthread_cond_t stbi__cond;
+#endif
+
+#ifndef STBI_JPEG_MAX_THREADS
+#define STBI_JPEG_MAX_THREADS 64
+#endif
+
+static int stbi__jpeg_thread_count = 1;
+
+typedef void (*stbi__jpeg_task)(void *arg, int worker, int nworkers);
+
+#ifdef _WIN32
+static void stbi__mutex_init(stbi__mutex *m) { InitializeCriticalSection(m); }
+static void stbi__mutex_destroy(stbi__mutex *m) { DeleteCriticalSection(m); }
+static void stbi__mutex_lock(stbi__mutex *m) { EnterCriticalSection(m); }
+static void stbi__mutex_unlock(stbi__mutex *m) { LeaveCriticalSection(m); }
+static void stbi__cond_init(stbi__cond *c) { InitializeConditionVariable(c); }
+static void stbi__cond_destroy(stbi__cond *c) { STBI_NOTUSED(c); }
+static void stbi__cond_wait(stbi__cond *c, stbi__mutex *m) { SleepConditionVariableCS(c, m, INFINITE); }
+static void stbi__cond_broadcast(stbi__cond *c) { WakeAllConditionVariable(c); }
+#else
+static void stbi__mutex_init(stbi__mutex *m) { pthread_mutex_init(m, NULL); }
+static void stbi__mutex_destroy(stbi__mutex *m) { pthread_mutex_destroy(m); }
+static void stbi__mutex_lock(stbi__mutex *m) { pthread_mutex_lock(m); }
+static void stbi__mutex_unlock(stbi__mutex *m) { pthread_mutex_unlock(m); }
+static void stbi__cond_init(stbi__cond *c) { pthread_cond_init(c, NULL); }
+static void stbi__cond_destroy(stbi__cond *c) { pthread_cond_destroy(c); }
+static void stbi__cond_wait(stbi__cond *c, stbi__mutex *m) { pthread_cond_wait(c, m); }
+static void stbi__cond_broadcast(stbi__cond *c) { pthread_cond_broadcast(c); }
+#endif
+
+// one call to stbi__jpeg_parallel. shares next..n-1 haven't been taken by
+// a thread yet, and 'left' of 1..n-1 haven't finished
+typedef struct stbi__jpeg_batch
+{
+	stbi__jpeg_task task;
+	void *arg;
+	int n, next, left;
+	struct stbi__jpeg_batch *queued; // next batch with shares to take
+} stbi__jpeg_batch;
+
+// the worker threads, shared by every image and kept between calls so
+// small images and MJPEG frames don't pay to start them. they're started
+// as calls need them, up to stbi__jpeg_thread_count - 1; ones over that
+// leave once they're idle
+static struct
+{
+	stbi__mutex lock;
+	stbi__cond work, done;
+	stbi__jpeg_batch *queue;
+	int threads;
+} stbi__jpeg_pool;
+
+static void stbi__jpeg_pool_init(void)
+{
+	stbi__mutex_init(&stbi__jpeg_pool.lock);
+	stbi__cond_init(&stbi__jpeg_pool.work);
+	stbi__cond_init(&stbi__jpeg_pool.done);
+}
+
+#ifdef _WIN32
+static BOOL CALLBACK stbi__jpeg_pool_init_once(PINIT_ONCE once, PVOID param, PVOID *context)
+{
+	STBI_NOTUSED(once);
+	STBI_NOTUSED(param);
+	STBI_NOTUSED(context);
+	stbi__jpeg_pool_init();
+	return TRUE;
+}
+#endif
+
+static void stbi__jpeg_pool_lock(void)
+{
+#ifdef _WIN32
+	static INIT_ONCE once = INIT_ONCE_STATIC_INIT;
+	InitOnceExecuteOnce(&once, stbi__jpeg_pool_init_once, NULL, NULL);
+#else
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, stbi__jpeg_pool_init);
+#endif
+	stbi__mutex_lock(&stbi__jpeg_pool.lock);
+}
+
+STBIDEF void stbi_jpeg_set_thread_count(int n)
+{
+	stbi__jpeg_pool_lock();
+	stbi__jpeg_thread_count = n < 1 ? 1 : n > STBI_JPEG_MAX_THREADS ? STBI_JPEG_MAX_THREADS
+																						: n;
+	// idle threads over the new count leave
+	stbi__cond_broadcast(&stbi__jpeg_pool.work);
+	stbi__mutex_unlock(&stbi__jpeg_pool.lock);
+}
+
+// run the next share of b, with the pool locked on entry and exit
+static void stbi__jpeg_pool_run(stbi__jpeg_batch *b)
+{
+	int i = b->next++;
+	if (b->next == b->n)
+	{
+		stbi__jpeg_batch **q = &stbi__jpeg_pool.queue;
+		while (*q != b)
+			q = &(*q)->queued;
+		*q = b->queued;
+	}
+	stbi__mutex_unlock(&stbi__jpeg_pool.lock);
+	b->task(b->arg, i, b->n);
+	stbi__mutex_lock(&stbi__jpeg_pool.lock);
+	if (--b->left == 0)
+		stbi__cond_broadcast(&stbi__jpeg_pool.done);
+}
+
+#ifdef _WIN32
+static DWORD WINAPI stbi__jpeg_pool_main(LPVOID p)
+#else
+static void *stbi__jpeg_pool_main(void *p)
+#endif
+{
+	STBI_NOTUSED(p);
+	stbi__mutex_lock(&stbi__jpeg_pool.lock);
+	while (stbi__jpeg_pool.threads < stbi__jpeg_thread_count)
+	{
+		if (stbi__jpeg_pool.queue)
+			stbi__jpeg_pool_run(stbi__jpeg_pool.queue);
+		else
+			stbi__cond_wait(&stbi__jpeg_pool.work, &stbi__jpeg_pool.lock);
+	}
+	--stbi__jpeg_pool.threads;
+	stbi__mutex_unlock(&stbi__jpeg_pool.lock);
+	return 0;
+}
+
+// one more thread for the pool, which is locked; 0 if it can't be started
+static int stbi__jpeg_pool_start(void)
+{
+	stbi__thread handle;
+#ifdef _WIN32
+	handle = CreateThread(NULL, 0, stbi__jpeg_pool_main, NULL, 0, NULL);
+	if (handle == NULL)
+		return 0;
+	CloseHandle(handle);
+#else
+	if (pthread_create(&handle, NULL, stbi__jpeg_pool_main, NULL) != 0)
+		return 0;
+	pthread_detach(handle);
+#endif
+	++stbi__jpeg_pool.threads;
+	return 1;
+}
+
+// run task(arg, i, n) for i = 0..n-1, with worker 0 on the calling thread
+// and the rest on the pool. shares no thread has taken by the time worker
+// 0 is done run on the caller instead, one after another
+static void stbi__jpeg_parallel(stbi__jpeg_task task, void *arg, int n)
+{
+	stbi__jpeg_batch b, **q;
+	if (n < 2)
+	{
+		task(arg, 0, n);
+		return;
+	}
+	b.task = task;
+	b.arg = arg;
+	b.n = n;
+	b.next = 1;
+	b.left = n - 1;
+	b.queued = NULL;
+	stbi__jpeg_pool_lock();
+	while (stbi__jpeg_pool.threads < n - 1 && stbi__jpeg_pool.threads < stbi__jpeg_thread_count - 1 && stbi__jpeg_pool_start())
+		;
+	for (q = &stbi__jpeg_pool.queue; *q; q = &(*q)->queued)
+		;
+	*q = &b;
+	stbi__cond_broadcast(&stbi__jpeg_pool.work);
+	stbi__mutex_unlock(&stbi__jpeg_pool.lock);
+	task(arg, 0, n);
+	stbi__mutex_lock(&stbi__jpeg_pool.lock);
+	while (b.next < b.n)
+		stbi__jpeg_pool_run(&b);
+	while (b.left)
+		stbi__cond_wait(&stbi__jpeg_pool.done, &stbi__jpeg_pool.lock);
+	stbi__mutex_unlock(&stbi__jpeg_pool.lock);
+}
+#endif // STBI_JPEG_THREADS
+
 static int stbi__build_huffman(stbi__huffman *h, int *count)
 {
 	int i, j, k = 0;
@@ -164,8 +695,87 @@ static void stbi__build_fast_ac(stbi__int16 *fast_ac, stbi__huffman *h)
 	}
 }
 
+// build a table that decodes up to two baseline AC symbols, magnitudes
+// included, from the next MULTI_BITS bits. each entry packs the length of
+// the first symbol (bits 0-3), of both (4-7), the two runs (8-11, 12-15)
+// and the two values (16-23, 24-31); a value of 0 is an EOB. 0 means the
+// first symbol has to be decoded the slow way
+static void stbi__build_multi_ac(stbi__uint32 *multi_ac, stbi__huffman *h)
+{
+	int i, j;
+	memset(multi_ac, 0, sizeof(*multi_ac) << MULTI_BITS);
+
+	// first the symbols that fit on their own: EOBs and small coefficients
+	for (i = 0; h->size[i]; ++i)
+	{
+		int s = h->size[i], rs = h->values[i], magbits = rs & 15;
+		if (rs == 0 && s <= MULTI_BITS)
+		{
+			for (j = 0; j < (1 << (MULTI_BITS - s)); ++j)
+				multi_ac[(h->code[i] << (MULTI_BITS - s)) + j] = s | (s << 4);
+		}
+		else if (magbits && s + magbits <= MULTI_BITS)
+		{
+			int len = s + magbits, x;
+			for (x = 0; x < (1 << magbits); ++x)
+			{
+				int k = x, base = ((h->code[i] << magbits) + x) << (MULTI_BITS - len);
+				if (k < (1 << (magbits - 1)))
+					k += (~0U << magbits) + 1;
+				if (k < -128 || k > 127)
+					continue;
+				for (j = 0; j < (1 << (MULTI_BITS - len)); ++j)
+					multi_ac[base + j] = len | (len << 4) | ((rs >> 4) << 8) | ((k & 255) << 16);
+			}
+		}
+	}
+
+	// then pair each coefficient with the symbol after it, if that fits in
+	// the bits left. looking it up with those bits moved to the top only
+	// reads the fields that pairing leaves alone
+	for (i = 0; i < (1 << MULTI_BITS); ++i)
+	{
+		stbi__uint32 e = multi_ac[i], e2;
+		int len1 = e & 15, len2;
+		if (!e || !(e & 0xff0000) || len1 == MULTI_BITS)
+			continue;
+		e2 = multi_ac[(i << len1) & ((1 << MULTI_BITS) - 1)];
+		len2 = e2 & 15;
+		if (e2 && len1 + len2 <= MULTI_BITS)
+			multi_ac[i] = (e & 0xff0f0f) | ((len1 + len2) << 4) | (((e2 >> 8) & 15) << 12) | ((e2 & 0xff0000) << 8);
+	}
+}
+
+// 8 bytes as a big-endian number; compilers turn this into a load and a
+// byte swap
+static stbi__uint64 stbi__jpeg_load_be64(const stbi_uc *p)
+{
+	return ((stbi__uint64)p[0] << 56) | ((stbi__uint64)p[1] << 48) | ((stbi__uint64)p[2] << 40) | ((stbi__uint64)p[3] << 32) |
+			 ((stbi__uint64)p[4] << 24) | ((stbi__uint64)p[5] << 16) | ((stbi__uint64)p[6] << 8) | (stbi__uint64)p[7];
+}
+
+// fill the bit buffer up to at least 57 bits. away from markers and the end
+// of the buffered data that takes one load: if none of the next 8 bytes is
+// 0xff (checked all at once, by looking for a zero byte in the complement)
+// there's nothing to unstuff, and as many whole bytes as fit go in. part of
+// the byte after them lands past the valid bits too, but it's what that
+// byte will bring in later, so OR-ing it in again changes nothing
 static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
 {
+	stbi__context *s = j->s;
+	if (!j->nomore && j->code_bits >= 0 && s->img_buffer_end - s->img_buffer >= 8)
+	{
+		stbi__uint64 v = stbi__jpeg_load_be64(s->img_buffer);
+		const stbi__uint64 ones = ((stbi__uint64)0x01010101 << 32) | 0x01010101;
+		if (!((~v - ones) & v & (ones << 7)))
+		{
+			int n = (63 - j->code_bits) >> 3;
+			j->code_buffer |= v >> j->code_bits;
+			j->code_bits += n * 8;
+			s->img_buffer += n;
+			return;
+		}
+	}
 	do
 	{
 		unsigned int b = j->nomore ? 0 : stbi__get8(j->s);
@@ -181,14 +791,11 @@ static void stbi__grow_buffer_unsafe(stbi__jpeg *j)
 				return;
 			}
 		}
-		j->code_buffer |= b << (24 - j->code_bits);
+		j->code_buffer |= (stbi__uint64)b << (56 - j->code_bits);
 		j->code_bits += 8;
-	} while (j->code_bits <= 24);
+	} while (j->code_bits <= 56);
 }
 
-// (1 << n) - 1
-static const stbi__uint32 stbi__bmask[17] = {0, 1, 3, 7, 15, 31, 63, 127, 255, 511, 1023, 2047, 4095, 8191, 16383, 32767, 65535};
-
 // decode a jpeg huffman value from the bitstream
 stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 {
@@ -200,7 +807,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 
 	// look at the top FAST_BITS and determine what symbol ID it is,
 	// if the code is <= FAST_BITS
-	c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
+	c = (int)(j->code_buffer >> (64 - FAST_BITS));
 	k = h->fast[c];
 	if (k < 255)
 	{
@@ -218,7 +825,7 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 	// end; in other words, regardless of the number of bits, it
 	// wants to be compared against something shifted to have 16;
 	// that way we don't need to shift inside the loop.
-	temp = j->code_buffer >> 16;
+	temp = (unsigned int)(j->code_buffer >> 48);
 	for (k = FAST_BITS + 1;; ++k)
 		if (temp < h->maxcode[k])
 			break;
@@ -233,8 +840,8 @@ stbi_inline static int stbi__jpeg_huff_decode(stbi__jpeg *j, stbi__huffman *h)
 		return -1;
 
 	// convert the huffman code to the symbol id
-	c = ((j->code_buffer >> (32 - k)) & stbi__bmask[k]) + h->delta[k];
-	STBI_ASSERT((((j->code_buffer) >> (32 - h->size[c])) & stbi__bmask[h->size[c]]) == h->code[c]);
+	c = (int)(j->code_buffer >> (64 - k)) + h->delta[k];
+	STBI_ASSERT((j->code_buffer >> (64 - h->size[c])) == h->code[c]);
 
 	// convert the id to a symbol
 	j->code_bits -= k;
@@ -251,15 +858,14 @@ stbi_inline static int stbi__extend_receive(stbi__jpeg *j, int n)
 {
 	unsigned int k;
 	int sgn;
+	if (n <= 0 || n >= (int)(sizeof(stbi__jbias) / sizeof(*stbi__jbias)))
+		return 0;
 	if (j->code_bits < n)
 		stbi__grow_buffer_unsafe(j);
 
-	sgn = (stbi__int32)j->code_buffer >> 31; // sign bit is always in MSB
-	k = stbi_lrot(j->code_buffer, n);
-	if (n < 0 || n >= (int)(sizeof(stbi__bmask) / sizeof(*stbi__bmask)))
-		return 0;
-	j->code_buffer = k & ~stbi__bmask[n];
-	k &= stbi__bmask[n];
+	sgn = (stbi__int32)(j->code_buffer >> 32) >> 31; // sign bit is always in MSB
+	k = (unsigned int)(j->code_buffer >> (64 - n));
+	j->code_buffer <<= n;
 	j->code_bits -= n;
 	return k + (stbi__jbias[n] & ~sgn);
 }
@@ -268,24 +874,25 @@ stbi_inline static int stbi__extend_receive(stbi__jpeg *j, int n)
 stbi_inline static int stbi__jpeg_get_bits(stbi__jpeg *j, int n)
 {
 	unsigned int k;
+	if (n <= 0)
+		return 0;
 	if (j->code_bits < n)
 		stbi__grow_buffer_unsafe(j);
-	k = stbi_lrot(j->code_buffer, n);
-	j->code_buffer = k & ~stbi__bmask[n];
-	k &= stbi__bmask[n];
+	k = (unsigned int)(j->code_buffer >> (64 - n));
+	j->code_buffer <<= n;
 	j->code_bits -= n;
 	return k;
 }
 
 stbi_inline static int stbi__jpeg_get_bit(stbi__jpeg *j)
 {
-	unsigned int k;
+	int k;
 	if (j->code_bits < 1)
 		stbi__grow_buffer_unsafe(j);
-	k = j->code_buffer;
+	k = (int)(j->code_buffer >> 63);
 	j->code_buffer <<= 1;
 	--j->code_bits;
-	return k & 0x80000000;
+	return k;
 }
 
 // given a value that's at position X in the zigzag stream,
@@ -304,8 +911,10 @@ static const stbi_uc stbi__jpeg_dezigzag[64 + 15] =
 		  63, 63, 63, 63, 63, 63, 63, 63,
 		  63, 63, 63, 63, 63, 63, 63};
 
-// decode one 64-entry block--
-static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__int16 *fac, int b, stbi__uint16 *dequant)
+// decode one 64-entry block--. returns 0 on error, otherwise one past the
+// zig-zag index of the last coefficient it could have set, so the IDCT can
+// tell how much of the block is zero
+static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__uint32 *mac, int b, stbi__uint16 *dequant)
 {
 	int diff, dc, k;
 	int t;
@@ -330,19 +939,39 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
 	{
 		unsigned int zig;
 		int c, r, s;
+		stbi__uint32 e;
 		if (j->code_bits < 16)
 			stbi__grow_buffer_unsafe(j);
-		c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
-		r = fac[c];
-		if (r)
-		{                      // fast-AC path
-			k += (r >> 4) & 15; // run
-			s = r & 15;         // combined length
+		// at a marker there can be fewer bits left than the table looks at
+		c = (int)(j->code_buffer >> (64 - MULTI_BITS));
+		e = j->code_bits >= MULTI_BITS ? mac[c] : 0;
+		if (e)
+		{ // one or two symbols at once
+			int v = (stbi__int32)(e << 8) >> 24;
+			s = e & 15;
+			k += (e >> 8) & 15; // run
+			if (v)
+			{
+				// decode into unzigzag'd location
+				zig = stbi__jpeg_dezigzag[k++];
+				data[zig] = (short)(v * dequant[zig]);
+				// the second symbol only counts if the block isn't full
+				if (k < 64 && (int)((e >> 4) & 15) > s)
+				{
+					s = (e >> 4) & 15;
+					v = (stbi__int32)e >> 24;
+					if (v)
+					{
+						k += (e >> 12) & 15;
+						zig = stbi__jpeg_dezigzag[k++];
+						data[zig] = (short)(v * dequant[zig]);
+					}
+				}
+			}
 			j->code_buffer <<= s;
 			j->code_bits -= s;
-			// decode into unzigzag'd location
-			zig = stbi__jpeg_dezigzag[k++];
-			data[zig] = (short)((r >> 8) * dequant[zig]);
+			if (!v)
+				break; // end block
 		}
 		else
 		{
@@ -366,6 +995,89 @@ static int stbi__jpeg_decode_block(stbi__jpeg *j, short data[64], stbi__huffman
 			}
 		}
 	} while (k < 64);
+	return k;
+}
+
+// decode a block without storing it, returning the DC difference
+static int stbi__jpeg_skip_block(stbi__jpeg *j, stbi__huffman *hdc, stbi__huffman *hac, stbi__uint32 *mac, int *diff)
+{
+	int k, t;
+
+	if (j->code_bits < 16)
+		stbi__grow_buffer_unsafe(j);
+	t = stbi__jpeg_huff_decode(j, hdc);
+	if (t < 0)
+		return 0;
+	*diff = t ? stbi__extend_receive(j, t) : 0;
+
+	// must consume exactly the bits stbi__jpeg_decode_block does
+	k = 1;
+	do
+	{
+		int c, r, s;
+		stbi__uint32 e;
+		if (j->code_bits < 16)
+			stbi__grow_buffer_unsafe(j);
+		// at a marker there can be fewer bits left than the table looks at
+		c = (int)(j->code_buffer >> (64 - MULTI_BITS));
+		e = j->code_bits >= MULTI_BITS ? mac[c] : 0;
+		if (e)
+		{
+			int v = (e >> 16) & 255;
+			s = e & 15;
+			k += (e >> 8) & 15;
+			if (v)
+			{
+				++k;
+				if (k < 64 && (int)((e >> 4) & 15) > s)
+				{
+					s = (e >> 4) & 15;
+					v = e >> 24;
+					if (v)
+						k += ((e >> 12) & 15) + 1;
+				}
+			}
+			j->code_buffer <<= s;
+			j->code_bits -= s;
+			if (!v)
+				break;
+		}
+		else
+		{
+			int rs = stbi__jpeg_huff_decode(j, hac);
+			if (rs < 0)
+				return 0;
+			s = rs & 15;
+			r = rs >> 4;
+			if (s == 0)
+			{
+				if (rs != 0xf0)
+					break;
+				k += 16;
+			}
+			else
+			{
+				k += r + 1;
+				stbi__extend_receive(j, s);
+			}
+		}
+	} while (k < 64);
+	return 1;
+}
+
+// decode a block for the current scale. a component reconstructed at 1/8
+// only ever uses the DC coefficient, so the AC coefficients are skipped
+// rather than stored. returns as stbi__jpeg_decode_block does
+static int stbi__jpeg_decode_block_scaled(stbi__jpeg *j, short data[64], stbi__huffman *hdc, stbi__huffman *hac, stbi__uint32 *mac, int b, stbi__uint16 *dequant)
+{
+	int diff, dc;
+	if (j->img_comp[b].bshift)
+		return stbi__jpeg_decode_block(j, data, hdc, hac, mac, b, dequant);
+	if (!stbi__jpeg_skip_block(j, hdc, hac, mac, &diff))
+		return stbi__err("bad huffman code", "Corrupt JPEG");
+	dc = j->img_comp[b].dc_pred + diff;
+	j->img_comp[b].dc_pred = dc;
+	data[0] = (short)(dc * dequant[0]);
 	return 1;
 }
 
@@ -426,7 +1138,7 @@ static int stbi__jpeg_decode_block_prog_ac(stbi__jpeg *j, short data[64], stbi__
 			int c, r, s;
 			if (j->code_bits < 16)
 				stbi__grow_buffer_unsafe(j);
-			c = (j->code_buffer >> (32 - FAST_BITS)) & ((1 << FAST_BITS) - 1);
+			c = (int)(j->code_buffer >> (64 - FAST_BITS));
 			r = fac[c];
 			if (r)
 			{                      // fast-AC path
@@ -678,35 +1390,269 @@ static void stbi__idct_block(stbi_uc *out, int out_stride, short data[64])
 	}
 }
 
-#ifdef STBI_SSE2
-// sse2 integer IDCT. not the fastest possible implementation but it
-// produces bit-identical results to the generic C version so it's
-// fully "transparent".
-static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
+// stbi__idct_block for a block whose coefficients all lie in the top left
+// 4x4: the terms from rows and columns 4-7 drop out, and so does the
+// column pass for columns 4-7. same results
+static void stbi__idct_block_low(stbi_uc *out, int out_stride, short data[64])
 {
-	// This is constructed to match our regular (generic) integer IDCT exactly.
-	__m128i row0, row1, row2, row3, row4, row5, row6, row7;
-	__m128i tmp;
+	int i, val[64], *v = val;
+	stbi_uc *o;
+	short *d = data;
 
-// dot product constant: even elems=x, odd elems=y
-#define dct_const(x, y) _mm_setr_epi16((x), (y), (x), (y), (x), (y), (x), (y))
+	// columns; the rest are zero, and the row pass doesn't read them
+	for (i = 0; i < 4; ++i, ++d, ++v)
+	{
+		STBI__IDCT_1D(d[0], d[8], d[16], d[24], 0, 0, 0, 0)
+		x0 += 512;
+		x1 += 512;
+		x2 += 512;
+		x3 += 512;
+		v[0] = (x0 + t3) >> 10;
+		v[56] = (x0 - t3) >> 10;
+		v[8] = (x1 + t2) >> 10;
+		v[48] = (x1 - t2) >> 10;
+		v[16] = (x2 + t1) >> 10;
+		v[40] = (x2 - t1) >> 10;
+		v[24] = (x3 + t0) >> 10;
+		v[32] = (x3 - t0) >> 10;
+	}
 
-// out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
-// out(1) = c1[even]*x + c1[odd]*y
-#define dct_rot(out0, out1, x, y, c0, c1)         \
-	__m128i c0##lo = _mm_unpacklo_epi16((x), (y)); \
-	__m128i c0##hi = _mm_unpackhi_epi16((x), (y)); \
-	__m128i out0##_l = _mm_madd_epi16(c0##lo, c0); \
-	__m128i out0##_h = _mm_madd_epi16(c0##hi, c0); \
-	__m128i out1##_l = _mm_madd_epi16(c0##lo, c1); \
-	__m128i out1##_h = _mm_madd_epi16(c0##hi, c1)
+	for (i = 0, v = val, o = out; i < 8; ++i, v += 8, o += out_stride)
+	{
+		STBI__IDCT_1D(v[0], v[1], v[2], v[3], 0, 0, 0, 0)
+		x0 += 65536 + (128 << 17);
+		x1 += 65536 + (128 << 17);
+		x2 += 65536 + (128 << 17);
+		x3 += 65536 + (128 << 17);
+		o[0] = stbi__clamp((x0 + t3) >> 17);
+		o[7] = stbi__clamp((x0 - t3) >> 17);
+		o[1] = stbi__clamp((x1 + t2) >> 17);
+		o[6] = stbi__clamp((x1 - t2) >> 17);
+		o[2] = stbi__clamp((x2 + t1) >> 17);
+		o[5] = stbi__clamp((x2 - t1) >> 17);
+		o[3] = stbi__clamp((x3 + t0) >> 17);
+		o[4] = stbi__clamp((x3 - t0) >> 17);
+	}
+}
 
-// out = in << 12  (in 16-bit, out 32-bit)
-#define dct_widen(out, in)                                                             \
-	__m128i out##_l = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (in)), 4); \
-	__m128i out##_h = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (in)), 4)
+// a block with only a DC coefficient is flat; this is what stbi__idct_block
+// works out to then
+static void stbi__idct_dc(stbi_uc *out, int out_stride, short data[64])
+{
+	int i;
+	stbi_uc v = stbi__clamp(((data[0] + 4) >> 3) + 128);
+	for (i = 0; i < 8; ++i, out += out_stride)
+		memset(out, v, 8);
+}
 
-// wide add
+// the AAN (Arai, Agui, Nakajima) IDCT from IJG's jidctfst, for
+// STBI_JPEG_FAST: 5 multiplies per 1D pass instead of 12, with 8-bit
+// constants. it needs each coefficient scaled by stbi__aan_scale first,
+// which is folded into dequant_aan along with 3 bits of extra precision.
+// coefficients can't be much over 1024 in magnitude, so that still fits
+// close to stbi__idct_block, but not the same
+#define stbi__aan(x) ((int)((x)*256 + 0.5))
+#define stbi__aan_mul(v, x) (((v)*stbi__aan(x)) >> 8)
+
+// cos(k*pi/16) * sqrt(2) for the row and column, k=0 counting as 1, in 2.14
+static const stbi__uint16 stbi__aan_scale[64] = {
+	16384, 22725, 21407, 19266, 16384, 12873, 8867, 4520,
+	22725, 31521, 29692, 26722, 22725, 17855, 12299, 6270,
+	21407, 29692, 27969, 25172, 21407, 16819, 11585, 5906,
+	19266, 26722, 25172, 22654, 19266, 15137, 10426, 5315,
+	16384, 22725, 21407, 19266, 16384, 12873, 8867, 4520,
+	12873, 17855, 16819, 15137, 12873, 10114, 6967, 3552,
+	8867, 12299, 11585, 10426, 8867, 6967, 4799, 2446,
+	4520, 6270, 5906, 5315, 4520, 3552, 2446, 1247};
+
+#define STBI__AAN_1D(s0, s1, s2, s3, s4, s5, s6, s7)           \
+	int e0, e1, e2, e3, o4, o5, o6, o7, z10, z11, z12, z13, z5; \
+	e0 = (s0) + (s4);                                           \
+	e1 = (s0) - (s4);                                           \
+	e3 = (s2) + (s6);                                           \
+	e2 = stbi__aan_mul((s2) - (s6), 1.414213562f) - e3;         \
+	z10 = e0;                                                   \
+	e0 += e3;                                                   \
+	e3 = z10 - e3;                                              \
+	z10 = e1;                                                   \
+	e1 += e2;                                                   \
+	e2 = z10 - e2;                                              \
+	z13 = (s5) + (s3);                                          \
+	z10 = (s5) - (s3);                                          \
+	z11 = (s1) + (s7);                                          \
+	z12 = (s1) - (s7);                                          \
+	o7 = z11 + z13;                                             \
+	z5 = stbi__aan_mul(z10 + z12, 1.847759065f);                \
+	o6 = (z10 * -stbi__aan(2.613125930f) >> 8) + z5 - o7;       \
+	o5 = stbi__aan_mul(z11 - z13, 1.414213562f) - o6;           \
+	o4 = stbi__aan_mul(z12, 1.082392200f) - z5 + o5;
+
+static void stbi__idct_block_aan(stbi_uc *out, int out_stride, short data[64])
+{
+	int i, val[64], *v = val;
+	stbi_uc *o;
+	short *d = data;
+
+	// columns
+	for (i = 0; i < 8; ++i, ++d, ++v)
+	{
+		if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[32] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0)
+		{
+			v[0] = v[8] = v[16] = v[24] = v[32] = v[40] = v[48] = v[56] = d[0];
+		}
+		else
+		{
+			STBI__AAN_1D(d[0], d[8], d[16], d[24], d[32], d[40], d[48], d[56])
+			v[0] = e0 + o7;
+			v[56] = e0 - o7;
+			v[8] = e1 + o6;
+			v[48] = e1 - o6;
+			v[16] = e2 + o5;
+			v[40] = e2 - o5;
+			v[32] = e3 + o4;
+			v[24] = e3 - o4;
+		}
+	}
+
+	for (i = 0, v = val, o = out; i < 8; ++i, v += 8, o += out_stride)
+	{
+		// the 3 extra bits and the 1/8 of the 2D transform come off here,
+		// rounded, with the +128 added first
+		STBI__AAN_1D(v[0] + (32 + (128 << 6)), v[1], v[2], v[3], v[4], v[5], v[6], v[7])
+		o[0] = stbi__clamp((e0 + o7) >> 6);
+		o[7] = stbi__clamp((e0 - o7) >> 6);
+		o[1] = stbi__clamp((e1 + o6) >> 6);
+		o[6] = stbi__clamp((e1 - o6) >> 6);
+		o[2] = stbi__clamp((e2 + o5) >> 6);
+		o[5] = stbi__clamp((e2 - o5) >> 6);
+		o[4] = stbi__clamp((e3 + o4) >> 6);
+		o[3] = stbi__clamp((e3 - o4) >> 6);
+	}
+}
+
+// stbi__idct_dc for a block dequantized with dequant_aan
+static void stbi__idct_dc_aan(stbi_uc *out, int out_stride, short data[64])
+{
+	int i;
+	stbi_uc v = stbi__clamp(((data[0] + 32) >> 6) + 128);
+	for (i = 0; i < 8; ++i, out += out_stride)
+		memset(out, v, 8);
+}
+
+// reduced IDCTs for scaled decoding. each output pixel is the 8x8 IDCT
+// averaged over the 2x2 or 4x4 pixels it replaces, which cancels some of
+// the coefficients outright (same idea as IJG's jidctred). the fixed point
+// scaling is the same as stbi__idct_block's.
+#define STBI__IDCT4_1D(s0, s1, s2, s3, s5, s6, s7)                                                                     \
+	int e0, e1, o0, o1;                                                                                                  \
+	o0 = (s2)*stbi__f2f(0.923879533f) + (s6)*stbi__f2f(-0.382683432f);                                                   \
+	e0 = stbi__fsh(s0) + o0;                                                                                             \
+	e1 = stbi__fsh(s0) - o0;                                                                                             \
+	o0 = (s1)*stbi__f2f(1.281457724f) + (s3)*stbi__f2f(0.449988112f) + (s5)*stbi__f2f(-0.300672443f) + (s7)*stbi__f2f(-0.254897790f); \
+	o1 = (s1)*stbi__f2f(0.530797169f) + (s3)*stbi__f2f(-1.086367402f) + (s5)*stbi__f2f(0.725887491f) + (s7)*stbi__f2f(-0.105582121f);
+
+#define STBI__IDCT2_1D(s0, s1, s3, s5, s7) \
+	int e0, o0;                            \
+	e0 = stbi__fsh(s0);                    \
+	o0 = (s1)*stbi__f2f(0.906127446f) + (s3)*stbi__f2f(-0.318189645f) + (s5)*stbi__f2f(0.212607524f) + (s7)*stbi__f2f(-0.180239956f);
+
+static void stbi__idct_4x4(stbi_uc *out, int out_stride, short data[64])
+{
+	int i, val[32], *v = val;
+	stbi_uc *o;
+	short *d = data;
+
+	// columns; the rows never look at column 4
+	for (i = 0; i < 8; ++i, ++d, ++v)
+	{
+		if (i == 4)
+			continue;
+		if (d[8] == 0 && d[16] == 0 && d[24] == 0 && d[40] == 0 && d[48] == 0 && d[56] == 0)
+		{
+			v[0] = v[8] = v[16] = v[24] = d[0] * 4;
+		}
+		else
+		{
+			STBI__IDCT4_1D(d[0], d[8], d[16], d[24], d[40], d[48], d[56])
+			e0 += 512;
+			e1 += 512;
+			v[0] = (e0 + o0) >> 10;
+			v[24] = (e0 - o0) >> 10;
+			v[8] = (e1 + o1) >> 10;
+			v[16] = (e1 - o1) >> 10;
+		}
+	}
+
+	for (i = 0, v = val, o = out; i < 4; ++i, v += 8, o += out_stride)
+	{
+		STBI__IDCT4_1D(v[0], v[1], v[2], v[3], v[5], v[6], v[7])
+		e0 += 65536 + (128 << 17);
+		e1 += 65536 + (128 << 17);
+		o[0] = stbi__clamp((e0 + o0) >> 17);
+		o[3] = stbi__clamp((e0 - o0) >> 17);
+		o[1] = stbi__clamp((e1 + o1) >> 17);
+		o[2] = stbi__clamp((e1 - o1) >> 17);
+	}
+}
+
+static void stbi__idct_2x2(stbi_uc *out, int out_stride, short data[64])
+{
+	int i, val[16], *v;
+
+	// columns; the rows only need the DC and odd columns
+	for (i = 0; i < 8; i += i ? 2 : 1)
+	{
+		STBI__IDCT2_1D(data[i], data[i + 8], data[i + 24], data[i + 40], data[i + 56])
+		e0 += 512;
+		val[i] = (e0 + o0) >> 10;
+		val[i + 8] = (e0 - o0) >> 10;
+	}
+
+	for (i = 0, v = val; i < 2; ++i, v += 8, out += out_stride)
+	{
+		STBI__IDCT2_1D(v[0], v[1], v[3], v[5], v[7])
+		e0 += 65536 + (128 << 17);
+		out[0] = stbi__clamp((e0 + o0) >> 17);
+		out[1] = stbi__clamp((e0 - o0) >> 17);
+	}
+}
+
+// 1/8 only needs the average of the block, which is the DC coefficient
+static void stbi__idct_1x1(stbi_uc *out, int out_stride, short data[64])
+{
+	STBI_NOTUSED(out_stride);
+	out[0] = stbi__clamp(((data[0] + 4) >> 3) + 128);
+}
+
+#ifdef STBI_SSE2
+// sse2 integer IDCT. not the fastest possible implementation but it
+// produces bit-identical results to the generic C version so it's
+// fully "transparent".
+static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
+{
+	// This is constructed to match our regular (generic) integer IDCT exactly.
+	__m128i row0, row1, row2, row3, row4, row5, row6, row7;
+	__m128i tmp;
+
+// dot product constant: even elems=x, odd elems=y
+#define dct_const(x, y) _mm_setr_epi16((x), (y), (x), (y), (x), (y), (x), (y))
+
+// out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+// out(1) = c1[even]*x + c1[odd]*y
+#define dct_rot(out0, out1, x, y, c0, c1)         \
+	__m128i c0##lo = _mm_unpacklo_epi16((x), (y)); \
+	__m128i c0##hi = _mm_unpackhi_epi16((x), (y)); \
+	__m128i out0##_l = _mm_madd_epi16(c0##lo, c0); \
+	__m128i out0##_h = _mm_madd_epi16(c0##hi, c0); \
+	__m128i out1##_l = _mm_madd_epi16(c0##lo, c1); \
+	__m128i out1##_h = _mm_madd_epi16(c0##hi, c1)
+
+// out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in)                                                             \
+	__m128i out##_l = _mm_srai_epi32(_mm_unpacklo_epi16(_mm_setzero_si128(), (in)), 4); \
+	__m128i out##_h = _mm_srai_epi32(_mm_unpackhi_epi16(_mm_setzero_si128(), (in)), 4)
+
+// wide add
 #define dct_wadd(out, a, b)                       \
 	__m128i out##_l = _mm_add_epi32(a##_l, b##_l); \
 	__m128i out##_h = _mm_add_epi32(a##_h, b##_h)
@@ -767,6 +1713,41 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 		dct_bfly32o(row3, row4, x3, x4, bias, shift);    \
 	}
 
+// pack to bytes, transpose back and store
+#define dct_pack_store(out, out_stride)                                           \
+	{                                                                              \
+		/* pack */                                                                  \
+		__m128i p0 = _mm_packus_epi16(row0, row1); /* a0a1a2a3...a7b0b1b2b3...b7 */ \
+		__m128i p1 = _mm_packus_epi16(row2, row3);                                  \
+		__m128i p2 = _mm_packus_epi16(row4, row5);                                  \
+		__m128i p3 = _mm_packus_epi16(row6, row7);                                  \
+		/* 8bit 8x8 transpose pass 1 */                                             \
+		dct_interleave8(p0, p2); /* a0e0a1e1... */                                  \
+		dct_interleave8(p1, p3); /* c0g0c1g1... */                                  \
+		/* transpose pass 2 */                                                      \
+		dct_interleave8(p0, p1); /* a0c0e0g0... */                                  \
+		dct_interleave8(p2, p3); /* b0d0f0h0... */                                  \
+		/* transpose pass 3 */                                                      \
+		dct_interleave8(p0, p2); /* a0b0c0d0... */                                  \
+		dct_interleave8(p1, p3); /* a4b4c4d4... */                                  \
+		/* store */                                                                 \
+		_mm_storel_epi64((__m128i *)out, p0);                                       \
+		out += out_stride;                                                          \
+		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p0, 0x4e));              \
+		out += out_stride;                                                          \
+		_mm_storel_epi64((__m128i *)out, p2);                                       \
+		out += out_stride;                                                          \
+		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p2, 0x4e));              \
+		out += out_stride;                                                          \
+		_mm_storel_epi64((__m128i *)out, p1);                                       \
+		out += out_stride;                                                          \
+		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p1, 0x4e));              \
+		out += out_stride;                                                          \
+		_mm_storel_epi64((__m128i *)out, p3);                                       \
+		out += out_stride;                                                          \
+		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p3, 0x4e));              \
+	}
+
 	__m128i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
 	__m128i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
 	__m128i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
@@ -816,12 +1797,291 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 	// row pass
 	dct_pass(bias_1, 17);
 
+	dct_pack_store(out, out_stride);
+}
+
+// stbi__idct_simd for a block whose coefficients all lie in the top left
+// 4x4. the column pass only has four columns to do, so it's done in 32-bit
+// lanes straight away, and neither pass needs the terms from rows 4-7
+static void stbi__idct_simd_low(stbi_uc *out, int out_stride, short data[64])
+{
+	__m128i row0, row1, row2, row3, row4, row5, row6, row7;
+	__m128i tmp;
+	__m128i zero = _mm_setzero_si128();
+
+	__m128i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+	__m128i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+	__m128i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+	__m128i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+	__m128i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+	__m128i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+	__m128i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+	__m128i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+	__m128i bias_0 = _mm_set1_epi32(512);
+	__m128i bias_1 = _mm_set1_epi32(65536 + (128 << 17));
+
+	// column pass, columns 0-3 of rows 0-3 in
+	{
+		__m128i c0 = _mm_loadl_epi64((const __m128i *)(data + 0 * 8));
+		__m128i c1 = _mm_loadl_epi64((const __m128i *)(data + 1 * 8));
+		__m128i c2 = _mm_loadl_epi64((const __m128i *)(data + 2 * 8));
+		__m128i c3 = _mm_loadl_epi64((const __m128i *)(data + 3 * 8));
+		__m128i c20 = _mm_unpacklo_epi16(c2, zero);
+		__m128i c03 = _mm_unpacklo_epi16(zero, c3);
+		__m128i c01 = _mm_unpacklo_epi16(zero, c1);
+		__m128i c13 = _mm_unpacklo_epi16(c1, c3);
+		// even part, with the bias in
+		__m128i t2e = _mm_madd_epi16(c20, rot0_0);
+		__m128i t3e = _mm_madd_epi16(c20, rot0_1);
+		__m128i t0e = _mm_add_epi32(_mm_srai_epi32(_mm_unpacklo_epi16(zero, c0), 4), bias_0);
+		__m128i x0 = _mm_add_epi32(t0e, t3e);
+		__m128i x3 = _mm_sub_epi32(t0e, t3e);
+		__m128i x1 = _mm_add_epi32(t0e, t2e);
+		__m128i x2 = _mm_sub_epi32(t0e, t2e);
+		// odd part
+		__m128i y4o = _mm_madd_epi16(c13, rot1_0);
+		__m128i y5o = _mm_madd_epi16(c13, rot1_1);
+		__m128i x4 = _mm_add_epi32(_mm_madd_epi16(c03, rot2_0), y4o);
+		__m128i x5 = _mm_add_epi32(_mm_madd_epi16(c01, rot3_0), y5o);
+		__m128i x6 = _mm_add_epi32(_mm_madd_epi16(c03, rot2_1), y5o);
+		__m128i x7 = _mm_add_epi32(_mm_madd_epi16(c01, rot3_1), y4o);
+		// rows 0-7 of the four columns, two rows a register
+		__m128i r01 = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(x0, x7), 10), _mm_srai_epi32(_mm_add_epi32(x1, x6), 10));
+		__m128i r23 = _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(x2, x5), 10), _mm_srai_epi32(_mm_add_epi32(x3, x4), 10));
+		__m128i r45 = _mm_packs_epi32(_mm_srai_epi32(_mm_sub_epi32(x3, x4), 10), _mm_srai_epi32(_mm_sub_epi32(x2, x5), 10));
+		__m128i r67 = _mm_packs_epi32(_mm_srai_epi32(_mm_sub_epi32(x1, x6), 10), _mm_srai_epi32(_mm_sub_epi32(x0, x7), 10));
+
+		// transpose to columns 0-3, 8 rows each; columns 4-7 are zero
+		__m128i a0 = _mm_unpacklo_epi16(r01, r23); // r0c0 r2c0 r0c1 r2c1 ...
+		__m128i a1 = _mm_unpackhi_epi16(r01, r23); // r1c0 r3c0 r1c1 r3c1 ...
+		__m128i b0 = _mm_unpacklo_epi16(r45, r67);
+		__m128i b1 = _mm_unpackhi_epi16(r45, r67);
+		__m128i a01 = _mm_unpacklo_epi16(a0, a1); // r0c0 r1c0 r2c0 r3c0 r0c1 ...
+		__m128i a23 = _mm_unpackhi_epi16(a0, a1);
+		__m128i b01 = _mm_unpacklo_epi16(b0, b1);
+		__m128i b23 = _mm_unpackhi_epi16(b0, b1);
+		row0 = _mm_unpacklo_epi64(a01, b01);
+		row1 = _mm_unpackhi_epi64(a01, b01);
+		row2 = _mm_unpacklo_epi64(a23, b23);
+		row3 = _mm_unpackhi_epi64(a23, b23);
+	}
+
+	// row pass, rows 4-7 zero
+	{
+		dct_rot(t2e, t3e, row2, zero, rot0_0, rot0_1);
+		dct_widen(t0e, row0);
+		dct_wadd(x0, t0e, t3e);
+		dct_wsub(x3, t0e, t3e);
+		dct_wadd(x1, t0e, t2e);
+		dct_wsub(x2, t0e, t2e);
+		dct_rot(y0o, y2o, zero, row3, rot2_0, rot2_1);
+		dct_rot(y1o, y3o, zero, row1, rot3_0, rot3_1);
+		dct_rot(y4o, y5o, row1, row3, rot1_0, rot1_1);
+		dct_wadd(x4, y0o, y4o);
+		dct_wadd(x5, y1o, y5o);
+		dct_wadd(x6, y2o, y5o);
+		dct_wadd(x7, y3o, y4o);
+		dct_bfly32o(row0, row7, x0, x7, bias_1, 17);
+		dct_bfly32o(row1, row6, x1, x6, bias_1, 17);
+		dct_bfly32o(row2, row5, x2, x5, bias_1, 17);
+		dct_bfly32o(row3, row4, x3, x4, bias_1, 17);
+	}
+
+	dct_pack_store(out, out_stride);
+
+#undef dct_const
+#undef dct_rot
+#undef dct_widen
+#undef dct_wadd
+#undef dct_wsub
+#undef dct_bfly32o
+#undef dct_interleave8
+#undef dct_interleave16
+#undef dct_pass
+#undef dct_pack_store
+}
+
+#endif // STBI_SSE2
+
+// AVX2 needs a runtime check, and on gcc/clang a per-function target so the
+// rest of the file still builds for plain SSE2
+#if defined(STBI_SSE2) && !defined(STBI_NO_AVX2) && (defined(__x86_64__) || defined(_M_X64)) && (defined(__GNUC__) || defined(_MSC_VER))
+#define STBI_AVX2
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define STBI__AVX2_TARGET
+static int stbi__avx2_available(void)
+{
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return 0;
+	// the OS has to save the YMM registers too
+	__cpuid(info, 1);
+	if ((info[2] & (3 << 27)) != (3 << 27) || (_xgetbv(0) & 6) != 6)
+		return 0;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+}
+#else
+#define STBI__AVX2_TARGET __attribute__((target("avx2")))
+static int stbi__avx2_available(void)
+{
+	return __builtin_cpu_supports("avx2");
+}
+#endif
+#endif
+
+#ifdef STBI_AVX2
+// avx2 integer IDCT of two blocks at once, one per 128-bit lane. every
+// step is the sse2 IDCT's, and avx2's unpacks and packs work within a
+// lane, so each block gets exactly the same arithmetic: bit-identical
+// to the generic C version as well.
+static STBI__AVX2_TARGET void stbi__idct_simd2(stbi_uc *out0, stbi_uc *out1, int out_stride, short *data0, short *data1)
+{
+	__m256i row0, row1, row2, row3, row4, row5, row6, row7;
+	__m256i tmp;
+	int i;
+
+// dot product constant: even elems=x, odd elems=y
+#define dct_const(x, y) _mm256_set1_epi32((int)(((unsigned int)(y) << 16) | ((unsigned int)(x) & 0xffff)))
+
+// out(0) = c0[even]*x + c0[odd]*y   (c0, x, y 16-bit, out 32-bit)
+// out(1) = c1[even]*x + c1[odd]*y
+#define dct_rot(out0, out1, x, y, c0, c1)            \
+	__m256i c0##lo = _mm256_unpacklo_epi16((x), (y)); \
+	__m256i c0##hi = _mm256_unpackhi_epi16((x), (y)); \
+	__m256i out0##_l = _mm256_madd_epi16(c0##lo, c0); \
+	__m256i out0##_h = _mm256_madd_epi16(c0##hi, c0); \
+	__m256i out1##_l = _mm256_madd_epi16(c0##lo, c1); \
+	__m256i out1##_h = _mm256_madd_epi16(c0##hi, c1)
+
+// out = in << 12  (in 16-bit, out 32-bit)
+#define dct_widen(out, in)                                                                      \
+	__m256i out##_l = _mm256_srai_epi32(_mm256_unpacklo_epi16(_mm256_setzero_si256(), (in)), 4); \
+	__m256i out##_h = _mm256_srai_epi32(_mm256_unpackhi_epi16(_mm256_setzero_si256(), (in)), 4)
+
+// wide add
+#define dct_wadd(out, a, b)                          \
+	__m256i out##_l = _mm256_add_epi32(a##_l, b##_l); \
+	__m256i out##_h = _mm256_add_epi32(a##_h, b##_h)
+
+// wide sub
+#define dct_wsub(out, a, b)                          \
+	__m256i out##_l = _mm256_sub_epi32(a##_l, b##_l); \
+	__m256i out##_h = _mm256_sub_epi32(a##_h, b##_h)
+
+// butterfly a/b, add bias, then shift by "s" and pack
+#define dct_bfly32o(out0, out1, a, b, bias, s)                                             \
+	{                                                                                       \
+		__m256i abiased_l = _mm256_add_epi32(a##_l, bias);                                   \
+		__m256i abiased_h = _mm256_add_epi32(a##_h, bias);                                   \
+		dct_wadd(sum, abiased, b);                                                           \
+		dct_wsub(dif, abiased, b);                                                           \
+		out0 = _mm256_packs_epi32(_mm256_srai_epi32(sum_l, s), _mm256_srai_epi32(sum_h, s)); \
+		out1 = _mm256_packs_epi32(_mm256_srai_epi32(dif_l, s), _mm256_srai_epi32(dif_h, s)); \
+	}
+
+// 8-bit interleave step (for transposes)
+#define dct_interleave8(a, b)      \
+	tmp = a;                        \
+	a = _mm256_unpacklo_epi8(a, b); \
+	b = _mm256_unpackhi_epi8(tmp, b)
+
+// 16-bit interleave step (for transposes)
+#define dct_interleave16(a, b)      \
+	tmp = a;                         \
+	a = _mm256_unpacklo_epi16(a, b); \
+	b = _mm256_unpackhi_epi16(tmp, b)
+
+// one row of each block, block 0 in the low lane
+#define dct_load(r) _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_load_si128((const __m128i *)(data0 + (r)*8))), _mm_load_si128((const __m128i *)(data1 + (r)*8)), 1)
+
+#define dct_pass(bias, shift)                          \
+	{                                                   \
+		/* even part */                                  \
+		dct_rot(t2e, t3e, row2, row6, rot0_0, rot0_1);   \
+		__m256i sum04 = _mm256_add_epi16(row0, row4);    \
+		__m256i dif04 = _mm256_sub_epi16(row0, row4);    \
+		dct_widen(t0e, sum04);                           \
+		dct_widen(t1e, dif04);                           \
+		dct_wadd(x0, t0e, t3e);                          \
+		dct_wsub(x3, t0e, t3e);                          \
+		dct_wadd(x1, t1e, t2e);                          \
+		dct_wsub(x2, t1e, t2e);                          \
+		/* odd part */                                   \
+		dct_rot(y0o, y2o, row7, row3, rot2_0, rot2_1);   \
+		dct_rot(y1o, y3o, row5, row1, rot3_0, rot3_1);   \
+		__m256i sum17 = _mm256_add_epi16(row1, row7);    \
+		__m256i sum35 = _mm256_add_epi16(row3, row5);    \
+		dct_rot(y4o, y5o, sum17, sum35, rot1_0, rot1_1); \
+		dct_wadd(x4, y0o, y4o);                          \
+		dct_wadd(x5, y1o, y5o);                          \
+		dct_wadd(x6, y2o, y5o);                          \
+		dct_wadd(x7, y3o, y4o);                          \
+		dct_bfly32o(row0, row7, x0, x7, bias, shift);    \
+		dct_bfly32o(row1, row6, x1, x6, bias, shift);    \
+		dct_bfly32o(row2, row5, x2, x5, bias, shift);    \
+		dct_bfly32o(row3, row4, x3, x4, bias, shift);    \
+	}
+
+	__m256i rot0_0 = dct_const(stbi__f2f(0.5411961f), stbi__f2f(0.5411961f) + stbi__f2f(-1.847759065f));
+	__m256i rot0_1 = dct_const(stbi__f2f(0.5411961f) + stbi__f2f(0.765366865f), stbi__f2f(0.5411961f));
+	__m256i rot1_0 = dct_const(stbi__f2f(1.175875602f) + stbi__f2f(-0.899976223f), stbi__f2f(1.175875602f));
+	__m256i rot1_1 = dct_const(stbi__f2f(1.175875602f), stbi__f2f(1.175875602f) + stbi__f2f(-2.562915447f));
+	__m256i rot2_0 = dct_const(stbi__f2f(-1.961570560f) + stbi__f2f(0.298631336f), stbi__f2f(-1.961570560f));
+	__m256i rot2_1 = dct_const(stbi__f2f(-1.961570560f), stbi__f2f(-1.961570560f) + stbi__f2f(3.072711026f));
+	__m256i rot3_0 = dct_const(stbi__f2f(-0.390180644f) + stbi__f2f(2.053119869f), stbi__f2f(-0.390180644f));
+	__m256i rot3_1 = dct_const(stbi__f2f(-0.390180644f), stbi__f2f(-0.390180644f) + stbi__f2f(1.501321110f));
+
+	// rounding biases in column/row passes, see stbi__idct_block for explanation.
+	__m256i bias_0 = _mm256_set1_epi32(512);
+	__m256i bias_1 = _mm256_set1_epi32(65536 + (128 << 17));
+
+	// load
+	row0 = dct_load(0);
+	row1 = dct_load(1);
+	row2 = dct_load(2);
+	row3 = dct_load(3);
+	row4 = dct_load(4);
+	row5 = dct_load(5);
+	row6 = dct_load(6);
+	row7 = dct_load(7);
+
+	// column pass
+	dct_pass(bias_0, 10);
+
+	{
+		// 16bit 8x8 transpose pass 1
+		dct_interleave16(row0, row4);
+		dct_interleave16(row1, row5);
+		dct_interleave16(row2, row6);
+		dct_interleave16(row3, row7);
+
+		// transpose pass 2
+		dct_interleave16(row0, row2);
+		dct_interleave16(row1, row3);
+		dct_interleave16(row4, row6);
+		dct_interleave16(row5, row7);
+
+		// transpose pass 3
+		dct_interleave16(row0, row1);
+		dct_interleave16(row2, row3);
+		dct_interleave16(row4, row5);
+		dct_interleave16(row6, row7);
+	}
+
+	// row pass
+	dct_pass(bias_1, 17);
+
 	{
 		// pack
-		__m128i p0 = _mm_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
-		__m128i p1 = _mm_packus_epi16(row2, row3);
-		__m128i p2 = _mm_packus_epi16(row4, row5);
-		__m128i p3 = _mm_packus_epi16(row6, row7);
+		__m256i p0 = _mm256_packus_epi16(row0, row1); // a0a1a2a3...a7b0b1b2b3...b7
+		__m256i p1 = _mm256_packus_epi16(row2, row3);
+		__m256i p2 = _mm256_packus_epi16(row4, row5);
+		__m256i p3 = _mm256_packus_epi16(row6, row7);
 
 		// 8bit 8x8 transpose pass 1
 		dct_interleave8(p0, p2); // a0e0a1e1...
@@ -835,22 +2095,30 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 		dct_interleave8(p0, p2); // a0b0c0d0...
 		dct_interleave8(p1, p3); // a4b4c4d4...
 
-		// store
-		_mm_storel_epi64((__m128i *)out, p0);
-		out += out_stride;
-		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p0, 0x4e));
-		out += out_stride;
-		_mm_storel_epi64((__m128i *)out, p2);
-		out += out_stride;
-		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p2, 0x4e));
-		out += out_stride;
-		_mm_storel_epi64((__m128i *)out, p1);
-		out += out_stride;
-		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p1, 0x4e));
-		out += out_stride;
-		_mm_storel_epi64((__m128i *)out, p3);
-		out += out_stride;
-		_mm_storel_epi64((__m128i *)out, _mm_shuffle_epi32(p3, 0x4e));
+		// rows 0,1 of each block are in p0, 2,3 in p2, 4,5 in p1, 6,7 in p3
+		for (i = 0; i < 2; ++i)
+		{
+			stbi_uc *out = i ? out1 : out0;
+			__m128i q0 = i ? _mm256_extracti128_si256(p0, 1) : _mm256_castsi256_si128(p0);
+			__m128i q1 = i ? _mm256_extracti128_si256(p1, 1) : _mm256_castsi256_si128(p1);
+			__m128i q2 = i ? _mm256_extracti128_si256(p2, 1) : _mm256_castsi256_si128(p2);
+			__m128i q3 = i ? _mm256_extracti128_si256(p3, 1) : _mm256_castsi256_si128(p3);
+			_mm_storel_epi64((__m128i *)out, q0);
+			out += out_stride;
+			_mm_storel_epi64((__m128i *)out, _mm_unpackhi_epi64(q0, q0));
+			out += out_stride;
+			_mm_storel_epi64((__m128i *)out, q2);
+			out += out_stride;
+			_mm_storel_epi64((__m128i *)out, _mm_unpackhi_epi64(q2, q2));
+			out += out_stride;
+			_mm_storel_epi64((__m128i *)out, q1);
+			out += out_stride;
+			_mm_storel_epi64((__m128i *)out, _mm_unpackhi_epi64(q1, q1));
+			out += out_stride;
+			_mm_storel_epi64((__m128i *)out, q3);
+			out += out_stride;
+			_mm_storel_epi64((__m128i *)out, _mm_unpackhi_epi64(q3, q3));
+		}
 	}
 
 #undef dct_const
@@ -861,10 +2129,10 @@ static void stbi__idct_simd(stbi_uc *out, int out_stride, short data[64])
 #undef dct_bfly32o
 #undef dct_interleave8
 #undef dct_interleave16
+#undef dct_load
 #undef dct_pass
 }
-
-#endif // STBI_SSE2
+#endif // STBI_AVX2
 
 #ifdef STBI_NEON
 
@@ -1152,725 +2420,2082 @@ static void stbi__jpeg_reset(stbi__jpeg *j)
 	// since we don't even allow 1<<30 pixels
 }
 
-static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
+// position of the next unread bit. the bytes still in the bit buffer are
+// walked back over, counting a stuffed 0xff 0x00 as the one byte it is.
+// meaningless once a marker has been hit.
+static size_t stbi__jpeg_bit_pos(stbi__jpeg *z, stbi_uc *base)
+{
+	stbi_uc *p = z->s->img_buffer;
+	int bits = z->code_bits;
+	while (bits > 0)
+	{
+		p -= p - base >= 2 && p[-1] == 0 && p[-2] == 0xff ? 2 : 1;
+		bits -= 8;
+	}
+	return (size_t)(p - base) * 8 - bits;
+}
+
+// point a freshly reset decoder at a bit position
+static void stbi__jpeg_seek_bit(stbi__jpeg *z, stbi_uc *base, size_t pos)
 {
+	z->s->img_buffer = base + pos / 8;
 	stbi__jpeg_reset(z);
-	if (!z->progressive)
+	if (pos & 7)
+		stbi__jpeg_get_bits(z, (int)(pos & 7));
+}
+
+// number of blocks covering 'pixels' of a component. component sizes are
+// scaled, but rounding up twice is the same as rounding up once, so this
+// is also the number of blocks in the full-size image.
+static int stbi__jpeg_blocks(int pixels, int bshift)
+{
+	return (pixels + (1 << bshift) - 1) >> bshift;
+}
+
+// number of MCUs in the current scan; for a non-interleaved scan every
+// block is an MCU
+static int stbi__jpeg_scan_mcus(stbi__jpeg *z)
+{
+	if (z->scan_n == 1)
 	{
-		if (z->scan_n == 1)
-		{
-			int i, j;
-			STBI_SIMD_ALIGN(short, data[64]);
-			int n = z->order[0];
-			// non-interleaved data, we just need to process one block at a time,
-			// in trivial scanline order
-			// number of blocks to do just depends on how many actual "pixels" this
-			// component has, independent of interleaved MCU blocking and such
-			int w = (z->img_comp[n].x + 7) >> 3;
-			int h = (z->img_comp[n].y + 7) >> 3;
-			for (j = 0; j < h; ++j)
-			{
-				for (i = 0; i < w; ++i)
-				{
-					int ha = z->img_comp[n].ha;
-					if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq]))
-						return 0;
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
-					// every data block is an MCU, so countdown the restart interval
-					if (--z->todo <= 0)
-					{
-						if (z->code_bits < 24)
-							stbi__grow_buffer_unsafe(z);
-						// if it's NOT a restart, then just bail, so we get corrupt data
-						// rather than no data
-						if (!STBI__RESTART(z->marker))
-							return 1;
-						stbi__jpeg_reset(z);
-					}
-				}
-			}
-			return 1;
-		}
-		else
-		{ // interleaved
-			int i, j, k, x, y;
-			STBI_SIMD_ALIGN(short, data[64]);
-			for (j = 0; j < z->img_mcu_y; ++j)
+		int n = z->order[0];
+		return stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].bshift) * stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].bshift);
+	}
+	return z->img_mcu_x * z->img_mcu_y;
+}
+
+// number of MCU rows at the top of the image the output region depends on
+static int stbi__jpeg_mcu_rows_used(stbi__jpeg *z)
+{
+	int k, rows = 0;
+	for (k = 0; k < z->s->img_n; ++k)
+	{
+		int r = (z->img_comp[k].by1 - 1) / z->img_comp[k].v + 1;
+		if (r > rows)
+			rows = r;
+	}
+	return rows < z->img_mcu_y ? rows : z->img_mcu_y;
+}
+
+// number of MCUs at the start of the current scan that have to be decoded:
+// a scan can stop after the last block under the output region, though
+// only if that's smaller than the image. interleaved scans stop at the end
+// of an MCU row, so every block a later non-interleaved scan reaches has
+// been through the first DC scan (progressive refinement depends on which
+// coefficients are already nonzero)
+static int stbi__jpeg_scan_end(stbi__jpeg *z)
+{
+	if (z->crop_w == (int)z->s->img_x && z->crop_h == (int)z->s->img_y)
+		return stbi__jpeg_scan_mcus(z);
+	if (z->scan_n == 1)
+	{
+		int n = z->order[0];
+		int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].bshift);
+		int h = stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].bshift);
+		return ((z->img_comp[n].by1 < h ? z->img_comp[n].by1 : h) - 1) * w + (z->img_comp[n].bx1 < w ? z->img_comp[n].bx1 : w);
+	}
+	return stbi__jpeg_mcu_rows_used(z) * z->img_mcu_x;
+}
+
+// whether block (bx,by) of component n is under the output region
+static int stbi__jpeg_block_used(stbi__jpeg *z, int n, int bx, int by)
+{
+	return bx >= z->img_comp[n].bx0 && bx < z->img_comp[n].bx1 && by >= z->img_comp[n].by0 && by < z->img_comp[n].by1;
+}
+
+// number of blocks in one MCU of the current scan
+static int stbi__jpeg_blocks_per_mcu(stbi__jpeg *z)
+{
+	int k, n = 0;
+	if (z->scan_n == 1)
+		return 1;
+	for (k = 0; k < z->scan_n; ++k)
+		n += z->img_comp[z->order[k]].h * z->img_comp[z->order[k]].v;
+	return n;
+}
+
+// how much of a block has coefficients in it, which picks the IDCT
+#define STBI__IDCT_DC 0   // just the DC coefficient
+#define STBI__IDCT_LOW 1  // the top left 4x4
+#define STBI__IDCT_FULL 2 // anywhere
+
+// from what stbi__jpeg_decode_block returns: zig-zag indices 0-9 all lie
+// in the top left 4x4
+static int stbi__jpeg_decoded_support(int end)
+{
+	return end <= 1 ? STBI__IDCT_DC : end <= 10 ? STBI__IDCT_LOW : STBI__IDCT_FULL;
+}
+
+// from the coefficients themselves, for blocks that were decoded earlier
+static int stbi__jpeg_block_support(const short *data)
+{
+#ifdef STBI_SSE2
+	__m128i hi = _mm_or_si128(_mm_or_si128(_mm_load_si128((const __m128i *)(data + 32)), _mm_load_si128((const __m128i *)(data + 40))),
+									  _mm_or_si128(_mm_load_si128((const __m128i *)(data + 48)), _mm_load_si128((const __m128i *)(data + 56))));
+	__m128i lo = _mm_or_si128(_mm_or_si128(_mm_load_si128((const __m128i *)(data + 0)), _mm_load_si128((const __m128i *)(data + 8))),
+									  _mm_or_si128(_mm_load_si128((const __m128i *)(data + 16)), _mm_load_si128((const __m128i *)(data + 24))));
+	// lanes 4-7 of lo are columns 4-7 of rows 0-3
+	int mask = _mm_movemask_epi8(_mm_cmpeq_epi16(_mm_or_si128(hi, _mm_unpackhi_epi64(lo, lo)), _mm_setzero_si128()));
+	if (mask != 0xffff)
+		return STBI__IDCT_FULL;
+	// lo with data[0] cleared, for the DC-only case
+	lo = _mm_or_si128(_mm_or_si128(_mm_srli_si128(_mm_load_si128((const __m128i *)(data + 0)), 2), _mm_load_si128((const __m128i *)(data + 8))),
+							_mm_or_si128(_mm_load_si128((const __m128i *)(data + 16)), _mm_load_si128((const __m128i *)(data + 24))));
+	mask = _mm_movemask_epi8(_mm_cmpeq_epi16(lo, _mm_setzero_si128()));
+	return (mask & 0xff) == 0xff ? STBI__IDCT_DC : STBI__IDCT_LOW;
+#else
+	int i, low = 0;
+	for (i = 0; i < 32; ++i)
+		if (data[32 + i] | ((i & 7) >= 4 ? data[i] : 0))
+			return STBI__IDCT_FULL;
+	for (i = 1; i < 28; ++i)
+		low |= data[i];
+	return low ? STBI__IDCT_LOW : STBI__IDCT_DC;
+#endif
+}
+
+// reconstruct a block of component n with the cheapest IDCT that gives the
+// same result. the reduced IDCTs are cheap already
+static void stbi__jpeg_idct_one(stbi__jpeg *z, int n, stbi_uc *out, int out_stride, short *data, int support)
+{
+	if (support == STBI__IDCT_FULL || z->img_comp[n].bshift != 3)
+		z->img_comp[n].idct(out, out_stride, data);
+	else if (support == STBI__IDCT_DC)
+		(z->img_comp[n].aan ? stbi__idct_dc_aan : stbi__idct_dc)(out, out_stride, data);
+	else
+		(z->img_comp[n].aan ? z->img_comp[n].idct : z->idct_low_kernel)(out, out_stride, data);
+}
+
+// reconstruct two blocks of component n, in one go if there's a kernel
+// for that and both need the full IDCT
+static void stbi__jpeg_idct_pair(stbi__jpeg *z, int n, stbi_uc *out0, stbi_uc *out1, int out_stride, short *data0, short *data1, int support0, int support1)
+{
+	if (z->idct_block2_kernel && z->img_comp[n].bshift == 3 && !z->img_comp[n].aan && support0 == STBI__IDCT_FULL && support1 == STBI__IDCT_FULL)
+		z->idct_block2_kernel(out0, out1, out_stride, data0, data1);
+	else
+	{
+		stbi__jpeg_idct_one(z, n, out0, out_stride, data0, support0);
+		stbi__jpeg_idct_one(z, n, out1, out_stride, data1, support1);
+	}
+}
+
+// decodes blocks as they're coded, for stbi__jpeg_load_coefficients
+static stbi__uint16 stbi__jpeg_unit_dequant[64] = {
+	 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1};
+
+// the table blocks of component n are dequantized with, to suit its IDCT
+static stbi__uint16 *stbi__jpeg_dequant(stbi__jpeg *z, int n)
+{
+	if (z->coefficients)
+		return stbi__jpeg_unit_dequant;
+	return z->img_comp[n].aan ? z->dequant_aan[z->img_comp[n].tq] : z->dequant[z->img_comp[n].tq];
+}
+
+// decode and/or reconstruct 'count' baseline MCUs, starting at MCU index
+// 'first' in scan order. with coeff == NULL each block is decoded and
+// IDCT'd directly; otherwise the blocks of those MCUs live in coeff, in
+// scan order, and are either decoded into it or reconstructed from it.
+// blocks outside the output region aren't reconstructed. restart intervals
+// are handled by the caller.
+static int stbi__jpeg_baseline_mcus(stbi__jpeg *z, int first, int count, short *coeff, int decode, int idct)
+{
+	// blocks are reconstructed in pairs from the same component, so each
+	// scan component has room for a block waiting for its partner
+	STBI_SIMD_ALIGN(short, data[4 * 2 * 64]);
+	short *pending[4] = {NULL, NULL, NULL, NULL};
+	stbi_uc *pending_out[4];
+	int pending_support[4];
+	short *block = coeff;
+	int k, end = 64;
+	if (z->scan_n == 1)
+	{
+		int n = z->order[0];
+		// non-interleaved data, we just need to process one block at a time,
+		// in trivial scanline order
+		// number of blocks to do just depends on how many actual "pixels" this
+		// component has, independent of interleaved MCU blocking and such
+		int bs = 1 << z->img_comp[n].bshift;
+		int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].bshift);
+		int i = first % w, j = first / w;
+		int ha = z->img_comp[n].ha;
+		for (; count > 0; --count)
+		{
+			short *b = coeff ? block : data + (pending[0] ? 64 : 0);
+			if (z->coefficients)
+				b = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+			if (decode && !(end = stbi__jpeg_decode_block_scaled(z, b, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->multi_ac[ha], n, stbi__jpeg_dequant(z, n))))
+				return 0;
+			if (idct && stbi__jpeg_block_used(z, n, i, j))
 			{
-				for (i = 0; i < z->img_mcu_x; ++i)
+				stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2 * (j * bs - z->img_comp[n].row0) + i * bs;
+				int support = decode ? stbi__jpeg_decoded_support(end) : stbi__jpeg_block_support(b);
+				if (pending[0])
 				{
-					// scan an interleaved mcu... process scan_n components in order
-					for (k = 0; k < z->scan_n; ++k)
-					{
-						int n = z->order[k];
-						// scan out an mcu's worth of this component; that's just determined
-						// by the basic H and V specified for the component
-						for (y = 0; y < z->img_comp[n].v; ++y)
-						{
-							for (x = 0; x < z->img_comp[n].h; ++x)
-							{
-								int x2 = (i * z->img_comp[n].h + x) * 8;
-								int y2 = (j * z->img_comp[n].v + y) * 8;
-								int ha = z->img_comp[n].ha;
-								if (!stbi__jpeg_decode_block(z, data, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->fast_ac[ha], n, z->dequant[z->img_comp[n].tq]))
-									return 0;
-								z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * y2 + x2, z->img_comp[n].w2, data);
-							}
-						}
-					}
-					// after all interleaved components, that's an interleaved MCU,
-					// so now count down the restart interval
-					if (--z->todo <= 0)
-					{
-						if (z->code_bits < 24)
-							stbi__grow_buffer_unsafe(z);
-						if (!STBI__RESTART(z->marker))
-							return 1;
-						stbi__jpeg_reset(z);
-					}
+					stbi__jpeg_idct_pair(z, n, pending_out[0], out, z->img_comp[n].w2, pending[0], b, pending_support[0], support);
+					pending[0] = NULL;
+				}
+				else
+				{
+					pending[0] = b;
+					pending_out[0] = out;
+					pending_support[0] = support;
 				}
 			}
-			return 1;
+			if (coeff)
+				block += 64;
+			if (++i == w)
+			{
+				i = 0;
+				++j;
+			}
 		}
 	}
 	else
-	{
-		if (z->scan_n == 1)
+	{ // interleaved
+		int i = first % z->img_mcu_x, j = first / z->img_mcu_x;
+		int x, y;
+		for (; count > 0; --count)
 		{
-			int i, j;
-			int n = z->order[0];
-			// non-interleaved data, we just need to process one block at a time,
-			// in trivial scanline order
-			// number of blocks to do just depends on how many actual "pixels" this
-			// component has, independent of interleaved MCU blocking and such
-			int w = (z->img_comp[n].x + 7) >> 3;
-			int h = (z->img_comp[n].y + 7) >> 3;
-			for (j = 0; j < h; ++j)
+			// scan an interleaved mcu... process scan_n components in order
+			for (k = 0; k < z->scan_n; ++k)
 			{
-				for (i = 0; i < w; ++i)
+				int n = z->order[k];
+				// scan out an mcu's worth of this component; that's just determined
+				// by the basic H and V specified for the component
+				for (y = 0; y < z->img_comp[n].v; ++y)
 				{
-					short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-					if (z->spec_start == 0)
-					{
-						if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
-							return 0;
-					}
-					else
+					for (x = 0; x < z->img_comp[n].h; ++x)
 					{
+						int x2 = (i * z->img_comp[n].h + x) << z->img_comp[n].bshift;
+						int y2 = (j * z->img_comp[n].v + y) << z->img_comp[n].bshift;
 						int ha = z->img_comp[n].ha;
-						if (!stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha], z->fast_ac[ha]))
+						short *b = coeff ? block : data + (k * 2 + (pending[k] ? 1 : 0)) * 64;
+						if (z->coefficients)
+							b = z->img_comp[n].coeff + 64 * (i * z->img_comp[n].h + x + (j * z->img_comp[n].v + y) * z->img_comp[n].coeff_w);
+						if (decode && !(end = stbi__jpeg_decode_block_scaled(z, b, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->multi_ac[ha], n, stbi__jpeg_dequant(z, n))))
 							return 0;
-					}
-					// every data block is an MCU, so countdown the restart interval
-					if (--z->todo <= 0)
-					{
-						if (z->code_bits < 24)
-							stbi__grow_buffer_unsafe(z);
-						if (!STBI__RESTART(z->marker))
-							return 1;
-						stbi__jpeg_reset(z);
-					}
-				}
-			}
-			return 1;
-		}
-		else
-		{ // interleaved
-			int i, j, k, x, y;
-			for (j = 0; j < z->img_mcu_y; ++j)
-			{
-				for (i = 0; i < z->img_mcu_x; ++i)
-				{
-					// scan an interleaved mcu... process scan_n components in order
-					for (k = 0; k < z->scan_n; ++k)
-					{
-						int n = z->order[k];
-						// scan out an mcu's worth of this component; that's just determined
-						// by the basic H and V specified for the component
-						for (y = 0; y < z->img_comp[n].v; ++y)
+						if (idct && stbi__jpeg_block_used(z, n, i * z->img_comp[n].h + x, j * z->img_comp[n].v + y))
 						{
-							for (x = 0; x < z->img_comp[n].h; ++x)
+							stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2 * (y2 - z->img_comp[n].row0) + x2;
+							int support = decode ? stbi__jpeg_decoded_support(end) : stbi__jpeg_block_support(b);
+							if (pending[k])
 							{
-								int x2 = (i * z->img_comp[n].h + x);
-								int y2 = (j * z->img_comp[n].v + y);
-								short *data = z->img_comp[n].coeff + 64 * (x2 + y2 * z->img_comp[n].coeff_w);
-								if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
-									return 0;
+								stbi__jpeg_idct_pair(z, n, pending_out[k], out, z->img_comp[n].w2, pending[k], b, pending_support[k], support);
+								pending[k] = NULL;
+							}
+							else
+							{
+								pending[k] = b;
+								pending_out[k] = out;
+								pending_support[k] = support;
 							}
 						}
-					}
-					// after all interleaved components, that's an interleaved MCU,
-					// so now count down the restart interval
-					if (--z->todo <= 0)
-					{
-						if (z->code_bits < 24)
-							stbi__grow_buffer_unsafe(z);
-						if (!STBI__RESTART(z->marker))
-							return 1;
-						stbi__jpeg_reset(z);
+						if (coeff)
+							block += 64;
 					}
 				}
 			}
-			return 1;
+			if (++i == z->img_mcu_x)
+			{
+				i = 0;
+				++j;
+			}
 		}
 	}
+	// reconstruct the odd blocks out
+	for (k = 0; k < 4; ++k)
+		if (pending[k])
+			stbi__jpeg_idct_one(z, z->order[k], pending_out[k], z->img_comp[z->order[k]].w2, pending[k], pending_support[k]);
+	return 1;
 }
 
-static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
-{
-	int i;
-	for (i = 0; i < 64; ++i)
-		data[i] *= dequant[i];
-}
-
-static void stbi__jpeg_finish(stbi__jpeg *z)
+// decode baseline MCUs from *pos up to 'end' serially, counting down the
+// restart interval. returns 0 on error, -1 if the scan ended early because
+// an interval wasn't followed by a restart marker, 1 otherwise. with a
+// coefficient buffer the blocks are stored there instead of reconstructed.
+static int stbi__jpeg_decode_baseline_run(stbi__jpeg *z, int *pos, int end, short *coeff)
 {
-	if (z->progressive)
+	while (*pos < end)
 	{
-		// dequantize and idct the data
-		int i, j, n;
-		for (n = 0; n < z->s->img_n; ++n)
+		int count = end - *pos < z->todo ? end - *pos : z->todo;
+		if (!stbi__jpeg_baseline_mcus(z, *pos, count, coeff, 1, coeff == NULL && !z->coefficients))
+			return 0;
+		if (coeff)
+			coeff += count * stbi__jpeg_blocks_per_mcu(z) * 64;
+		*pos += count;
+		// count down the restart interval by whole MCUs
+		z->todo -= count;
+		if (z->todo <= 0)
 		{
-			int w = (z->img_comp[n].x + 7) >> 3;
-			int h = (z->img_comp[n].y + 7) >> 3;
-			for (j = 0; j < h; ++j)
-			{
-				for (i = 0; i < w; ++i)
-				{
-					short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
-					stbi__jpeg_dequantize(data, z->dequant[z->img_comp[n].tq]);
-					z->idct_block_kernel(z->img_comp[n].data + z->img_comp[n].w2 * j * 8 + i * 8, z->img_comp[n].w2, data);
-				}
-			}
+			if (z->code_bits < 24)
+				stbi__grow_buffer_unsafe(z);
+			// if it's NOT a restart, then just bail, so we get corrupt data
+			// rather than no data
+			if (!STBI__RESTART(z->marker))
+				return -1;
+			stbi__jpeg_reset(z);
 		}
 	}
+	return 1;
 }
 
-static int stbi__process_marker(stbi__jpeg *z, int m)
+// decode the rest of a baseline scan serially, starting at MCU 'done'
+static int stbi__jpeg_decode_baseline_from(stbi__jpeg *z, int done)
 {
-	int L;
-	switch (m)
-	{
-	case STBI__MARKER_none: // no marker found
-		return stbi__err("expected marker", "Corrupt JPEG");
+	return stbi__jpeg_decode_baseline_run(z, &done, stbi__jpeg_scan_end(z), NULL) != 0;
+}
 
-	case 0xDD: // DRI - specify restart interval
-		if (stbi__get16be(z->s) != 4)
-			return stbi__err("bad DRI len", "Corrupt JPEG");
-		z->restart_interval = stbi__get16be(z->s);
-		return 1;
+#ifdef STBI_JPEG_THREADS
+// restart intervals are independent: each one starts on a byte boundary
+// after an RSTn marker with zeroed DC predictors, so we can pre-scan the
+// entropy-coded segment for the markers and decode intervals in parallel
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi_uc **seg_start;
+	int num_segs;
+	int failed[STBI_JPEG_MAX_THREADS]; // per worker
+} stbi__jpeg_restart_job;
 
-	case 0xDB: // DQT - define quantization table
-		L = stbi__get16be(z->s) - 2;
-		while (L > 0)
+static void stbi__jpeg_restart_worker(void *arg, int worker, int nworkers)
+{
+	stbi__jpeg_restart_job *job = (stbi__jpeg_restart_job *)arg;
+	stbi__jpeg *z = job->z;
+	int per = (job->num_segs + nworkers - 1) / nworkers;
+	int first = per * worker;
+	int last = first + per < job->num_segs ? first + per : job->num_segs;
+	stbi__context s = *z->s;
+	stbi__jpeg *w;
+	int seg;
+	if (first >= last)
+		return;
+	w = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (w == NULL)
+	{
+		job->failed[worker] = 1;
+		return;
+	}
+	*w = *z;
+	w->s = &s;
+	for (seg = first; seg < last; ++seg)
+	{
+		s.img_buffer = job->seg_start[seg];
+		stbi__jpeg_reset(w);
+		if (!stbi__jpeg_baseline_mcus(w, seg * z->restart_interval, z->restart_interval, NULL, 1, 1))
 		{
-			int q = stbi__get8(z->s);
-			int p = q >> 4, sixteen = (p != 0);
-			int t = q & 15, i;
-			if (p != 0 && p != 1)
-				return stbi__err("bad DQT type", "Corrupt JPEG");
-			if (t > 3)
-				return stbi__err("bad DQT table", "Corrupt JPEG");
-
-			for (i = 0; i < 64; ++i)
-				z->dequant[t][stbi__jpeg_dezigzag[i]] = (stbi__uint16)(sixteen ? stbi__get16be(z->s) : stbi__get8(z->s));
-			L -= (sixteen ? 129 : 65);
+			job->failed[worker] = 1;
+			break;
 		}
-		return L == 0;
-
-	case 0xC4: // DHT - define huffman table
-		L = stbi__get16be(z->s) - 2;
-		while (L > 0)
+		// the serial decoder gives up on the rest of the scan if an interval
+		// doesn't end at a restart marker; let it reproduce that
+		if (w->code_bits < 24)
+			stbi__grow_buffer_unsafe(w);
+		if (!STBI__RESTART(w->marker))
 		{
-			stbi_uc *v;
-			int sizes[16], i, n = 0;
-			int q = stbi__get8(z->s);
-			int tc = q >> 4;
-			int th = q & 15;
-			if (tc > 1 || th > 3)
-				return stbi__err("bad DHT header", "Corrupt JPEG");
-			for (i = 0; i < 16; ++i)
-			{
-				sizes[i] = stbi__get8(z->s);
-				n += sizes[i];
-			}
-			L -= 17;
-			if (tc == 0)
-			{
-				if (!stbi__build_huffman(z->huff_dc + th, sizes))
-					return 0;
-				v = z->huff_dc[th].values;
-			}
-			else
-			{
-				if (!stbi__build_huffman(z->huff_ac + th, sizes))
-					return 0;
-				v = z->huff_ac[th].values;
-			}
-			for (i = 0; i < n; ++i)
-				v[i] = stbi__get8(z->s);
-			if (tc != 0)
-				stbi__build_fast_ac(z->fast_ac[th], z->huff_ac + th);
-			L -= n;
+			job->failed[worker] = 1;
+			break;
 		}
-		return L == 0;
 	}
+	STBI_FREE(w);
+}
 
-	// check for comment block or APP blocks
-	if ((m >= 0xE0 && m <= 0xEF) || m == 0xFE)
+// returns 0 if the scan can't be split, in which case nothing was consumed
+static int stbi__jpeg_decode_restart_parallel(stbi__jpeg *z)
+{
+	stbi__jpeg_restart_job job;
+	stbi_uc *p = z->s->img_buffer, *end = z->s->img_buffer_end;
+	stbi_uc *start = p;
+	int n = 1, nworkers, failed = 0, i;
+
+	job.num_segs = (stbi__jpeg_scan_end(z) + z->restart_interval - 1) / z->restart_interval;
+	if (job.num_segs < 2)
+		return 0;
+	job.seg_start = (stbi_uc **)stbi__malloc_mad2(job.num_segs, sizeof(stbi_uc *), 0);
+	if (job.seg_start == NULL)
+		return 0;
+	job.seg_start[0] = p;
+
+	// find the start of every interval; stop at the first non-RSTn marker
+	while (n < job.num_segs && p + 1 < end)
 	{
-		L = stbi__get16be(z->s);
-		if (L < 2)
-		{
-			if (m == 0xFE)
-				return stbi__err("bad COM len", "Corrupt JPEG");
-			else
-				return stbi__err("bad APP len", "Corrupt JPEG");
-		}
-		L -= 2;
+		if (*p++ != 0xff)
+			continue;
+		while (p < end && *p == 0xff)
+			++p; // fill bytes
+		if (p == end || *p == 0)
+			continue; // stuffed zero
+		if (!STBI__RESTART(*p))
+			break;
+		job.seg_start[n++] = ++p;
+	}
+	if (n < job.num_segs)
+	{
+		STBI_FREE(job.seg_start);
+		return 0;
+	}
 
-		if (m == 0xE0 && L >= 5)
-		{ // JFIF APP0 segment
-			static const unsigned char tag[5] = {'J', 'F', 'I', 'F', '\0'};
-			int ok = 1;
-			int i;
-			for (i = 0; i < 5; ++i)
-				if (stbi__get8(z->s) != tag[i])
-					ok = 0;
-			L -= 5;
-			if (ok)
-				z->jfif = 1;
-		}
-		else if (m == 0xEE && L >= 12)
-		{ // Adobe APP14 segment
-			static const unsigned char tag[6] = {'A', 'd', 'o', 'b', 'e', '\0'};
-			int ok = 1;
-			int i;
-			for (i = 0; i < 6; ++i)
-				if (stbi__get8(z->s) != tag[i])
-					ok = 0;
-			L -= 6;
-			if (ok)
-			{
-				stbi__get8(z->s);                            // version
-				stbi__get16be(z->s);                         // flags0
-				stbi__get16be(z->s);                         // flags1
-				z->app14_color_transform = stbi__get8(z->s); // color transform
-				L -= 6;
-			}
-		}
+	// all but the final interval go to the workers; the final one is decoded
+	// afterwards by the caller's decoder, so the stream position and pending
+	// marker end up exactly where the serial path leaves them
+	job.z = z;
+	--job.num_segs;
+	nworkers = stbi__jpeg_thread_count < job.num_segs ? stbi__jpeg_thread_count : job.num_segs;
+	for (i = 0; i < nworkers; ++i)
+		job.failed[i] = 0;
+	stbi__jpeg_parallel(stbi__jpeg_restart_worker, &job, nworkers);
+	for (i = 0; i < nworkers; ++i)
+		failed |= job.failed[i];
+	if (!failed)
+	{
+		z->s->img_buffer = job.seg_start[job.num_segs];
+		stbi__jpeg_reset(z);
+		failed = !stbi__jpeg_decode_baseline_from(z, job.num_segs * z->restart_interval);
+	}
+	STBI_FREE(job.seg_start);
 
-		stbi__skip(z->s, L);
-		return 1;
+	if (failed)
+	{
+		// corrupt data or out of memory; rerun serially so errors and
+		// partial output match the single-threaded decoder exactly
+		z->s->img_buffer = start;
+		stbi__jpeg_reset(z);
+		return stbi__jpeg_decode_baseline_from(z, 0) ? 1 : -1;
 	}
+	return 1;
+}
 
-	return stbi__err("unknown marker", "Corrupt JPEG");
+// without restart intervals there's nowhere safe to split the scan, but
+// huffman codes self-synchronise: a decoder started at an arbitrary bit
+// soon lands on the same block boundaries as the true decode. so we cut
+// the entropy-coded segment into byte ranges and speculatively decode each
+// one from its first byte, recording where its first blocks start. each
+// range's decoder then runs on into the next range until it lands on one of
+// those starts, which pins down the block index and DC predictors there.
+// finally every range is decoded for real from its first whole MCU.
+#define STBI__JPEG_SYNC_POINTS 4096     // block starts recorded per range
+#define STBI__JPEG_MIN_SPECULATE 65536 // smallest range worth its own thread
+
+typedef struct
+{
+	size_t pos; // in bits from the start of the segment
+	int diff;   // DC difference of the block starting there
+} stbi__jpeg_sync;
+
+typedef struct
+{
+	stbi__jpeg *d;
+	stbi__context s;
+	stbi__jpeg_sync *sync;
+	int num_sync, failed;
+	// decoder state: next block, counted from where it started, and DC
+	// differences summed by block index mod blocks-per-MCU
+	size_t pos;
+	int block;
+	unsigned int acc[10];
+	// where the true decode joins this range, once known
+	int first, first_block, dc_pred[4];
+} stbi__jpeg_range;
+
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi_uc *base;
+	stbi_uc **start; // first byte of each range, and the end of the segment
+	stbi__jpeg_range *range;
+	int num_ranges;
+	int blocks_per_mcu, same_tables;
+	int comp[10]; // scan component of each block in an MCU
+} stbi__jpeg_spec_job;
+
+// skip the range decoder's next block, assuming it started on an MCU
+static int stbi__jpeg_range_skip(stbi__jpeg_spec_job *job, stbi__jpeg_range *r, int *diff)
+{
+	stbi__jpeg *d = r->d;
+	int phase = r->block % job->blocks_per_mcu;
+	int n = d->order[job->comp[phase]];
+	int ha = d->img_comp[n].ha;
+	if (!stbi__jpeg_skip_block(d, d->huff_dc + d->img_comp[n].hd, d->huff_ac + ha, d->multi_ac[ha], diff))
+		return 0;
+	r->acc[phase] += *diff;
+	++r->block;
+	r->pos = stbi__jpeg_bit_pos(d, job->base);
+	return !d->nomore;
 }
 
-// after we see SOS
-static int stbi__process_scan_header(stbi__jpeg *z)
+// phase 1: decode a range speculatively, recording where its first blocks
+// start, and stop at the first block that starts in the next range
+static void stbi__jpeg_spec_worker(void *arg, int worker, int nworkers)
 {
-	int i;
-	int Ls = stbi__get16be(z->s);
-	z->scan_n = stbi__get8(z->s);
-	if (z->scan_n < 1 || z->scan_n > 4 || z->scan_n > (int)z->s->img_n)
-		return stbi__err("bad SOS component count", "Corrupt JPEG");
-	if (Ls != 6 + 2 * z->scan_n)
-		return stbi__err("bad SOS len", "Corrupt JPEG");
-	for (i = 0; i < z->scan_n; ++i)
+	stbi__jpeg_spec_job *job = (stbi__jpeg_spec_job *)arg;
+	stbi__jpeg_range *r = &job->range[worker];
+	size_t end = (size_t)(job->start[worker + 1] - job->base) * 8;
+	stbi_uc *p = job->start[worker];
+	STBI_NOTUSED(nworkers);
+
+	r->d = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (r->d == NULL)
 	{
-		int id = stbi__get8(z->s), which;
-		int q = stbi__get8(z->s);
-		for (which = 0; which < z->s->img_n; ++which)
-			if (z->img_comp[which].id == id)
-				break;
-		if (which == z->s->img_n)
-			return 0; // no match
-		z->img_comp[which].hd = q >> 4;
-		if (z->img_comp[which].hd > 3)
-			return stbi__err("bad DC huff", "Corrupt JPEG");
-		z->img_comp[which].ha = q & 15;
-		if (z->img_comp[which].ha > 3)
-			return stbi__err("bad AC huff", "Corrupt JPEG");
-		z->order[i] = which;
+		r->failed = 1;
+		return;
 	}
+	*r->d = *job->z;
+	r->s = *job->z->s;
+	r->d->s = &r->s;
 
+	for (;;)
 	{
-		int aa;
-		z->spec_start = stbi__get8(z->s);
-		z->spec_end = stbi__get8(z->s); // should be 63, but might be 0
-		aa = stbi__get8(z->s);
-		z->succ_high = (aa >> 4);
-		z->succ_low = (aa & 15);
-		if (z->progressive)
-		{
-			if (z->spec_start > 63 || z->spec_end > 63 || z->spec_start > z->spec_end || z->succ_high > 13 || z->succ_low > 13)
-				return stbi__err("bad SOS", "Corrupt JPEG");
-		}
-		else
+		int diff;
+		r->num_sync = 0;
+		r->block = 0;
+		memset(r->acc, 0, sizeof(r->acc));
+		r->s.img_buffer = p;
+		stbi__jpeg_reset(r->d);
+		r->pos = (size_t)(p - job->base) * 8;
+		while (r->pos < end)
 		{
-			if (z->spec_start != 0)
-				return stbi__err("bad SOS", "Corrupt JPEG");
-			if (z->succ_high != 0 || z->succ_low != 0)
-				return stbi__err("bad SOS", "Corrupt JPEG");
-			z->spec_end = 63;
+			size_t pos = r->pos;
+			if (!stbi__jpeg_range_skip(job, r, &diff))
+				break;
+			if (r->num_sync < STBI__JPEG_SYNC_POINTS)
+			{
+				r->sync[r->num_sync].pos = pos;
+				r->sync[r->num_sync++].diff = diff;
+			}
 		}
+		if (r->pos >= end && !r->d->nomore)
+			return;
+		if (r->d->nomore || worker == 0)
+			break;
+		// not a valid code sequence from here. if that's because we
+		// haven't synchronised yet, try again from the next byte
+		p = job->base + r->pos / 8 + 1;
+		if (p[-1] == 0xff)
+			++p;
+		if (p >= job->start[worker + 1])
+			break;
 	}
-
-	return 1;
+	// hit the end of the segment or corrupt data. that's fine for the last
+	// range, which nobody synchronises past
+	if (worker + 1 < job->num_ranges)
+		r->failed = 1;
 }
 
-static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
+// phase 2: carry on decoding past the end of the range until we land on
+// a block start that the next range's decoder also found. unless every
+// component uses the same tables, that decoder also has to have thought
+// it was at the same point in the MCU.
+static void stbi__jpeg_sync_worker(void *arg, int worker, int nworkers)
 {
-	int i;
-	for (i = 0; i < ncomp; ++i)
+	stbi__jpeg_spec_job *job = (stbi__jpeg_spec_job *)arg;
+	stbi__jpeg_range *r = &job->range[worker], *next = r + 1;
+	int i = 0, diff;
+	if (worker + 1 == nworkers)
+		return;
+	while (!r->failed && !next->failed)
 	{
-		if (z->img_comp[i].raw_data)
-		{
-			STBI_FREE(z->img_comp[i].raw_data);
-			z->img_comp[i].raw_data = NULL;
-			z->img_comp[i].data = NULL;
-		}
-		if (z->img_comp[i].raw_coeff)
-		{
-			STBI_FREE(z->img_comp[i].raw_coeff);
-			z->img_comp[i].raw_coeff = 0;
-			z->img_comp[i].coeff = 0;
-		}
-		if (z->img_comp[i].linebuf)
+		while (i < next->num_sync && next->sync[i].pos < r->pos)
+			++i;
+		if (i == next->num_sync)
+			break;
+		if (next->sync[i].pos == r->pos && (job->same_tables || (r->block - i) % job->blocks_per_mcu == 0))
 		{
-			STBI_FREE(z->img_comp[i].linebuf);
-			z->img_comp[i].linebuf = NULL;
+			next->first = i;
+			return;
 		}
+		if (!stbi__jpeg_range_skip(job, r, &diff))
+			break;
 	}
-	return why;
+	r->failed = 1;
 }
 
-static int stbi__process_frame_header(stbi__jpeg *z, int scan)
+// phase 3: decode each range for real, from its first whole MCU
+static void stbi__jpeg_range_worker(void *arg, int worker, int nworkers)
 {
-	stbi__context *s = z->s;
-	int Lf, p, i, q, h_max = 1, v_max = 1, c;
-	Lf = stbi__get16be(s);
-	if (Lf < 11)
-		return stbi__err("bad SOF len", "Corrupt JPEG"); // JPEG
-	p = stbi__get8(s);
-	if (p != 8)
-		return stbi__err("only 8-bit", "JPEG format not supported: 8-bit only"); // JPEG baseline
-	s->img_y = stbi__get16be(s);
-	if (s->img_y == 0)
-		return stbi__err("no header height", "JPEG format not supported: delayed height"); // Legal, but we don't handle it--but neither does IJG
-	s->img_x = stbi__get16be(s);
-	if (s->img_x == 0)
-		return stbi__err("0 width", "Corrupt JPEG"); // JPEG requires
-	if (s->img_y > STBI_MAX_DIMENSIONS)
-		return stbi__err("too large", "Very large image (corrupt?)");
-	if (s->img_x > STBI_MAX_DIMENSIONS)
-		return stbi__err("too large", "Very large image (corrupt?)");
-	c = stbi__get8(s);
-	if (c != 3 && c != 1 && c != 4)
-		return stbi__err("bad component count", "Corrupt JPEG");
-	s->img_n = c;
-	for (i = 0; i < c; ++i)
+	stbi__jpeg_spec_job *job = (stbi__jpeg_spec_job *)arg;
+	stbi__jpeg_range *r = &job->range[worker];
+	stbi__jpeg *d = r->d;
+	int k, b = job->blocks_per_mcu;
+	STBI_NOTUSED(nworkers);
+	stbi__jpeg_seek_bit(d, job->base, r->sync[r->first].pos);
+	for (k = 0; k < d->scan_n; ++k)
+		d->img_comp[d->order[k]].dc_pred = r->dc_pred[k];
+	r->failed = !stbi__jpeg_baseline_mcus(d, r->first_block / b, (r[1].first_block - r->first_block) / b, NULL, 1, 1);
+}
+
+// returns 0 if the scan can't be split, in which case nothing was consumed
+static int stbi__jpeg_decode_speculative(stbi__jpeg *z)
+{
+	stbi__jpeg_spec_job job;
+	stbi_uc *p = z->s->img_buffer, *end = z->s->img_buffer_end;
+	int b = stbi__jpeg_blocks_per_mcu(z), total = stbi__jpeg_scan_mcus(z) * b;
+	int n, i, k, x, failed = 0;
+	size_t len;
+
+	// find the end of the entropy-coded segment
+	job.base = p;
+	while (p + 1 < end)
 	{
-		z->img_comp[i].data = NULL;
-		z->img_comp[i].linebuf = NULL;
+		if (*p++ != 0xff)
+			continue;
+		while (p < end && *p == 0xff)
+			++p;
+		if (p < end && *p != 0)
+		{
+			--p;
+			break;
+		}
 	}
+	len = (size_t)(p - job.base);
+	n = stbi__jpeg_thread_count;
+	if ((size_t)n > len / STBI__JPEG_MIN_SPECULATE)
+		n = (int)(len / STBI__JPEG_MIN_SPECULATE);
+	// more blocks per MCU than the standard allows isn't worth handling
+	if (n < 2 || b > 10)
+		return 0;
 
-	if (Lf != 8 + 3 * s->img_n)
-		return stbi__err("bad SOF len", "Corrupt JPEG");
-
-	z->rgb = 0;
-	for (i = 0; i < s->img_n; ++i)
+	job.z = z;
+	job.num_ranges = n;
+	job.blocks_per_mcu = b;
+	job.same_tables = 1;
+	for (i = k = 0; k < z->scan_n; ++k)
 	{
-		static const unsigned char rgb[3] = {'R', 'G', 'B'};
-		z->img_comp[i].id = stbi__get8(s);
-		if (s->img_n == 3 && z->img_comp[i].id == rgb[i])
-			++z->rgb;
-		q = stbi__get8(s);
-		z->img_comp[i].h = (q >> 4);
-		if (!z->img_comp[i].h || z->img_comp[i].h > 4)
-			return stbi__err("bad H", "Corrupt JPEG");
-		z->img_comp[i].v = q & 15;
-		if (!z->img_comp[i].v || z->img_comp[i].v > 4)
-			return stbi__err("bad V", "Corrupt JPEG");
-		z->img_comp[i].tq = stbi__get8(s);
-		if (z->img_comp[i].tq > 3)
-			return stbi__err("bad TQ", "Corrupt JPEG");
+		int c = z->order[k], c0 = z->order[0];
+		int blocks = z->scan_n == 1 ? 1 : z->img_comp[c].h * z->img_comp[c].v;
+		for (x = 0; x < blocks; ++x)
+			job.comp[i++] = k;
+		if (z->img_comp[c].hd != z->img_comp[c0].hd || z->img_comp[c].ha != z->img_comp[c0].ha)
+			job.same_tables = 0;
 	}
 
-	if (scan != STBI__SCAN_load)
-		return 1;
+	job.start = (stbi_uc **)stbi__malloc_mad2(n + 1, sizeof(stbi_uc *), 0);
+	job.range = (stbi__jpeg_range *)stbi__malloc_mad2(n, sizeof(stbi__jpeg_range), 0);
+	if (job.range)
+		job.range[0].sync = (stbi__jpeg_sync *)stbi__malloc_mad3(n, STBI__JPEG_SYNC_POINTS, sizeof(stbi__jpeg_sync), 0);
+	if (!job.start || !job.range || !job.range[0].sync)
+	{
+		if (job.range)
+			STBI_FREE(job.range[0].sync);
+		STBI_FREE(job.start);
+		STBI_FREE(job.range);
+		return 0;
+	}
+	for (i = 0; i < n; ++i)
+	{
+		job.start[i] = job.base + len / n * i;
+		// don't start on the zero of a stuffed 0xff
+		if (i && job.start[i][-1] == 0xff)
+			++job.start[i];
+		job.range[i].sync = job.range[0].sync + i * STBI__JPEG_SYNC_POINTS;
+		job.range[i].d = NULL;
+		job.range[i].failed = 0;
+	}
+	job.start[n] = p;
 
-	if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0))
-		return stbi__err("too large", "Image too large to decode");
+	stbi__jpeg_parallel(stbi__jpeg_spec_worker, &job, n);
+	stbi__jpeg_parallel(stbi__jpeg_sync_worker, &job, n);
 
-	for (i = 0; i < s->img_n; ++i)
+	// chain the synchronisation points together, starting from the true
+	// state at the start of the scan
+	job.range[0].first = job.range[0].first_block = 0;
+	for (k = 0; k < 4; ++k)
+		job.range[0].dc_pred[k] = 0;
+	for (i = 0; i + 1 < n && !failed; ++i)
 	{
-		if (z->img_comp[i].h > h_max)
-			h_max = z->img_comp[i].h;
-		if (z->img_comp[i].v > v_max)
-			v_max = z->img_comp[i].v;
-	}
+		stbi__jpeg_range *r = &job.range[i], *next = r + 1;
+		unsigned int acc[10];
+		// range i's block index is off from the true one by this much
+		int shift = r->first_block - r->first;
+		failed = r->failed;
+		if (failed)
+			break;
 
-	// compute interleaved mcu info
-	z->img_h_max = h_max;
-	z->img_v_max = v_max;
-	z->img_mcu_w = h_max * 8;
-	z->img_mcu_h = v_max * 8;
-	// these sizes can't be more than 17 bits
-	z->img_mcu_x = (s->img_x + z->img_mcu_w - 1) / z->img_mcu_w;
-	z->img_mcu_y = (s->img_y + z->img_mcu_h - 1) / z->img_mcu_h;
+		// DC differences from range i's first MCU up to the sync point
+		for (x = 0; x < b; ++x)
+			acc[x] = r->acc[x];
+		for (x = 0; x < r->first; ++x)
+			acc[x % b] -= r->sync[x].diff;
+		for (k = 0; k < z->scan_n; ++k)
+			next->dc_pred[k] = r->dc_pred[k];
+		for (x = 0; x < b; ++x)
+		{
+			k = job.comp[(x + shift % b + b) % b];
+			next->dc_pred[k] = (int)((unsigned int)next->dc_pred[k] + acc[x]);
+		}
+		next->first_block = r->first_block + r->block - r->first;
 
-	for (i = 0; i < s->img_n; ++i)
+		// move up to the next MCU boundary
+		while (next->first_block % b != 0 && next->first < next->num_sync)
+		{
+			k = job.comp[next->first_block++ % b];
+			next->dc_pred[k] += next->sync[next->first++].diff;
+		}
+		failed = next->first == next->num_sync || next->first_block > total;
+	}
+	if (!failed)
 	{
-		// number of effective pixels (e.g. for non-interleaved MCU)
-		z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max - 1) / h_max;
-		z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max - 1) / v_max;
-		// to simplify generation, we'll allocate enough memory to decode
-		// the bogus oversized data from using interleaved MCUs and their
-		// big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
-		// discard the extra data until colorspace conversion
-		//
-		// img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
-		// so these muls can't overflow with 32-bit ints (which we require)
-		z->img_comp[i].w2 = z->img_mcu_x * z->img_comp[i].h * 8;
-		z->img_comp[i].h2 = z->img_mcu_y * z->img_comp[i].v * 8;
-		z->img_comp[i].coeff = 0;
-		z->img_comp[i].raw_coeff = 0;
-		z->img_comp[i].linebuf = NULL;
-		z->img_comp[i].raw_data = stbi__malloc_mad2(z->img_comp[i].w2, z->img_comp[i].h2, 15);
-		if (z->img_comp[i].raw_data == NULL)
-			return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
-		// align blocks for idct using mmx/sse
-		z->img_comp[i].data = (stbi_uc *)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
-		if (z->progressive)
+		// all but the last range go to the workers; the last one is decoded
+		// afterwards by the caller's decoder, which leaves the stream
+		// position and pending marker exactly where the serial path does
+		stbi__jpeg_parallel(stbi__jpeg_range_worker, &job, n - 1);
+		for (i = 0; i + 1 < n; ++i)
+			failed |= job.range[i].failed;
+		if (!failed)
 		{
-			// w2, h2 are multiples of 8 (see above)
-			z->img_comp[i].coeff_w = z->img_comp[i].w2 / 8;
-			z->img_comp[i].coeff_h = z->img_comp[i].h2 / 8;
-			z->img_comp[i].raw_coeff = stbi__malloc_mad3(z->img_comp[i].w2, z->img_comp[i].h2, sizeof(short), 15);
-			if (z->img_comp[i].raw_coeff == NULL)
-				return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
-			z->img_comp[i].coeff = (short *)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
+			stbi__jpeg_range *r = &job.range[n - 1];
+			stbi__jpeg_seek_bit(z, job.base, r->sync[r->first].pos);
+			for (k = 0; k < z->scan_n; ++k)
+				z->img_comp[z->order[k]].dc_pred = r->dc_pred[k];
+			failed = !stbi__jpeg_decode_baseline_from(z, r->first_block / b);
 		}
+		failed = failed ? 2 : 0;
 	}
 
+	for (i = 0; i < n; ++i)
+		STBI_FREE(job.range[i].d);
+	STBI_FREE(job.range[0].sync);
+	STBI_FREE(job.start);
+	STBI_FREE(job.range);
+
+	if (failed == 1)
+		return 0; // couldn't synchronise; nothing has been consumed
+	if (failed)
+	{
+		// corrupt data; rerun serially so errors and partial output match
+		// the single-threaded decoder exactly
+		z->s->img_buffer = job.base;
+		stbi__jpeg_reset(z);
+		return stbi__jpeg_decode_baseline_from(z, 0) ? 1 : -1;
+	}
 	return 1;
 }
+#endif
 
-// use comparisons since in some cases we handle more than one case (e.g. SOF)
-#define stbi__DNL(x) ((x) == 0xdc)
-#define stbi__SOI(x) ((x) == 0xd8)
-#define stbi__EOI(x) ((x) == 0xd9)
-#define stbi__SOF(x) ((x) == 0xc0 || (x) == 0xc1 || (x) == 0xc2)
-#define stbi__SOS(x) ((x) == 0xda)
-
-#define stbi__SOF_progressive(x) ((x) == 0xc2)
+#ifdef STBI_JPEG_THREADS
+static int stbi__jpeg_decode_pipelined(stbi__jpeg *z);
+#endif
 
-static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
+// skip over the entropy-coded data of a scan to the marker that ends it
+static int stbi__jpeg_skip_scan(stbi__jpeg *z)
 {
-	int m;
-	z->jfif = 0;
-	z->app14_color_transform = -1; // valid values are 0,1,2
-	z->marker = STBI__MARKER_none; // initialize cached marker to empty
-	m = stbi__get_marker(z);
-	if (!stbi__SOI(m))
-		return stbi__err("no SOI", "Corrupt JPEG");
-	if (scan == STBI__SCAN_type)
-		return 1;
-	m = stbi__get_marker(z);
-	while (!stbi__SOF(m))
+	while (!stbi__at_eof(z->s))
 	{
-		if (!stbi__process_marker(z, m))
-			return 0;
-		m = stbi__get_marker(z);
-		while (m == STBI__MARKER_none)
+		if (stbi__get8(z->s) == 0xff)
 		{
-			// some files have extra padding after their blocks, so ok, we'll scan
-			if (stbi__at_eof(z->s))
-				return stbi__err("no SOF", "Corrupt JPEG");
-			m = stbi__get_marker(z);
+			int m = stbi__get8(z->s);
+			while (m == 0xff)
+				m = stbi__get8(z->s);
+			if (m != 0 && !STBI__RESTART(m))
+			{
+				z->marker = (unsigned char)m;
+				return 1;
+			}
 		}
 	}
-	z->progressive = stbi__SOF_progressive(m);
-	if (!stbi__process_frame_header(z, scan))
-		return 0;
 	return 1;
 }
 
-// decode image to YCbCr format
-static int stbi__decode_jpeg_image(stbi__jpeg *j)
+// let the pages of component n's coefficients above block row j go, if
+// they're in a scratch file; they're read back in when they're needed.
+// done block rows are never touched again by the scan, so the memory a
+// scan takes stays at a few rows. only the rows since the last call are
+// let go; a j that isn't past that call's starts a new pass from the top.
+// 0 if the pages couldn't be let go, in which case the rows above j may be
+// gone
+static int stbi__jpeg_coeff_release(stbi__jpeg *z, int n, int j)
 {
-	int m;
-	for (m = 0; m < 4; m++)
+#ifdef STBI_JPEG_SCRATCH
+	size_t end = (size_t)j * z->img_comp[n].coeff_w * 64 * sizeof(short);
+	size_t start = z->img_comp[n].coeff_released;
+	if (z->img_comp[n].coeff_mapped && end > 0)
 	{
-		j->img_comp[m].raw_data = NULL;
-		j->img_comp[m].raw_coeff = NULL;
+		char *base = (char *)z->img_comp[n].raw_coeff;
+		if (end <= start)
+			start = 0;
+		z->img_comp[n].coeff_released = end;
+#ifdef _WIN32
+		// unlocking pages that aren't locked takes them out of the working set
+		VirtualUnlock(base + start, end - start);
+#else
+		// mapping the same part of the file over them drops the pages, and
+		// what was written stays in the file. unlike madvise(MADV_DONTNEED)
+		// this can fail, and MAP_FIXED may have taken the old mapping down
+		// by then, so the image can't go on. only whole pages go, so the
+		// page the last call stopped in is let go now
+		{
+			size_t page = (size_t)sysconf(_SC_PAGESIZE);
+			start = start / page * page;
+			end = end / page * page;
+			if (end > start && mmap(base + start, end - start, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, z->img_comp[n].coeff_fd, (off_t)start) == MAP_FAILED)
+				return stbi__err("can't remap scratch file", "Out of memory");
+		}
+#endif
 	}
-	j->restart_interval = 0;
-	if (!stbi__decode_jpeg_header(j, STBI__SCAN_load))
-		return 0;
-	m = stbi__get_marker(j);
-	while (!stbi__EOI(m))
+#else
+	STBI_NOTUSED(z);
+	STBI_NOTUSED(n);
+	STBI_NOTUSED(j);
+#endif
+	return 1;
+}
+
+// let the coefficients of the first 'rows' MCU rows of every component go
+// once they've been finished
+static int stbi__jpeg_release_rows(stbi__jpeg *z, int rows)
+{
+	int n;
+	for (n = 0; n < z->s->img_n; ++n)
+		if (!stbi__jpeg_coeff_release(z, n, rows * z->img_comp[n].v))
+			return 0;
+	return 1;
+}
+
+static int stbi__jpeg_decode_scan(stbi__jpeg *z)
+{
+	int end = stbi__jpeg_scan_end(z);
+	stbi__jpeg_reset(z);
+	// this scan may change pixels that were already output
+	if (z->out)
+		z->out->rows_done = 0;
+	if (!z->progressive)
 	{
-		if (stbi__SOS(m))
+#ifdef STBI_JPEG_THREADS
+		// splitting the scan needs random access to the whole entropy-coded
+		// segment. a scan cut short by the output region is left to the
+		// serial decoder unless it has restart intervals, since speculation
+		// would decode all of it
+		if (stbi__jpeg_thread_count > 1 && !z->s->io.read && !z->coefficients && (z->restart_interval || end == stbi__jpeg_scan_mcus(z)))
 		{
-			if (!stbi__process_scan_header(j))
-				return 0;
-			if (!stbi__parse_entropy_coded_data(j))
-				return 0;
-			if (j->marker == STBI__MARKER_none)
+			int r = z->restart_interval ? stbi__jpeg_decode_restart_parallel(z) : stbi__jpeg_decode_speculative(z);
+			if (r)
+				return r > 0;
+		}
+		// otherwise overlap decoding with reconstruction and output, as long
+		// as this scan covers every component
+		if (z->out && stbi__jpeg_thread_count > 1 && z->scan_n == z->s->img_n)
+			return stbi__jpeg_decode_pipelined(z);
+#endif
+		return stbi__jpeg_decode_baseline_from(z, 0);
+	}
+	else
+	{
+		// a component reconstructed at 1/8 only uses DC coefficients, so its
+		// AC scans (always non-interleaved) can be passed over undecoded
+		if (z->spec_start != 0 && z->img_comp[z->order[0]].bshift == 0)
+			return stbi__jpeg_skip_scan(z);
+		if (z->scan_n == 1)
+		{
+			int i, j;
+			int n = z->order[0];
+			// non-interleaved data, we just need to process one block at a time,
+			// in trivial scanline order
+			// number of blocks to do just depends on how many actual "pixels" this
+			// component has, independent of interleaved MCU blocking and such
+			int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].bshift);
+			int h = stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].bshift);
+			for (j = 0; j < h; ++j)
 			{
-				// handle 0s at the end of image data from IP Kamera 9060
-				while (!stbi__at_eof(j->s))
+				for (i = 0; i < w; ++i)
 				{
-					int x = stbi__get8(j->s);
-					if (x == 255)
+					short *data = z->img_comp[n].coeff + 64 * (i + j * z->img_comp[n].coeff_w);
+					if (j * w + i == end)
+						return 1;
+					if (z->spec_start == 0)
 					{
-						j->marker = stbi__get8(j->s);
-						break;
+						if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
+							return 0;
+					}
+					else
+					{
+						int ha = z->img_comp[n].ha;
+						if (!stbi__jpeg_decode_block_prog_ac(z, data, &z->huff_ac[ha], z->fast_ac[ha]))
+							return 0;
+					}
+					// every data block is an MCU, so countdown the restart interval
+					if (--z->todo <= 0)
+					{
+						if (z->code_bits < 24)
+							stbi__grow_buffer_unsafe(z);
+						if (!STBI__RESTART(z->marker))
+							return 1;
+						stbi__jpeg_reset(z);
 					}
 				}
-				// if we reach eof without hitting a marker, stbi__get_marker() below will fail and we'll eventually return 0
+				if (!stbi__jpeg_coeff_release(z, n, j + 1))
+					return 0;
 			}
-		}
-		else if (stbi__DNL(m))
-		{
-			int Ld = stbi__get16be(j->s);
-			stbi__uint32 NL = stbi__get16be(j->s);
-			if (Ld != 4)
-				return stbi__err("bad DNL len", "Corrupt JPEG");
-			if (NL != j->s->img_y)
-				return stbi__err("bad DNL height", "Corrupt JPEG");
+			return 1;
 		}
 		else
-		{
-			if (!stbi__process_marker(j, m))
-				return 0;
+		{ // interleaved
+			int i, j, k, x, y;
+			for (j = 0; j < z->img_mcu_y; ++j)
+			{
+				for (i = 0; i < z->img_mcu_x; ++i)
+				{
+					if (j * z->img_mcu_x + i == end)
+						return 1;
+					// scan an interleaved mcu... process scan_n components in order
+					for (k = 0; k < z->scan_n; ++k)
+					{
+						int n = z->order[k];
+						// scan out an mcu's worth of this component; that's just determined
+						// by the basic H and V specified for the component
+						for (y = 0; y < z->img_comp[n].v; ++y)
+						{
+							for (x = 0; x < z->img_comp[n].h; ++x)
+							{
+								int x2 = (i * z->img_comp[n].h + x);
+								int y2 = (j * z->img_comp[n].v + y);
+								short *data = z->img_comp[n].coeff + 64 * (x2 + y2 * z->img_comp[n].coeff_w);
+								if (!stbi__jpeg_decode_block_prog_dc(z, data, &z->huff_dc[z->img_comp[n].hd], n))
+									return 0;
+							}
+						}
+					}
+					// after all interleaved components, that's an interleaved MCU,
+					// so now count down the restart interval
+					if (--z->todo <= 0)
+					{
+						if (z->code_bits < 24)
+							stbi__grow_buffer_unsafe(z);
+						if (!STBI__RESTART(z->marker))
+							return 1;
+						stbi__jpeg_reset(z);
+					}
+				}
+				for (k = 0; k < z->scan_n; ++k)
+					if (!stbi__jpeg_coeff_release(z, z->order[k], (j + 1) * z->img_comp[z->order[k]].v))
+						return 0;
+			}
+			return 1;
 		}
-		m = stbi__get_marker(j);
 	}
-	if (j->progressive)
-		stbi__jpeg_finish(j);
-	return 1;
 }
 
-// static jfif-centered resampling (across block boundaries)
-
-typedef stbi_uc *(*resample_row_func)(stbi_uc *out, stbi_uc *in0, stbi_uc *in1,
-												  int w, int hs);
-
-#define stbi__div4(x) ((stbi_uc)((x) >> 2))
-
-static stbi_uc *resample_row_1(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+static int stbi__parse_entropy_coded_data(stbi__jpeg *z)
 {
-	STBI_NOTUSED(out);
-	STBI_NOTUSED(in_far);
-	STBI_NOTUSED(w);
-	STBI_NOTUSED(hs);
-	return in_near;
+	int r = stbi__jpeg_decode_scan(z);
+	// a scan that stopped at the end of the output region is passed over to
+	// the marker after it; the bit reader may be sitting on a restart
+	if (r && (z->marker == STBI__MARKER_none || STBI__RESTART(z->marker)) && stbi__jpeg_scan_end(z) < stbi__jpeg_scan_mcus(z))
+	{
+		z->marker = STBI__MARKER_none;
+		return stbi__jpeg_skip_scan(z);
+	}
+	return r;
 }
 
-static stbi_uc *stbi__resample_row_v_2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+static void stbi__jpeg_dequantize(short *data, stbi__uint16 *dequant)
 {
-	// need to generate two samples vertically for every one in input
 	int i;
-	STBI_NOTUSED(hs);
-	for (i = 0; i < w; ++i)
-		out[i] = stbi__div4(3 * in_near[i] + in_far[i] + 2);
-	return out;
+	for (i = 0; i < 64; ++i)
+		data[i] *= dequant[i];
 }
 
-static stbi_uc *stbi__resample_row_h_2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+// dequantize and idct the blocks of every component in one MCU row, or
+// the ones under the output region. with 'keep' the coefficients are
+// dequantized in a copy, so more scans can still be added to them;
+// otherwise they're done with, and stbi__jpeg_release_rows can let them go
+static void stbi__jpeg_finish_row(stbi__jpeg *z, int row, int keep)
 {
-	// need to generate two samples horizontally for every one in input
-	int i;
-	stbi_uc *input = in_near;
-
-	if (w == 1)
+	STBI_SIMD_ALIGN(short, copy[128]);
+	int i, j, n;
+	for (n = 0; n < z->s->img_n; ++n)
 	{
-		// if only one sample, can't do any interpolation
-		out[0] = out[1] = input[0];
-		return out;
+		int bs = 1 << z->img_comp[n].bshift;
+		int w = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].bshift);
+		int h = stbi__jpeg_blocks(z->img_comp[n].y, z->img_comp[n].bshift);
+		int i0 = z->img_comp[n].bx0, j1 = (row + 1) * z->img_comp[n].v;
+		if (w > z->img_comp[n].bx1)
+			w = z->img_comp[n].bx1;
+		if (h > z->img_comp[n].by1)
+			h = z->img_comp[n].by1;
+		for (j = row * z->img_comp[n].v; j < j1 && j < h; ++j)
+		{
+			short *data = z->img_comp[n].coeff + 64 * j * z->img_comp[n].coeff_w;
+			stbi_uc *out = z->img_comp[n].data + z->img_comp[n].w2 * (j * bs - z->img_comp[n].row0);
+			if (j < z->img_comp[n].by0)
+				continue;
+			// blocks in a row are reconstructed in pairs
+			for (i = i0; i < w; i += 2)
+			{
+				short *b = data + 64 * i;
+				int pair = i + 1 < w;
+				if (keep)
+				{
+					memcpy(copy, b, (pair ? 128 : 64) * sizeof(short));
+					b = copy;
+				}
+				stbi__jpeg_dequantize(b, stbi__jpeg_dequant(z, n));
+				if (pair)
+				{
+					stbi__jpeg_dequantize(b + 64, stbi__jpeg_dequant(z, n));
+					stbi__jpeg_idct_pair(z, n, out + i * bs, out + i * bs + bs, z->img_comp[n].w2, b, b + 64, stbi__jpeg_block_support(b), stbi__jpeg_block_support(b + 64));
+				}
+				else
+					stbi__jpeg_idct_one(z, n, out + i * bs, z->img_comp[n].w2, b, stbi__jpeg_block_support(b));
+			}
+		}
 	}
+}
 
-	out[0] = input[0];
-	out[1] = stbi__div4(input[0] * 3 + input[1] + 2);
-	for (i = 1; i < w - 1; ++i)
+#ifdef STBI_JPEG_THREADS
+static int stbi__jpeg_finish_parallel(stbi__jpeg *z);
+#endif
+
+static int stbi__jpeg_finish(stbi__jpeg *z)
+{
+	if (z->progressive)
 	{
-		int n = 3 * input[i] + 2;
-		out[i * 2 + 0] = stbi__div4(n + input[i - 1]);
-		out[i * 2 + 1] = stbi__div4(n + input[i + 1]);
+		int row;
+#ifdef STBI_JPEG_THREADS
+		if (z->out && stbi__jpeg_thread_count > 1)
+		{
+			int r = stbi__jpeg_finish_parallel(z);
+			if (r)
+				return r > 0;
+		}
+#endif
+		// dequantize and idct the data
+		for (row = 0; row < stbi__jpeg_mcu_rows_used(z); ++row)
+		{
+			stbi__jpeg_finish_row(z, row, 0);
+			if (!stbi__jpeg_release_rows(z, row + 1))
+				return 0;
+		}
 	}
-	out[i * 2 + 0] = stbi__div4(input[w - 2] * 3 + input[w - 1] + 2);
-	out[i * 2 + 1] = input[w - 1];
+	return 1;
+}
 
-	STBI_NOTUSED(in_far);
-	STBI_NOTUSED(hs);
+// stbi__jpeg.exif bits
+#define STBI__EXIF_orientation 1
+#define STBI__EXIF_thumbnail 2
 
-	return out;
+// EXIF is a TIFF file inside the APP1 segment, in either byte order
+static stbi__uint32 stbi__exif_get(const stbi_uc *p, int bytes, int le)
+{
+	stbi__uint32 v = 0;
+	int i;
+	for (i = 0; i < bytes; ++i)
+		v |= (stbi__uint32)p[le ? i : bytes - 1 - i] << (8 * i);
+	return v;
 }
 
-#define stbi__div16(x) ((stbi_uc)((x) >> 4))
+// pick what's wanted out of an APP1 segment's EXIF data. anything that
+// doesn't look right is just ignored, as the image can be decoded anyway
+// entry i of the IFD at ifd in the len bytes of TIFF data at t, or NULL
+// once i is past its count or the entry is past the data. len is at least 14
+static const stbi_uc *stbi__exif_entry(const stbi_uc *t, stbi__uint32 len, stbi__uint32 ifd, stbi__uint32 i, int le)
+{
+	if (ifd > len - 2) // ifd + 2 <= len, without wrapping
+		return NULL;
+	if (i >= stbi__exif_get(t + ifd, 2, le) || ifd + 2 + 12 * (i + 1) > len)
+		return NULL;
+	return t + ifd + 2 + 12 * i;
+}
 
-static stbi_uc *stbi__resample_row_hv_2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+static void stbi__jpeg_parse_exif(stbi__jpeg *z, const stbi_uc *p, int len)
 {
-	// need to generate 2x2 samples for every one in input
-	int i, t0, t1;
-	if (w == 1)
+	stbi__uint32 ifd, next, i, off = 0, size = 0;
+	const stbi_uc *e;
+	const stbi_uc *t = p + 6;
+	int le;
+	len -= 6;
+	// the TIFF header and at least an IFD count and link, so none of the
+	// bounds below go negative
+	if (memcmp(p, "Exif\0\0", 6) != 0 || len < 14)
+		return;
+	if (t[0] == 'I' && t[1] == 'I')
+		le = 1;
+	else if (t[0] == 'M' && t[1] == 'M')
+		le = 0;
+	else
+		return;
+	if (stbi__exif_get(t + 2, 2, le) != 42)
+		return;
+
+	// IFD0 describes the image, and links to IFD1, the thumbnail's
+	ifd = stbi__exif_get(t + 4, 4, le);
+	if (ifd > (stbi__uint32)len - 2)
+		return;
+	for (i = 0; (e = stbi__exif_entry(t, len, ifd, i, le)) != NULL; ++i)
 	{
-		out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
-		return out;
+		if (stbi__exif_get(e, 2, le) == 0x112 && stbi__exif_get(e + 2, 2, le) == 3) // Orientation, a SHORT
+		{
+			int v = stbi__exif_get(e + 8, 2, le);
+			if (v >= 1 && v <= 8)
+				z->orientation = v;
+		}
 	}
-
-	t1 = 3 * in_near[0] + in_far[0];
-	out[0] = stbi__div4(t1 + 2);
-	for (i = 1; i < w; ++i)
+	if (!(z->exif & STBI__EXIF_thumbnail))
+		return;
+	next = ifd + 2 + 12 * stbi__exif_get(t + ifd, 2, le);
+	if (next > (stbi__uint32)len - 4)
+		return;
+	ifd = stbi__exif_get(t + next, 4, le);
+	if (ifd == 0)
+		return;
+	for (i = 0; (e = stbi__exif_entry(t, len, ifd, i, le)) != NULL; ++i)
 	{
-		t0 = t1;
-		t1 = 3 * in_near[i] + in_far[i];
-		out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
-		out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+		int tag = stbi__exif_get(e, 2, le);
+		int type = stbi__exif_get(e + 2, 2, le);
+		// a SHORT or LONG value, held in the entry itself
+		stbi__uint32 v = type == 3 ? stbi__exif_get(e + 8, 2, le) : stbi__exif_get(e + 8, 4, le);
+		if (tag == 0x201) // JPEGInterchangeFormat
+			off = v;
+		else if (tag == 0x202) // JPEGInterchangeFormatLength
+			size = v;
+	}
+	// an uncompressed TIFF thumbnail has neither of these
+	if (off && size && off <= (stbi__uint32)len && size <= (stbi__uint32)len - off && !z->exif_thumb)
+	{
+		z->exif_thumb = (stbi_uc *)stbi__malloc(size);
+		if (z->exif_thumb)
+		{
+			memcpy(z->exif_thumb, t + off, size);
+			z->exif_thumb_len = (int)size;
+		}
 	}
-	out[w * 2 - 1] = stbi__div4(t1 + 2);
-
-	STBI_NOTUSED(hs);
-
-	return out;
 }
 
-#if defined(STBI_SSE2) || defined(STBI_NEON)
-static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+// the example tables of ITU T.81 K.3, as DHT payloads. Motion JPEG frames
+// leave their DHT segment out and are decoded with these (class 0/1, id 0/1)
+static const stbi_uc stbi__jpeg_std_dc_luminance[16 + 12] = {
+	 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0,
+	 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const stbi_uc stbi__jpeg_std_dc_chrominance[16 + 12] = {
+	 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0,
+	 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const stbi_uc stbi__jpeg_std_ac_luminance[16 + 162] = {
+	 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d,
+	 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+	 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+static const stbi_uc stbi__jpeg_std_ac_chrominance[16 + 162] = {
+	 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77,
+	 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+
+// build huffman table th of class tc (0 DC, 1 AC) from a DHT payload,
+// unless it's already been built from the same one
+static int stbi__jpeg_define_huffman(stbi__jpeg *z, int tc, int th, const stbi_uc *spec)
 {
-	// need to generate 2x2 samples for every one in input
-	int i = 0, t0, t1;
-
-	if (w == 1)
+	int sizes[16], i, n = 0, slot = tc * 4 + th;
+	stbi__huffman *h = tc ? z->huff_ac + th : z->huff_dc + th;
+	for (i = 0; i < 16; ++i)
+		n += sizes[i] = spec[i];
+	z->huff_defined |= 1 << slot;
+	if ((z->huff_valid >> slot) & 1 && memcmp(z->huff_spec[slot], spec, 16 + n) == 0)
+		return 1;
+	z->huff_valid &= ~(1 << slot);
+	if (!stbi__build_huffman(h, sizes))
+		return 0;
+	memcpy(h->values, spec + 16, n);
+	if (tc != 0)
 	{
-		out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
-		return out;
+		stbi__build_fast_ac(z->fast_ac[th], h);
+		stbi__build_multi_ac(z->multi_ac[th], h);
 	}
+	memcpy(z->huff_spec[slot], spec, 16 + n);
+	z->huff_valid |= 1 << slot;
+	return 1;
+}
 
-	t1 = 3 * in_near[0] + in_far[0];
-	// process groups of 8 pixels for as long as we can.
-	// note we can't handle the last pixel in a row in this loop
-	// because we need to handle the filter boundary conditions.
-	for (; i < ((w - 1) & ~7); i += 8)
+// make sure table th of class tc has been defined by this frame, with the
+// standard one if the file left it out
+static int stbi__jpeg_need_huffman(stbi__jpeg *z, int tc, int th)
+{
+	static const stbi_uc *standard[2][2] = {
+		 {stbi__jpeg_std_dc_luminance, stbi__jpeg_std_dc_chrominance},
+		 {stbi__jpeg_std_ac_luminance, stbi__jpeg_std_ac_chrominance}};
+	if ((z->huff_defined >> (tc * 4 + th)) & 1)
+		return 1;
+	if (th > 1)
+		return stbi__err("undefined huffman table", "Corrupt JPEG");
+	return stbi__jpeg_define_huffman(z, tc, th, standard[tc][th]);
+}
+
+static int stbi__process_marker(stbi__jpeg *z, int m)
+{
+	int L;
+	switch (m)
 	{
-#if defined(STBI_SSE2)
-		// load and perform the vertical filtering pass
-		// this uses 3*x + y = 4*x + (y - x)
-		__m128i zero = _mm_setzero_si128();
-		__m128i farb = _mm_loadl_epi64((__m128i *)(in_far + i));
-		__m128i nearb = _mm_loadl_epi64((__m128i *)(in_near + i));
-		__m128i farw = _mm_unpacklo_epi8(farb, zero);
-		__m128i nearw = _mm_unpacklo_epi8(nearb, zero);
-		__m128i diff = _mm_sub_epi16(farw, nearw);
-		__m128i nears = _mm_slli_epi16(nearw, 2);
-		__m128i curr = _mm_add_epi16(nears, diff); // current row
+	case STBI__MARKER_none: // no marker found
+		return stbi__err("expected marker", "Corrupt JPEG");
 
-		// horizontal filter works the same based on shifted vers of current
-		// row. "prev" is current row shifted right by 1 pixel; we need to
+	case 0xDD: // DRI - specify restart interval
+		if (stbi__get16be(z->s) != 4)
+			return stbi__err("bad DRI len", "Corrupt JPEG");
+		z->restart_interval = stbi__get16be(z->s);
+		return 1;
+
+	case 0xDB: // DQT - define quantization table
+		L = stbi__get16be(z->s) - 2;
+		while (L > 0)
+		{
+			int q = stbi__get8(z->s);
+			int p = q >> 4, sixteen = (p != 0);
+			int t = q & 15, i;
+			if (p != 0 && p != 1)
+				return stbi__err("bad DQT type", "Corrupt JPEG");
+			if (t > 3)
+				return stbi__err("bad DQT table", "Corrupt JPEG");
+
+			for (i = 0; i < 64; ++i)
+				z->dequant[t][stbi__jpeg_dezigzag[i]] = (stbi__uint16)(sixteen ? stbi__get16be(z->s) : stbi__get8(z->s));
+			for (i = 0; i < 64; ++i)
+			{
+				int v = (z->dequant[t][i] * stbi__aan_scale[i] + (1 << 10)) >> 11;
+				z->dequant_aan[t][i] = (stbi__uint16)(v > 65535 ? 65535 : v);
+			}
+			L -= (sixteen ? 129 : 65);
+		}
+		return L == 0;
+
+	case 0xC4: // DHT - define huffman table
+		L = stbi__get16be(z->s) - 2;
+		while (L > 0)
+		{
+			stbi_uc spec[16 + 256];
+			int i, n = 0;
+			int q = stbi__get8(z->s);
+			int tc = q >> 4;
+			int th = q & 15;
+			if (tc > 1 || th > 3)
+				return stbi__err("bad DHT header", "Corrupt JPEG");
+			for (i = 0; i < 16; ++i)
+				n += spec[i] = stbi__get8(z->s);
+			if (n > 256)
+				return stbi__err("bad DHT header", "Corrupt JPEG");
+			for (i = 0; i < n; ++i)
+				spec[16 + i] = stbi__get8(z->s);
+			if (!stbi__jpeg_define_huffman(z, tc, th, spec))
+				return 0;
+			L -= 17 + n;
+		}
+		return L == 0;
+	}
+
+	// check for comment block or APP blocks
+	if ((m >= 0xE0 && m <= 0xEF) || m == 0xFE)
+	{
+		L = stbi__get16be(z->s);
+		if (L < 2)
+		{
+			if (m == 0xFE)
+				return stbi__err("bad COM len", "Corrupt JPEG");
+			else
+				return stbi__err("bad APP len", "Corrupt JPEG");
+		}
+		L -= 2;
+
+		if (m == 0xE0 && L >= 5)
+		{ // JFIF APP0 segment
+			static const unsigned char tag[5] = {'J', 'F', 'I', 'F', '\0'};
+			int ok = 1;
+			int i;
+			for (i = 0; i < 5; ++i)
+				if (stbi__get8(z->s) != tag[i])
+					ok = 0;
+			L -= 5;
+			if (ok)
+				z->jfif = 1;
+		}
+		else if (m == 0xE1 && z->exif && L >= 14)
+		{ // EXIF APP1 segment
+			stbi_uc *exif = (stbi_uc *)stbi__malloc(L);
+			if (!exif)
+				return stbi__err("outofmem", "Out of memory");
+			if (!stbi__getn(z->s, exif, L))
+			{
+				STBI_FREE(exif);
+				return stbi__err("bad APP len", "Corrupt JPEG");
+			}
+			stbi__jpeg_parse_exif(z, exif, L);
+			STBI_FREE(exif);
+			L = 0;
+		}
+		else if (m == 0xEE && L >= 12)
+		{ // Adobe APP14 segment
+			static const unsigned char tag[6] = {'A', 'd', 'o', 'b', 'e', '\0'};
+			int ok = 1;
+			int i;
+			for (i = 0; i < 6; ++i)
+				if (stbi__get8(z->s) != tag[i])
+					ok = 0;
+			L -= 6;
+			if (ok)
+			{
+				stbi__get8(z->s);                            // version
+				stbi__get16be(z->s);                         // flags0
+				stbi__get16be(z->s);                         // flags1
+				z->app14_color_transform = stbi__get8(z->s); // color transform
+				L -= 6;
+			}
+		}
+
+		stbi__skip(z->s, L);
+		return 1;
+	}
+
+	return stbi__err("unknown marker", "Corrupt JPEG");
+}
+
+// after we see SOS
+static int stbi__process_scan_header(stbi__jpeg *z)
+{
+	int i;
+	int Ls = stbi__get16be(z->s);
+	z->scan_n = stbi__get8(z->s);
+	if (z->scan_n < 1 || z->scan_n > 4 || z->scan_n > (int)z->s->img_n)
+		return stbi__err("bad SOS component count", "Corrupt JPEG");
+	if (Ls != 6 + 2 * z->scan_n)
+		return stbi__err("bad SOS len", "Corrupt JPEG");
+	for (i = 0; i < z->scan_n; ++i)
+	{
+		int id = stbi__get8(z->s), which;
+		int q = stbi__get8(z->s);
+		for (which = 0; which < z->s->img_n; ++which)
+			if (z->img_comp[which].id == id)
+				break;
+		if (which == z->s->img_n)
+			return 0; // no match
+		z->img_comp[which].hd = q >> 4;
+		if (z->img_comp[which].hd > 3)
+			return stbi__err("bad DC huff", "Corrupt JPEG");
+		z->img_comp[which].ha = q & 15;
+		if (z->img_comp[which].ha > 3)
+			return stbi__err("bad AC huff", "Corrupt JPEG");
+		z->order[i] = which;
+	}
+
+	{
+		int aa;
+		z->spec_start = stbi__get8(z->s);
+		z->spec_end = stbi__get8(z->s); // should be 63, but might be 0
+		aa = stbi__get8(z->s);
+		z->succ_high = (aa >> 4);
+		z->succ_low = (aa & 15);
+		if (z->progressive)
+		{
+			if (z->spec_start > 63 || z->spec_end > 63 || z->spec_start > z->spec_end || z->succ_high > 13 || z->succ_low > 13)
+				return stbi__err("bad SOS", "Corrupt JPEG");
+		}
+		else
+		{
+			if (z->spec_start != 0)
+				return stbi__err("bad SOS", "Corrupt JPEG");
+			if (z->succ_high != 0 || z->succ_low != 0)
+				return stbi__err("bad SOS", "Corrupt JPEG");
+			z->spec_end = 63;
+		}
+	}
+
+	for (i = 0; i < z->scan_n; ++i)
+	{
+		int k = z->order[i];
+		if (z->spec_start == 0 && z->succ_high == 0 && !stbi__jpeg_need_huffman(z, 0, z->img_comp[k].hd))
+			return 0;
+		if (z->spec_end > 0 && !stbi__jpeg_need_huffman(z, 1, z->img_comp[k].ha))
+			return 0;
+	}
+	return 1;
+}
+
+// a decoder object's buffers start with their size, so a spare can be
+// matched to the next request for one
+#define STBI__JPEG_BUF_HEADER 16
+
+// the decoder's own buffers: the planes, progressive coefficients and line
+// buffers. a decoder object reuses the smallest spare one that's big enough
+static void *stbi__jpeg_alloc_buf(stbi__jpeg *z, size_t size)
+{
+	int i, best = -1;
+	stbi_uc *p;
+	if (!z->keep)
+		return stbi__malloc(size);
+	for (i = 0; i < STBI__JPEG_SPARES; ++i)
+		if (z->spare[i] && *(size_t *)z->spare[i] >= size && (best < 0 || *(size_t *)z->spare[i] < *(size_t *)z->spare[best]))
+			best = i;
+	if (best >= 0)
+	{
+		p = z->spare[best];
+		z->spare[best] = NULL;
+	}
+	else
+	{
+		p = (stbi_uc *)stbi__malloc(size + STBI__JPEG_BUF_HEADER);
+		if (!p)
+			return NULL;
+		*(size_t *)p = size;
+	}
+	return p + STBI__JPEG_BUF_HEADER;
+}
+
+static void stbi__jpeg_free_buf(stbi__jpeg *z, void *p)
+{
+	int i;
+	if (!z->keep || !p)
+	{
+		STBI_FREE(p);
+		return;
+	}
+	p = (stbi_uc *)p - STBI__JPEG_BUF_HEADER;
+	for (i = 0; i < STBI__JPEG_SPARES; ++i)
+		if (!z->spare[i])
+		{
+			z->spare[i] = (stbi_uc *)p;
+			return;
+		}
+	STBI_FREE(p);
+}
+
+static int stbi__free_jpeg_components(stbi__jpeg *z, int ncomp, int why)
+{
+	int i;
+	for (i = 0; i < ncomp; ++i)
+	{
+		if (z->img_comp[i].raw_data)
+		{
+			stbi__jpeg_free_buf(z, z->img_comp[i].raw_data);
+			z->img_comp[i].raw_data = NULL;
+			z->img_comp[i].data = NULL;
+		}
+		if (z->img_comp[i].raw_coeff)
+		{
+#ifdef STBI_JPEG_SCRATCH
+			if (z->img_comp[i].coeff_mapped)
+				stbi__jpeg_scratch_unmap(z->img_comp[i].raw_coeff, z->img_comp[i].coeff_mapped, z->img_comp[i].coeff_fd);
+			else
+#endif
+				stbi__jpeg_free_buf(z, z->img_comp[i].raw_coeff);
+			z->img_comp[i].raw_coeff = 0;
+			z->img_comp[i].coeff = 0;
+			z->img_comp[i].coeff_mapped = 0;
+		}
+		if (z->img_comp[i].linebuf)
+		{
+			stbi__jpeg_free_buf(z, z->img_comp[i].linebuf);
+			z->img_comp[i].linebuf = NULL;
+		}
+	}
+	return why;
+}
+
+// plane rows a streamed component keeps: one MCU row, plus the rows above
+// it that output rows across the boundary are upsampled from
+#define STBI__JPEG_STREAM_HISTORY 3
+#define STBI__JPEG_STREAM_ROWS(z, i) (((z)->img_comp[i].v << (z)->img_comp[i].bshift) + STBI__JPEG_STREAM_HISTORY)
+
+// allocate the plane of component i, 'rows' rows tall
+static int stbi__jpeg_alloc_plane(stbi__jpeg *z, int i, int rows)
+{
+	z->img_comp[i].h2 = rows;
+	z->img_comp[i].row0 = 0;
+	if (!stbi__mad2sizes_valid(z->img_comp[i].w2, rows, 15))
+		return stbi__err("outofmem", "Out of memory");
+	z->img_comp[i].raw_data = stbi__jpeg_alloc_buf(z, z->img_comp[i].w2 * rows + 15);
+	if (z->img_comp[i].raw_data == NULL)
+		return stbi__err("outofmem", "Out of memory");
+	// align blocks for idct using mmx/sse
+	z->img_comp[i].data = (stbi_uc *)(((size_t)z->img_comp[i].raw_data + 15) & ~15);
+	return 1;
+}
+
+// give every component a plane for the whole image, for when a streamed
+// image turns out to need more than one scan
+static int stbi__jpeg_full_planes(stbi__jpeg *z)
+{
+	int i;
+	for (i = 0; i < z->s->img_n; ++i)
+	{
+		int rows = (z->img_mcu_y * z->img_comp[i].v) << z->img_comp[i].bshift;
+		if (z->img_comp[i].h2 == rows)
+			continue;
+		stbi__jpeg_free_buf(z, z->img_comp[i].raw_data);
+		z->img_comp[i].raw_data = NULL;
+		if (!stbi__jpeg_alloc_plane(z, i, rows))
+			return 0;
+	}
+	z->stream = 0;
+	return 1;
+}
+
+// allocate every plane in one block, each aligned for the idct, so they
+// can be handed out together
+static int stbi__jpeg_alloc_planes(stbi__jpeg *z)
+{
+	int i, size = 0, offset[4];
+	stbi_uc *base;
+	for (i = 0; i < z->s->img_n; ++i)
+	{
+		int plane;
+		z->img_comp[i].h2 = (z->img_mcu_y * z->img_comp[i].v) << z->img_comp[i].bshift;
+		z->img_comp[i].row0 = 0;
+		if (!stbi__mad2sizes_valid(z->img_comp[i].w2, z->img_comp[i].h2, 15))
+			return stbi__err("outofmem", "Out of memory");
+		plane = (z->img_comp[i].w2 * z->img_comp[i].h2 + 15) & ~15;
+		if (!stbi__addsizes_valid(size, plane + 15))
+			return stbi__err("outofmem", "Out of memory");
+		offset[i] = size;
+		size += plane;
+	}
+	z->img_comp[0].raw_data = stbi__malloc(size + 15);
+	if (z->img_comp[0].raw_data == NULL)
+		return stbi__err("outofmem", "Out of memory");
+	base = (stbi_uc *)(((size_t)z->img_comp[0].raw_data + 15) & ~15);
+	for (i = 0; i < z->s->img_n; ++i)
+		z->img_comp[i].data = base + offset[i];
+	return 1;
+}
+
+// allocate every component's coefficients in one block, cleared so blocks
+// the file never codes read as zero
+static int stbi__jpeg_alloc_coefficients(stbi__jpeg *z)
+{
+	int i, size = 0, offset[4];
+	short *base;
+	for (i = 0; i < z->s->img_n; ++i)
+	{
+		int blocks = z->img_comp[i].coeff_w * z->img_comp[i].coeff_h;
+		if (!stbi__mul2sizes_valid(z->img_comp[i].coeff_w, z->img_comp[i].coeff_h) || !stbi__addsizes_valid(size, blocks) || !stbi__mad2sizes_valid(size + blocks, 64 * sizeof(short), 15))
+			return stbi__err("outofmem", "Out of memory");
+		offset[i] = size * 64;
+		size += blocks;
+	}
+	z->img_comp[0].raw_coeff = stbi__malloc(size * 64 * sizeof(short) + 15);
+	if (z->img_comp[0].raw_coeff == NULL)
+		return stbi__err("outofmem", "Out of memory");
+	base = (short *)(((size_t)z->img_comp[0].raw_coeff + 15) & ~15);
+	memset(base, 0, size * 64 * sizeof(short));
+	for (i = 0; i < z->s->img_n; ++i)
+		z->img_comp[i].coeff = base + offset[i];
+	return 1;
+}
+
+// upsampling from component k's plane to the output. a component
+// reconstructed bigger than 8 >> scale needs less of it
+static void stbi__jpeg_expansion(stbi__jpeg *z, int k, int *hs, int *vs)
+{
+	*hs = (z->img_h_max / z->img_comp[k].h) >> (z->img_comp[k].bshift - 3 + z->scale);
+	*vs = (z->img_v_max / z->img_comp[k].v) >> (z->img_comp[k].bshift - 3 + z->scale);
+}
+
+// clip the output region to the image, and work out which blocks of each
+// component it reads: the upsamplers look one pixel to either side
+// horizontally, and at the plane rows around each output row vertically
+static int stbi__jpeg_set_region(stbi__jpeg *z)
+{
+	int img_x = z->s->img_x, img_y = z->s->img_y, k;
+	if (z->crop_w == 0)
+	{
+		z->crop_x = z->crop_y = 0;
+		z->crop_w = img_x;
+		z->crop_h = img_y;
+	}
+	if (z->crop_x < 0)
+	{
+		z->crop_w += z->crop_x;
+		z->crop_x = 0;
+	}
+	if (z->crop_y < 0)
+	{
+		z->crop_h += z->crop_y;
+		z->crop_y = 0;
+	}
+	if (z->crop_w > img_x - z->crop_x)
+		z->crop_w = img_x - z->crop_x;
+	if (z->crop_h > img_y - z->crop_y)
+		z->crop_h = img_y - z->crop_y;
+	if (z->crop_w <= 0 || z->crop_h <= 0)
+		return stbi__err("bad region", "Region is outside the image");
+
+	for (k = 0; k < z->s->img_n; ++k)
+	{
+		int hs, vs, w, x0, x1, y0, y1, b = z->img_comp[k].bshift;
+		stbi__jpeg_expansion(z, k, &hs, &vs);
+		w = (img_x + hs - 1) / hs;
+		x0 = z->crop_x / hs - 1;
+		x1 = (z->crop_x + z->crop_w - 1) / hs + 2;
+		y0 = (z->crop_y + (vs >> 1)) / vs - 1;
+		y1 = (z->crop_y + z->crop_h - 1 + (vs >> 1)) / vs + 1;
+		if (x0 < 0)
+			x0 = 0;
+		if (x1 > w)
+			x1 = w;
+		if (y0 < 0)
+			y0 = 0;
+		if (y1 > z->img_comp[k].y)
+			y1 = z->img_comp[k].y;
+		z->img_comp[k].bx0 = x0 >> b;
+		z->img_comp[k].bx1 = ((x1 - 1) >> b) + 1;
+		z->img_comp[k].by0 = y0 >> b;
+		z->img_comp[k].by1 = ((y1 - 1) >> b) + 1;
+	}
+	return 1;
+}
+
+static int stbi__process_frame_header(stbi__jpeg *z, int scan)
+{
+	stbi__context *s = z->s;
+	int Lf, p, i, q, h_max = 1, v_max = 1, c;
+#ifdef STBI_JPEG_SCRATCH
+	int scratch = 0;
+#endif
+	Lf = stbi__get16be(s);
+	if (Lf < 11)
+		return stbi__err("bad SOF len", "Corrupt JPEG"); // JPEG
+	p = stbi__get8(s);
+	if (p != 8)
+		return stbi__err("only 8-bit", "JPEG format not supported: 8-bit only"); // JPEG baseline
+	s->img_y = stbi__get16be(s);
+	if (s->img_y == 0)
+		return stbi__err("no header height", "JPEG format not supported: delayed height"); // Legal, but we don't handle it--but neither does IJG
+	s->img_x = stbi__get16be(s);
+	if (s->img_x == 0)
+		return stbi__err("0 width", "Corrupt JPEG"); // JPEG requires
+	if (s->img_y > STBI_MAX_DIMENSIONS)
+		return stbi__err("too large", "Very large image (corrupt?)");
+	if (s->img_x > STBI_MAX_DIMENSIONS)
+		return stbi__err("too large", "Very large image (corrupt?)");
+	c = stbi__get8(s);
+	if (c != 3 && c != 1 && c != 4)
+		return stbi__err("bad component count", "Corrupt JPEG");
+	s->img_n = c;
+	for (i = 0; i < c; ++i)
+	{
+		z->img_comp[i].data = NULL;
+		z->img_comp[i].linebuf = NULL;
+	}
+
+	if (Lf != 8 + 3 * s->img_n)
+		return stbi__err("bad SOF len", "Corrupt JPEG");
+
+	z->rgb = 0;
+	for (i = 0; i < s->img_n; ++i)
+	{
+		static const unsigned char rgb[3] = {'R', 'G', 'B'};
+		z->img_comp[i].id = stbi__get8(s);
+		if (s->img_n == 3 && z->img_comp[i].id == rgb[i])
+			++z->rgb;
+		q = stbi__get8(s);
+		z->img_comp[i].h = (q >> 4);
+		if (!z->img_comp[i].h || z->img_comp[i].h > 4)
+			return stbi__err("bad H", "Corrupt JPEG");
+		z->img_comp[i].v = q & 15;
+		if (!z->img_comp[i].v || z->img_comp[i].v > 4)
+			return stbi__err("bad V", "Corrupt JPEG");
+		z->img_comp[i].tq = stbi__get8(s);
+		if (z->img_comp[i].tq > 3)
+			return stbi__err("bad TQ", "Corrupt JPEG");
+	}
+
+	if (scan != STBI__SCAN_load)
+		return 1;
+
+	if (!stbi__mad3sizes_valid(s->img_x, s->img_y, s->img_n, 0))
+		return stbi__err("too large", "Image too large to decode");
+
+	for (i = 0; i < s->img_n; ++i)
+	{
+		if (z->img_comp[i].h > h_max)
+			h_max = z->img_comp[i].h;
+		if (z->img_comp[i].v > v_max)
+			v_max = z->img_comp[i].v;
+	}
+
+	// compute interleaved mcu info
+	z->img_h_max = h_max;
+	z->img_v_max = v_max;
+	z->img_mcu_w = h_max * 8;
+	z->img_mcu_h = v_max * 8;
+	// these sizes can't be more than 17 bits
+	z->img_mcu_x = (s->img_x + z->img_mcu_w - 1) / z->img_mcu_w;
+	z->img_mcu_y = (s->img_y + z->img_mcu_h - 1) / z->img_mcu_h;
+
+	// progressive coefficients too big to want on the heap go to a scratch
+	// file, and then a streamed image only needs planes a band tall
+	z->banded = 0;
+#ifdef STBI_JPEG_SCRATCH
+	if (stbi__jpeg_scratch_dir && z->progressive && !z->coefficients)
+	{
+		double size = 0;
+		for (i = 0; i < s->img_n; ++i)
+			size += (double)z->img_mcu_x * z->img_comp[i].h * z->img_mcu_y * z->img_comp[i].v * 64 * sizeof(short);
+		scratch = size >= STBI_JPEG_SCRATCH_MIN;
+		z->banded = scratch && z->stream == 1 && !z->planar && !z->preview;
+	}
+#endif
+
+	for (i = 0; i < s->img_n; ++i)
+	{
+		// scaled decoding uses reduced IDCTs. subsampled components are
+		// reconstructed bigger where that takes the place of upsampling
+		// (4:2:0 chroma at 1/2 is a plain 8x8 IDCT), like IJG does. the
+		// fast profiles use the AAN IDCT at full size if there is one
+		static void (*const reduced[3])(stbi_uc *out, int out_stride, short data[64]) = {stbi__idct_1x1, stbi__idct_2x2, stbi__idct_4x4};
+		int up = 0, d;
+		while (up < z->scale && h_max % (z->img_comp[i].h << (up + 1)) == 0 && v_max % (z->img_comp[i].v << (up + 1)) == 0)
+			++up;
+		z->img_comp[i].bshift = 3 - z->scale + up;
+		z->img_comp[i].aan = z->img_comp[i].bshift == 3 && z->profile != STBI_JPEG_ACCURATE && z->idct_aan_kernel;
+		z->img_comp[i].idct = z->img_comp[i].bshift == 3 ? z->idct_block_kernel : reduced[z->img_comp[i].bshift];
+		if (z->img_comp[i].aan)
+			z->img_comp[i].idct = z->idct_aan_kernel;
+
+		// number of effective pixels (e.g. for non-interleaved MCU), at the
+		// size being decoded
+		d = 8 >> z->img_comp[i].bshift;
+		z->img_comp[i].x = (s->img_x * z->img_comp[i].h + h_max * d - 1) / (h_max * d);
+		z->img_comp[i].y = (s->img_y * z->img_comp[i].v + v_max * d - 1) / (v_max * d);
+		// to simplify generation, we'll allocate enough memory to decode
+		// the bogus oversized data from using interleaved MCUs and their
+		// big blocks (e.g. a 16x16 iMCU on an image of width 33); we won't
+		// discard the extra data until colorspace conversion
+		//
+		// img_mcu_x, img_mcu_y: <=17 bits; comp[i].h and .v are <=4 (checked earlier)
+		// so these muls can't overflow with 32-bit ints (which we require)
+		z->img_comp[i].w2 = (z->img_mcu_x * z->img_comp[i].h) << z->img_comp[i].bshift;
+		z->img_comp[i].coeff = 0;
+		z->img_comp[i].raw_coeff = 0;
+		z->img_comp[i].coeff_mapped = 0;
+		z->img_comp[i].linebuf = NULL;
+		// a baseline image being streamed may only need a window of rows;
+		// stbi__jpeg_full_planes() grows it if not
+		if (!z->planar && !z->coefficients && !stbi__jpeg_alloc_plane(z, i, z->stream && (!z->progressive || z->banded) ? STBI__JPEG_STREAM_ROWS(z, i) : (z->img_mcu_y * z->img_comp[i].v) << z->img_comp[i].bshift))
+			return stbi__free_jpeg_components(z, i + 1, 0);
+		// coefficients are kept for every block whatever the scale
+		z->img_comp[i].coeff_w = z->img_mcu_x * z->img_comp[i].h;
+		z->img_comp[i].coeff_h = z->img_mcu_y * z->img_comp[i].v;
+		if (z->progressive && !z->coefficients)
+		{
+			if (stbi__mad3sizes_valid(z->img_comp[i].coeff_w * 8, z->img_comp[i].coeff_h * 8, sizeof(short), 15))
+			{
+				int size = z->img_comp[i].coeff_w * 8 * z->img_comp[i].coeff_h * 8 * sizeof(short) + 15;
+#ifdef STBI_JPEG_SCRATCH
+				// a mapping is page aligned and starts out zeroed
+				if (scratch)
+				{
+					z->img_comp[i].raw_coeff = stbi__jpeg_scratch_map(size, &z->img_comp[i].coeff_fd);
+					z->img_comp[i].coeff_mapped = z->img_comp[i].raw_coeff ? size : 0;
+					z->img_comp[i].coeff_released = 0;
+				}
+				if (z->img_comp[i].raw_coeff == NULL)
+#endif
+					z->img_comp[i].raw_coeff = stbi__jpeg_alloc_buf(z, size);
+			}
+			if (z->img_comp[i].raw_coeff == NULL)
+				return stbi__free_jpeg_components(z, i + 1, stbi__err("outofmem", "Out of memory"));
+			z->img_comp[i].coeff = (short *)(((size_t)z->img_comp[i].raw_coeff + 15) & ~15);
+		}
+	}
+
+	if (z->planar && !stbi__jpeg_alloc_planes(z))
+		return stbi__free_jpeg_components(z, s->img_n, 0);
+	if (z->coefficients && !stbi__jpeg_alloc_coefficients(z))
+		return stbi__free_jpeg_components(z, s->img_n, 0);
+
+	// from here on the image is the size it's being decoded at
+	s->img_x = (s->img_x + (1 << z->scale) - 1) >> z->scale;
+	s->img_y = (s->img_y + (1 << z->scale) - 1) >> z->scale;
+	if (!stbi__jpeg_set_region(z))
+		return stbi__free_jpeg_components(z, s->img_n, 0);
+	return 1;
+}
+
+// use comparisons since in some cases we handle more than one case (e.g. SOF)
+#define stbi__DNL(x) ((x) == 0xdc)
+#define stbi__SOI(x) ((x) == 0xd8)
+#define stbi__EOI(x) ((x) == 0xd9)
+#define stbi__SOF(x) ((x) == 0xc0 || (x) == 0xc1 || (x) == 0xc2)
+#define stbi__SOS(x) ((x) == 0xda)
+
+#define stbi__SOF_progressive(x) ((x) == 0xc2)
+
+static int stbi__decode_jpeg_header(stbi__jpeg *z, int scan)
+{
+	int m;
+	z->jfif = 0;
+	z->app14_color_transform = -1; // valid values are 0,1,2
+	z->orientation = 1;
+	z->huff_defined = 0;
+	z->marker = STBI__MARKER_none; // initialize cached marker to empty
+	m = stbi__get_marker(z);
+	if (!stbi__SOI(m))
+		return stbi__err("no SOI", "Corrupt JPEG");
+	if (scan == STBI__SCAN_type)
+		return 1;
+	m = stbi__get_marker(z);
+	while (!stbi__SOF(m))
+	{
+		if (!stbi__process_marker(z, m))
+			return 0;
+		m = stbi__get_marker(z);
+		while (m == STBI__MARKER_none)
+		{
+			// some files have extra padding after their blocks, so ok, we'll scan
+			if (stbi__at_eof(z->s))
+				return stbi__err("no SOF", "Corrupt JPEG");
+			m = stbi__get_marker(z);
+		}
+	}
+	z->progressive = stbi__SOF_progressive(m);
+	if (!stbi__process_frame_header(z, scan))
+		return 0;
+	return 1;
+}
+
+// after a scan's entropy-coded data, find the marker that follows it
+static void stbi__jpeg_end_scan(stbi__jpeg *j)
+{
+	if (j->marker == STBI__MARKER_none)
+	{
+		// handle 0s at the end of image data from IP Kamera 9060
+		while (!stbi__at_eof(j->s))
+		{
+			int x = stbi__get8(j->s);
+			if (x == 255)
+			{
+				j->marker = stbi__get8(j->s);
+				break;
+			}
+		}
+		// if we reach eof without hitting a marker, stbi__get_marker() will fail and we'll eventually return 0
+	}
+}
+
+static int stbi__jpeg_preview(stbi__jpeg *z);
+
+// whether markers after the scan starting here could still change how the
+// image is colour converted, which is set up before a streamed scan. that's
+// an Adobe marker, or a JFIF one that overrides it, unless the frame has
+// already settled it. the rest of an image in memory is looked through for
+// them, stepping over scans by their markers; anything else might have them
+static int stbi__jpeg_late_colour_markers(stbi__jpeg *z)
+{
+	const stbi_uc *p = z->s->img_buffer, *end = z->s->img_buffer_end;
+	if (z->s->img_n == 1 || (z->s->img_n == 3 && (z->rgb == 3 || z->jfif)))
+		return 0;
+	if (z->s->io.read)
+		return 1;
+	for (;;)
+	{
+		int m;
+		p = (const stbi_uc *)memchr(p, 0xff, end - p);
+		if (!p || end - p < 2)
+			return 0;
+		m = p[1];
+		// stuffed zeros, restart markers and fill bytes are part of the scan
+		if (m == 0 || m == 0xff || STBI__RESTART(m))
+		{
+			++p;
+			continue;
+		}
+		if (stbi__EOI(m))
+			return 0;
+		if (m == 0xe0 || m == 0xee)
+			return 1;
+		if (end - p < 4)
+			return 0;
+		p += 2 + (p[2] << 8 | p[3]);
+		if (p >= end)
+			return 0;
+	}
+}
+
+// decode the scans and process the markers up to EOI
+static int stbi__decode_jpeg_markers(stbi__jpeg *j)
+{
+	int m = stbi__get_marker(j);
+	while (!stbi__EOI(m))
+	{
+		if (stbi__SOS(m))
+		{
+			if (!stbi__process_scan_header(j))
+				return 0;
+			if (j->stream == 1)
+			{
+				// a baseline scan of every component is the whole image, and
+				// the caller decodes it an MCU row at a time, unless the
+				// output format can't be known until after it
+				if (!j->progressive && j->scan_n == j->s->img_n && !stbi__jpeg_late_colour_markers(j))
+					return 1;
+				// a banded image's scans all go into the coefficients, which
+				// the caller reconstructs an MCU row at a time
+				if (!j->banded && !stbi__jpeg_full_planes(j))
+					return 0;
+			}
+			// once the streamed scan is done its planes are gone, so there's
+			// nowhere for another one to go
+			if (j->stream == 2 ? !stbi__jpeg_skip_scan(j) : !stbi__parse_entropy_coded_data(j))
+				return 0;
+			stbi__jpeg_end_scan(j);
+			if (j->preview && j->progressive && !stbi__jpeg_preview(j))
+				return 0;
+		}
+		else if (stbi__DNL(m))
+		{
+			int Ld = stbi__get16be(j->s);
+			stbi__uint32 NL = stbi__get16be(j->s);
+			if (Ld != 4)
+				return stbi__err("bad DNL len", "Corrupt JPEG");
+			if (((NL + (1 << j->scale) - 1) >> j->scale) != j->s->img_y)
+				return stbi__err("bad DNL height", "Corrupt JPEG");
+		}
+		else
+		{
+			if (!stbi__process_marker(j, m))
+				return 0;
+		}
+		m = stbi__get_marker(j);
+	}
+	// a streamed image without any scans still gets (undecoded) planes
+	if (j->stream == 1 && !j->banded && !stbi__jpeg_full_planes(j))
+		return 0;
+	if (j->progressive && !j->coefficients && !j->banded && !stbi__jpeg_finish(j))
+		return 0;
+	return 1;
+}
+
+// decode image to YCbCr format
+static int stbi__decode_jpeg_image(stbi__jpeg *j)
+{
+	int m;
+	for (m = 0; m < 4; m++)
+	{
+		j->img_comp[m].raw_data = NULL;
+		j->img_comp[m].raw_coeff = NULL;
+		j->img_comp[m].coeff_mapped = 0;
+	}
+	j->restart_interval = 0;
+	if (!stbi__decode_jpeg_header(j, STBI__SCAN_load))
+		return 0;
+	return stbi__decode_jpeg_markers(j);
+}
+
+// static jfif-centered resampling (across block boundaries)
+
+#define stbi__div4(x) ((stbi_uc)((x) >> 2))
+
+static stbi_uc *resample_row_1(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	STBI_NOTUSED(out);
+	STBI_NOTUSED(in_far);
+	STBI_NOTUSED(w);
+	STBI_NOTUSED(hs);
+	return in_near;
+}
+
+static stbi_uc *stbi__resample_row_v_2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// need to generate two samples vertically for every one in input
+	int i;
+	STBI_NOTUSED(hs);
+	for (i = 0; i < w; ++i)
+		out[i] = stbi__div4(3 * in_near[i] + in_far[i] + 2);
+	return out;
+}
+
+static stbi_uc *stbi__resample_row_h_2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// need to generate two samples horizontally for every one in input
+	int i;
+	stbi_uc *input = in_near;
+
+	if (w == 1)
+	{
+		// if only one sample, can't do any interpolation
+		out[0] = out[1] = input[0];
+		return out;
+	}
+
+	out[0] = input[0];
+	out[1] = stbi__div4(input[0] * 3 + input[1] + 2);
+	for (i = 1; i < w - 1; ++i)
+	{
+		int n = 3 * input[i] + 2;
+		out[i * 2 + 0] = stbi__div4(n + input[i - 1]);
+		out[i * 2 + 1] = stbi__div4(n + input[i + 1]);
+	}
+	out[i * 2 + 0] = stbi__div4(input[w - 2] * 3 + input[w - 1] + 2);
+	out[i * 2 + 1] = input[w - 1];
+
+	STBI_NOTUSED(in_far);
+	STBI_NOTUSED(hs);
+
+	return out;
+}
+
+#define stbi__div16(x) ((stbi_uc)((x) >> 4))
+
+static stbi_uc *stbi__resample_row_hv_2(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// need to generate 2x2 samples for every one in input
+	int i, t0, t1;
+	if (w == 1)
+	{
+		out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+		return out;
+	}
+
+	t1 = 3 * in_near[0] + in_far[0];
+	out[0] = stbi__div4(t1 + 2);
+	for (i = 1; i < w; ++i)
+	{
+		t0 = t1;
+		t1 = 3 * in_near[i] + in_far[i];
+		out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+		out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+	}
+	out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+	STBI_NOTUSED(hs);
+
+	return out;
+}
+
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// need to generate 2x2 samples for every one in input
+	int i = 0, t0, t1;
+
+	if (w == 1)
+	{
+		out[0] = out[1] = stbi__div4(3 * in_near[0] + in_far[0] + 2);
+		return out;
+	}
+
+	t1 = 3 * in_near[0] + in_far[0];
+	// process groups of 8 pixels for as long as we can.
+	// note we can't handle the last pixel in a row in this loop
+	// because we need to handle the filter boundary conditions.
+	for (; i < ((w - 1) & ~7); i += 8)
+	{
+#if defined(STBI_SSE2)
+		// load and perform the vertical filtering pass
+		// this uses 3*x + y = 4*x + (y - x)
+		__m128i zero = _mm_setzero_si128();
+		__m128i farb = _mm_loadl_epi64((__m128i *)(in_far + i));
+		__m128i nearb = _mm_loadl_epi64((__m128i *)(in_near + i));
+		__m128i farw = _mm_unpacklo_epi8(farb, zero);
+		__m128i nearw = _mm_unpacklo_epi8(nearb, zero);
+		__m128i diff = _mm_sub_epi16(farw, nearw);
+		__m128i nears = _mm_slli_epi16(nearw, 2);
+		__m128i curr = _mm_add_epi16(nears, diff); // current row
+
+		// horizontal filter works the same based on shifted vers of current
+		// row. "prev" is current row shifted right by 1 pixel; we need to
 		// insert the previous pixel value (from t1).
 		// "next" is current row shifted left by 1 pixel, with first pixel
 		// of next block of 8 pixels added in.
@@ -1879,576 +4504,2441 @@ static stbi_uc *stbi__resample_row_hv_2_simd(stbi_uc *out, stbi_uc *in_near, stb
 		__m128i prev = _mm_insert_epi16(prv0, t1, 0);
 		__m128i next = _mm_insert_epi16(nxt0, 3 * in_near[i + 8] + in_far[i + 8], 7);
 
-		// horizontal filter, polyphase implementation since it's convenient:
-		// even pixels = 3*cur + prev = cur*4 + (prev - cur)
-		// odd  pixels = 3*cur + next = cur*4 + (next - cur)
-		// note the shared term.
-		__m128i bias = _mm_set1_epi16(8);
-		__m128i curs = _mm_slli_epi16(curr, 2);
-		__m128i prvd = _mm_sub_epi16(prev, curr);
-		__m128i nxtd = _mm_sub_epi16(next, curr);
-		__m128i curb = _mm_add_epi16(curs, bias);
-		__m128i even = _mm_add_epi16(prvd, curb);
-		__m128i odd = _mm_add_epi16(nxtd, curb);
+		// horizontal filter, polyphase implementation since it's convenient:
+		// even pixels = 3*cur + prev = cur*4 + (prev - cur)
+		// odd  pixels = 3*cur + next = cur*4 + (next - cur)
+		// note the shared term.
+		__m128i bias = _mm_set1_epi16(8);
+		__m128i curs = _mm_slli_epi16(curr, 2);
+		__m128i prvd = _mm_sub_epi16(prev, curr);
+		__m128i nxtd = _mm_sub_epi16(next, curr);
+		__m128i curb = _mm_add_epi16(curs, bias);
+		__m128i even = _mm_add_epi16(prvd, curb);
+		__m128i odd = _mm_add_epi16(nxtd, curb);
+
+		// interleave even and odd pixels, then undo scaling.
+		__m128i int0 = _mm_unpacklo_epi16(even, odd);
+		__m128i int1 = _mm_unpackhi_epi16(even, odd);
+		__m128i de0 = _mm_srli_epi16(int0, 4);
+		__m128i de1 = _mm_srli_epi16(int1, 4);
+
+		// pack and write output
+		__m128i outv = _mm_packus_epi16(de0, de1);
+		_mm_storeu_si128((__m128i *)(out + i * 2), outv);
+#elif defined(STBI_NEON)
+		// load and perform the vertical filtering pass
+		// this uses 3*x + y = 4*x + (y - x)
+		uint8x8_t farb = vld1_u8(in_far + i);
+		uint8x8_t nearb = vld1_u8(in_near + i);
+		int16x8_t diff = vreinterpretq_s16_u16(vsubl_u8(farb, nearb));
+		int16x8_t nears = vreinterpretq_s16_u16(vshll_n_u8(nearb, 2));
+		int16x8_t curr = vaddq_s16(nears, diff); // current row
+
+		// horizontal filter works the same based on shifted vers of current
+		// row. "prev" is current row shifted right by 1 pixel; we need to
+		// insert the previous pixel value (from t1).
+		// "next" is current row shifted left by 1 pixel, with first pixel
+		// of next block of 8 pixels added in.
+		int16x8_t prv0 = vextq_s16(curr, curr, 7);
+		int16x8_t nxt0 = vextq_s16(curr, curr, 1);
+		int16x8_t prev = vsetq_lane_s16(t1, prv0, 0);
+		int16x8_t next = vsetq_lane_s16(3 * in_near[i + 8] + in_far[i + 8], nxt0, 7);
+
+		// horizontal filter, polyphase implementation since it's convenient:
+		// even pixels = 3*cur + prev = cur*4 + (prev - cur)
+		// odd  pixels = 3*cur + next = cur*4 + (next - cur)
+		// note the shared term.
+		int16x8_t curs = vshlq_n_s16(curr, 2);
+		int16x8_t prvd = vsubq_s16(prev, curr);
+		int16x8_t nxtd = vsubq_s16(next, curr);
+		int16x8_t even = vaddq_s16(curs, prvd);
+		int16x8_t odd = vaddq_s16(curs, nxtd);
+
+		// undo scaling and round, then store with even/odd phases interleaved
+		uint8x8x2_t o;
+		o.val[0] = vqrshrun_n_s16(even, 4);
+		o.val[1] = vqrshrun_n_s16(odd, 4);
+		vst2_u8(out + i * 2, o);
+#endif
+
+		// "previous" value for next iter
+		t1 = 3 * in_near[i + 7] + in_far[i + 7];
+	}
+
+	t0 = t1;
+	t1 = 3 * in_near[i] + in_far[i];
+	out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+
+	for (++i; i < w; ++i)
+	{
+		t0 = t1;
+		t1 = 3 * in_near[i] + in_far[i];
+		out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
+		out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+	}
+	out[w * 2 - 1] = stbi__div4(t1 + 2);
+
+	STBI_NOTUSED(hs);
+
+	return out;
+}
+
+static stbi_uc *stbi__resample_row_v_2_simd(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// need to generate two samples vertically for every one in input
+	int i = 0;
+	STBI_NOTUSED(hs);
+
+	// 16 pixels at a time; 3*near + far + 2 fits comfortably in 16 bits
+	for (; i + 16 <= w; i += 16)
+	{
+#if defined(STBI_SSE2)
+		__m128i zero = _mm_setzero_si128();
+		__m128i bias = _mm_set1_epi16(2);
+		__m128i nearb = _mm_loadu_si128((__m128i *)(in_near + i));
+		__m128i farb = _mm_loadu_si128((__m128i *)(in_far + i));
+		__m128i nearl = _mm_unpacklo_epi8(nearb, zero);
+		__m128i nearh = _mm_unpackhi_epi8(nearb, zero);
+		__m128i farl = _mm_add_epi16(_mm_unpacklo_epi8(farb, zero), bias);
+		__m128i farh = _mm_add_epi16(_mm_unpackhi_epi8(farb, zero), bias);
+		__m128i sl = _mm_add_epi16(_mm_add_epi16(nearl, _mm_slli_epi16(nearl, 1)), farl);
+		__m128i sh = _mm_add_epi16(_mm_add_epi16(nearh, _mm_slli_epi16(nearh, 1)), farh);
+		__m128i outv = _mm_packus_epi16(_mm_srli_epi16(sl, 2), _mm_srli_epi16(sh, 2));
+		_mm_storeu_si128((__m128i *)(out + i), outv);
+#elif defined(STBI_NEON)
+		uint8x16_t nearb = vld1q_u8(in_near + i);
+		uint8x16_t farb = vld1q_u8(in_far + i);
+		uint8x8_t three = vdup_n_u8(3);
+		uint16x8_t sl = vmlal_u8(vmovl_u8(vget_low_u8(farb)), vget_low_u8(nearb), three);
+		uint16x8_t sh = vmlal_u8(vmovl_u8(vget_high_u8(farb)), vget_high_u8(nearb), three);
+		vst1q_u8(out + i, vcombine_u8(vrshrn_n_u16(sl, 2), vrshrn_n_u16(sh, 2)));
+#endif
+	}
+
+	for (; i < w; ++i)
+		out[i] = stbi__div4(3 * in_near[i] + in_far[i] + 2);
+	return out;
+}
+
+static stbi_uc *stbi__resample_row_h_2_simd(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// need to generate two samples horizontally for every one in input
+	int i;
+	stbi_uc *input = in_near;
+
+	if (w == 1)
+	{
+		// if only one sample, can't do any interpolation
+		out[0] = out[1] = input[0];
+		return out;
+	}
+
+	out[0] = input[0];
+	out[1] = stbi__div4(input[0] * 3 + input[1] + 2);
+
+	// groups of 8 pixels, reading each one's neighbours with offset loads.
+	// the last pixel needs the boundary rule so the loop stops short of it.
+	for (i = 1; i + 8 < w; i += 8)
+	{
+#if defined(STBI_SSE2)
+		// even pixels = 3*cur + prev + 2, odd pixels = 3*cur + next + 2
+		__m128i zero = _mm_setzero_si128();
+		__m128i bias = _mm_set1_epi16(2);
+		__m128i prev = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(input + i - 1)), zero);
+		__m128i curr = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(input + i)), zero);
+		__m128i next = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(input + i + 1)), zero);
+		__m128i curb = _mm_add_epi16(_mm_add_epi16(curr, _mm_slli_epi16(curr, 1)), bias);
+		__m128i even = _mm_srli_epi16(_mm_add_epi16(curb, prev), 2);
+		__m128i odd = _mm_srli_epi16(_mm_add_epi16(curb, next), 2);
+
+		// interleave even and odd pixels, then pack and write output
+		__m128i int0 = _mm_unpacklo_epi16(even, odd);
+		__m128i int1 = _mm_unpackhi_epi16(even, odd);
+		_mm_storeu_si128((__m128i *)(out + i * 2), _mm_packus_epi16(int0, int1));
+#elif defined(STBI_NEON)
+		uint8x8_t prev = vld1_u8(input + i - 1);
+		uint8x8_t curr = vld1_u8(input + i);
+		uint8x8_t next = vld1_u8(input + i + 1);
+		uint16x8_t cur3 = vmull_u8(curr, vdup_n_u8(3));
+
+		// round, narrow, and store with even/odd phases interleaved
+		uint8x8x2_t o;
+		o.val[0] = vrshrn_n_u16(vaddw_u8(cur3, prev), 2);
+		o.val[1] = vrshrn_n_u16(vaddw_u8(cur3, next), 2);
+		vst2_u8(out + i * 2, o);
+#endif
+	}
+
+	for (; i < w - 1; ++i)
+	{
+		int n = 3 * input[i] + 2;
+		out[i * 2 + 0] = stbi__div4(n + input[i - 1]);
+		out[i * 2 + 1] = stbi__div4(n + input[i + 1]);
+	}
+	out[i * 2 + 0] = stbi__div4(input[w - 2] * 3 + input[w - 1] + 2);
+	out[i * 2 + 1] = input[w - 1];
+
+	STBI_NOTUSED(in_far);
+	STBI_NOTUSED(hs);
+
+	return out;
+}
+#endif
+
+static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// resample with nearest-neighbor
+	int i, j;
+	STBI_NOTUSED(in_far);
+	if (hs == 2) // the common case, for STBI_JPEG_FAST
+	{
+		for (i = 0; i < w; ++i)
+			out[i * 2] = out[i * 2 + 1] = in_near[i];
+		return out;
+	}
+	for (i = 0; i < w; ++i)
+		for (j = 0; j < hs; ++j)
+			out[i * hs + j] = in_near[i];
+	return out;
+}
+
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+static stbi_uc *stbi__resample_row_generic_simd(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+{
+	// resample with nearest-neighbor, replicating 16 input pixels at a time
+	// for the factors that come up in practice (4:1:1 is hs=4)
+	int i = 0, j;
+	STBI_NOTUSED(in_far);
+
+	// no horizontal expansion (vertical-only factors other than 2)
+	if (hs == 1)
+		return in_near;
+
+	for (; i + 16 <= w; i += 16)
+	{
+#if defined(STBI_SSE2)
+		__m128i v = _mm_loadu_si128((__m128i *)(in_near + i));
+		__m128i lo = _mm_unpacklo_epi8(v, v);
+		__m128i hi = _mm_unpackhi_epi8(v, v);
+		if (hs == 2)
+		{
+			_mm_storeu_si128((__m128i *)(out + i * 2 + 0), lo);
+			_mm_storeu_si128((__m128i *)(out + i * 2 + 16), hi);
+		}
+		else if (hs == 4)
+		{
+			_mm_storeu_si128((__m128i *)(out + i * 4 + 0), _mm_unpacklo_epi16(lo, lo));
+			_mm_storeu_si128((__m128i *)(out + i * 4 + 16), _mm_unpackhi_epi16(lo, lo));
+			_mm_storeu_si128((__m128i *)(out + i * 4 + 32), _mm_unpacklo_epi16(hi, hi));
+			_mm_storeu_si128((__m128i *)(out + i * 4 + 48), _mm_unpackhi_epi16(hi, hi));
+		}
+		else
+			break; // hs=3 has no cheap SSE2 shuffle
+#elif defined(STBI_NEON)
+		uint8x16_t v = vld1q_u8(in_near + i);
+		if (hs == 2)
+		{
+			uint8x16x2_t o = {{v, v}};
+			vst2q_u8(out + i * 2, o);
+		}
+		else if (hs == 3)
+		{
+			uint8x16x3_t o = {{v, v, v}};
+			vst3q_u8(out + i * 3, o);
+		}
+		else
+		{
+			uint8x16x4_t o = {{v, v, v, v}};
+			vst4q_u8(out + i * 4, o);
+		}
+#endif
+	}
+
+	for (; i < w; ++i)
+		for (j = 0; j < hs; ++j)
+			out[i * hs + j] = in_near[i];
+	return out;
+}
+#endif
+
+// this is a reduced-precision calculation of YCbCr-to-RGB introduced
+// to make sure the code produces the same results in both SIMD and scalar
+#define stbi__float2fixed(x) (((int)((x)*4096.0f + 0.5f)) << 8)
+static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+{
+	int i;
+	for (i = 0; i < count; ++i)
+	{
+		int y_fixed = (y[i] << 20) + (1 << 19); // rounding
+		int r, g, b;
+		int cr = pcr[i] - 128;
+		int cb = pcb[i] - 128;
+		r = y_fixed + cr * stbi__float2fixed(1.40200f);
+		g = y_fixed + (cr * -stbi__float2fixed(0.71414f)) + ((cb * -stbi__float2fixed(0.34414f)) & 0xffff0000);
+		b = y_fixed + cb * stbi__float2fixed(1.77200f);
+		r >>= 20;
+		g >>= 20;
+		b >>= 20;
+		if ((unsigned)r > 255)
+		{
+			if (r < 0)
+				r = 0;
+			else
+				r = 255;
+		}
+		if ((unsigned)g > 255)
+		{
+			if (g < 0)
+				g = 0;
+			else
+				g = 255;
+		}
+		if ((unsigned)b > 255)
+		{
+			if (b < 0)
+				b = 0;
+			else
+				b = 255;
+		}
+		out[0] = (stbi_uc)r;
+		out[1] = (stbi_uc)g;
+		out[2] = (stbi_uc)b;
+		out[3] = 255;
+		out += step;
+	}
+}
+
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+{
+	int i = 0;
+
+#ifdef STBI_SSE2
+	// step == 3 is pretty ugly on the final interleave, and i'm not convinced
+	// it's useful in practice (you wouldn't use it for textures, for example).
+	// so just accelerate step == 4 case.
+	if (step == 4)
+	{
+		// this is a fairly straightforward implementation and not super-optimized.
+		__m128i signflip = _mm_set1_epi8(-0x80);
+		__m128i cr_const0 = _mm_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
+		__m128i cr_const1 = _mm_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
+		__m128i cb_const0 = _mm_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
+		__m128i cb_const1 = _mm_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
+		__m128i y_bias = _mm_set1_epi8((char)(unsigned char)128);
+		__m128i xw = _mm_set1_epi16(255); // alpha channel
+
+		for (; i + 7 < count; i += 8)
+		{
+			// load
+			__m128i y_bytes = _mm_loadl_epi64((__m128i *)(y + i));
+			__m128i cr_bytes = _mm_loadl_epi64((__m128i *)(pcr + i));
+			__m128i cb_bytes = _mm_loadl_epi64((__m128i *)(pcb + i));
+			__m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+			__m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+			// unpack to short (and left-shift cr, cb by 8)
+			__m128i yw = _mm_unpacklo_epi8(y_bias, y_bytes);
+			__m128i crw = _mm_unpacklo_epi8(_mm_setzero_si128(), cr_biased);
+			__m128i cbw = _mm_unpacklo_epi8(_mm_setzero_si128(), cb_biased);
+
+			// color transform
+			__m128i yws = _mm_srli_epi16(yw, 4);
+			__m128i cr0 = _mm_mulhi_epi16(cr_const0, crw);
+			__m128i cb0 = _mm_mulhi_epi16(cb_const0, cbw);
+			__m128i cb1 = _mm_mulhi_epi16(cbw, cb_const1);
+			__m128i cr1 = _mm_mulhi_epi16(crw, cr_const1);
+			__m128i rws = _mm_add_epi16(cr0, yws);
+			__m128i gwt = _mm_add_epi16(cb0, yws);
+			__m128i bws = _mm_add_epi16(yws, cb1);
+			__m128i gws = _mm_add_epi16(gwt, cr1);
+
+			// descale
+			__m128i rw = _mm_srai_epi16(rws, 4);
+			__m128i bw = _mm_srai_epi16(bws, 4);
+			__m128i gw = _mm_srai_epi16(gws, 4);
+
+			// back to byte, set up for transpose
+			__m128i brb = _mm_packus_epi16(rw, bw);
+			__m128i gxb = _mm_packus_epi16(gw, xw);
+
+			// transpose to interleave channels
+			__m128i t0 = _mm_unpacklo_epi8(brb, gxb);
+			__m128i t1 = _mm_unpackhi_epi8(brb, gxb);
+			__m128i o0 = _mm_unpacklo_epi16(t0, t1);
+			__m128i o1 = _mm_unpackhi_epi16(t0, t1);
+
+			// store
+			_mm_storeu_si128((__m128i *)(out + 0), o0);
+			_mm_storeu_si128((__m128i *)(out + 16), o1);
+			out += 32;
+		}
+	}
+#endif
+
+#ifdef STBI_NEON
+	// in this version, step=3 support would be easy to add. but is there demand?
+	if (step == 4)
+	{
+		// this is a fairly straightforward implementation and not super-optimized.
+		uint8x8_t signflip = vdup_n_u8(0x80);
+		int16x8_t cr_const0 = vdupq_n_s16((short)(1.40200f * 4096.0f + 0.5f));
+		int16x8_t cr_const1 = vdupq_n_s16(-(short)(0.71414f * 4096.0f + 0.5f));
+		int16x8_t cb_const0 = vdupq_n_s16(-(short)(0.34414f * 4096.0f + 0.5f));
+		int16x8_t cb_const1 = vdupq_n_s16((short)(1.77200f * 4096.0f + 0.5f));
+
+		for (; i + 7 < count; i += 8)
+		{
+			// load
+			uint8x8_t y_bytes = vld1_u8(y + i);
+			uint8x8_t cr_bytes = vld1_u8(pcr + i);
+			uint8x8_t cb_bytes = vld1_u8(pcb + i);
+			int8x8_t cr_biased = vreinterpret_s8_u8(vsub_u8(cr_bytes, signflip));
+			int8x8_t cb_biased = vreinterpret_s8_u8(vsub_u8(cb_bytes, signflip));
+
+			// expand to s16
+			int16x8_t yws = vreinterpretq_s16_u16(vshll_n_u8(y_bytes, 4));
+			int16x8_t crw = vshll_n_s8(cr_biased, 7);
+			int16x8_t cbw = vshll_n_s8(cb_biased, 7);
+
+			// color transform
+			int16x8_t cr0 = vqdmulhq_s16(crw, cr_const0);
+			int16x8_t cb0 = vqdmulhq_s16(cbw, cb_const0);
+			int16x8_t cr1 = vqdmulhq_s16(crw, cr_const1);
+			int16x8_t cb1 = vqdmulhq_s16(cbw, cb_const1);
+			int16x8_t rws = vaddq_s16(yws, cr0);
+			int16x8_t gws = vaddq_s16(vaddq_s16(yws, cb0), cr1);
+			int16x8_t bws = vaddq_s16(yws, cb1);
+
+			// undo scaling, round, convert to byte
+			uint8x8x4_t o;
+			o.val[0] = vqrshrun_n_s16(rws, 4);
+			o.val[1] = vqrshrun_n_s16(gws, 4);
+			o.val[2] = vqrshrun_n_s16(bws, 4);
+			o.val[3] = vdup_n_u8(255);
+
+			// store, interleaving r/g/b/a
+			vst4_u8(out, o);
+			out += 8 * 4;
+		}
+	}
+#endif
+
+	for (; i < count; ++i)
+	{
+		int y_fixed = (y[i] << 20) + (1 << 19); // rounding
+		int r, g, b;
+		int cr = pcr[i] - 128;
+		int cb = pcb[i] - 128;
+		r = y_fixed + cr * stbi__float2fixed(1.40200f);
+		g = y_fixed + cr * -stbi__float2fixed(0.71414f) + ((cb * -stbi__float2fixed(0.34414f)) & 0xffff0000);
+		b = y_fixed + cb * stbi__float2fixed(1.77200f);
+		r >>= 20;
+		g >>= 20;
+		b >>= 20;
+		if ((unsigned)r > 255)
+		{
+			if (r < 0)
+				r = 0;
+			else
+				r = 255;
+		}
+		if ((unsigned)g > 255)
+		{
+			if (g < 0)
+				g = 0;
+			else
+				g = 255;
+		}
+		if ((unsigned)b > 255)
+		{
+			if (b < 0)
+				b = 0;
+			else
+				b = 255;
+		}
+		out[0] = (stbi_uc)r;
+		out[1] = (stbi_uc)g;
+		out[2] = (stbi_uc)b;
+		out[3] = 255;
+		out += step;
+	}
+}
+#endif
+
+// fast 0..255 * 0..255 => 0..255 rounded multiplication
+static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
+{
+	unsigned int t = x * y + 128;
+	return (stbi_uc)((t + (t >> 8)) >> 8);
+}
+
+// Adobe CMYK, stored inverted, so each of C, M and Y times K is R, G or B
+static void stbi__CMYK_to_RGB_row(stbi_uc *out, const stbi_uc *c, const stbi_uc *m, const stbi_uc *y, const stbi_uc *k, int count, int step)
+{
+	int i;
+	for (i = 0; i < count; ++i)
+	{
+		out[0] = stbi__blinn_8x8(c[i], k[i]);
+		out[1] = stbi__blinn_8x8(m[i], k[i]);
+		out[2] = stbi__blinn_8x8(y[i], k[i]);
+		out[3] = 255;
+		out += step;
+	}
+}
+
+// Adobe YCCK: YCbCr of the inverted CMY, with K as in CMYK
+static void stbi__YCCK_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, const stbi_uc *k, int count, int step)
+{
+	int i;
+	stbi__YCbCr_to_RGB_row(out, y, pcb, pcr, count, step);
+	for (i = 0; i < count; ++i)
+	{
+		out[0] = stbi__blinn_8x8(255 - out[0], k[i]);
+		out[1] = stbi__blinn_8x8(255 - out[1], k[i]);
+		out[2] = stbi__blinn_8x8(255 - out[2], k[i]);
+		out += step;
+	}
+}
+
+#ifdef STBI_SSE2
+// stbi__blinn_8x8 on eight 16-bit lanes of 0..255; exact, since x * y + 128
+// and t + (t >> 8) both fit in 16 unsigned bits
+static __m128i stbi__blinn_8x8_simd(__m128i x, __m128i y)
+{
+	__m128i t = _mm_add_epi16(_mm_mullo_epi16(x, y), _mm_set1_epi16(128));
+	return _mm_srli_epi16(_mm_add_epi16(t, _mm_srli_epi16(t, 8)), 8);
+}
+
+// store eight pixels given as 16-bit r, g, b lanes, step 3 or 4 bytes apart
+static void stbi__store_rgb_simd(stbi_uc *out, __m128i rw, __m128i gw, __m128i bw, int step)
+{
+	// back to byte, set up for transpose
+	__m128i brb = _mm_packus_epi16(rw, bw);
+	__m128i gxb = _mm_packus_epi16(gw, _mm_set1_epi16(255));
+
+	// transpose to interleave channels
+	__m128i t0 = _mm_unpacklo_epi8(brb, gxb);
+	__m128i t1 = _mm_unpackhi_epi8(brb, gxb);
+	__m128i o0 = _mm_unpacklo_epi16(t0, t1);
+	__m128i o1 = _mm_unpackhi_epi16(t0, t1);
+
+	if (step == 4)
+	{
+		_mm_storeu_si128((__m128i *)(out + 0), o0);
+		_mm_storeu_si128((__m128i *)(out + 16), o1);
+	}
+	else
+	{
+		// squeeze the alpha bytes out of each group of four pixels by shifting
+		// pixel j down j bytes, then store the 24 bytes that are left
+		__m128i m0 = _mm_setr_epi8(-1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0);
+		__m128i m1 = _mm_slli_si128(m0, 3), m2 = _mm_slli_si128(m0, 6), m3 = _mm_slli_si128(m0, 9);
+		__m128i p0 = _mm_or_si128(_mm_or_si128(_mm_and_si128(o0, m0), _mm_and_si128(_mm_srli_si128(o0, 1), m1)),
+										  _mm_or_si128(_mm_and_si128(_mm_srli_si128(o0, 2), m2), _mm_and_si128(_mm_srli_si128(o0, 3), m3)));
+		__m128i p1 = _mm_or_si128(_mm_or_si128(_mm_and_si128(o1, m0), _mm_and_si128(_mm_srli_si128(o1, 1), m1)),
+										  _mm_or_si128(_mm_and_si128(_mm_srli_si128(o1, 2), m2), _mm_and_si128(_mm_srli_si128(o1, 3), m3)));
+		_mm_storeu_si128((__m128i *)(out + 0), _mm_or_si128(p0, _mm_slli_si128(p1, 12)));
+		_mm_storel_epi64((__m128i *)(out + 16), _mm_srli_si128(p1, 4));
+	}
+}
+#endif
+
+// YCbCr-to-RGB for STBI_JPEG_FASTEST, with the constants in 8-bit fixed
+// point and the sum kept at twice scale for rounding, so the SIMD version
+// fits in 16-bit lanes with nothing to descale but one shift, and does
+// step 3 as well. within a level of stbi__YCbCr_to_RGB_row
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+#define stbi__float2fixed8(x) ((int)((x)*512.0f + 0.5f))
+static void stbi__YCbCr_to_RGB_fast_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+{
+	int i;
+	for (i = 0; i < count; ++i)
+	{
+		int y2 = y[i] * 2 + 1;
+		int cr = pcr[i] - 128;
+		int cb = pcb[i] - 128;
+		int r = (y2 + ((cr * stbi__float2fixed8(1.40200f)) >> 8)) >> 1;
+		int g = (y2 + ((cr * -stbi__float2fixed8(0.71414f)) >> 8) + ((cb * -stbi__float2fixed8(0.34414f)) >> 8)) >> 1;
+		int b = (y2 + ((cb * stbi__float2fixed8(1.77200f)) >> 8)) >> 1;
+		out[0] = stbi__clamp(r);
+		out[1] = stbi__clamp(g);
+		out[2] = stbi__clamp(b);
+		out[3] = 255;
+		out += step;
+	}
+}
+
+static void stbi__YCbCr_to_RGB_fast_simd(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+{
+	int i = 0;
+
+#ifdef STBI_SSE2
+	__m128i signflip = _mm_set1_epi8(-0x80);
+	__m128i cr_const0 = _mm_set1_epi16(stbi__float2fixed8(1.40200f));
+	__m128i cr_const1 = _mm_set1_epi16(-stbi__float2fixed8(0.71414f));
+	__m128i cb_const0 = _mm_set1_epi16(-stbi__float2fixed8(0.34414f));
+	__m128i cb_const1 = _mm_set1_epi16(stbi__float2fixed8(1.77200f));
+	__m128i one = _mm_set1_epi16(1);
+	for (; i + 7 < count; i += 8)
+	{
+		// cr, cb - 128 in the top byte, so mulhi leaves (c * const) >> 8
+		__m128i crw = _mm_unpacklo_epi8(_mm_setzero_si128(), _mm_xor_si128(_mm_loadl_epi64((__m128i *)(pcr + i)), signflip));
+		__m128i cbw = _mm_unpacklo_epi8(_mm_setzero_si128(), _mm_xor_si128(_mm_loadl_epi64((__m128i *)(pcb + i)), signflip));
+		__m128i yw = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(y + i)), _mm_setzero_si128());
+		__m128i y2 = _mm_add_epi16(_mm_add_epi16(yw, yw), one);
+		__m128i rw = _mm_add_epi16(y2, _mm_mulhi_epi16(crw, cr_const0));
+		__m128i gw = _mm_add_epi16(_mm_add_epi16(y2, _mm_mulhi_epi16(crw, cr_const1)), _mm_mulhi_epi16(cbw, cb_const0));
+		__m128i bw = _mm_add_epi16(y2, _mm_mulhi_epi16(cbw, cb_const1));
+		stbi__store_rgb_simd(out, _mm_srai_epi16(rw, 1), _mm_srai_epi16(gw, 1), _mm_srai_epi16(bw, 1), step);
+		out += 8 * step;
+	}
+#endif
+
+#ifdef STBI_NEON
+	int16x8_t cr_const0 = vdupq_n_s16(stbi__float2fixed8(1.40200f));
+	int16x8_t cr_const1 = vdupq_n_s16(-stbi__float2fixed8(0.71414f));
+	int16x8_t cb_const0 = vdupq_n_s16(-stbi__float2fixed8(0.34414f));
+	int16x8_t cb_const1 = vdupq_n_s16(stbi__float2fixed8(1.77200f));
+	for (; i + 7 < count; i += 8)
+	{
+		// vqdmulh doubles, so shifting c - 128 up by 7 leaves (c * const) >> 8
+		int16x8_t crw = vshll_n_s8(vreinterpret_s8_u8(vsub_u8(vld1_u8(pcr + i), vdup_n_u8(128))), 7);
+		int16x8_t cbw = vshll_n_s8(vreinterpret_s8_u8(vsub_u8(vld1_u8(pcb + i), vdup_n_u8(128))), 7);
+		int16x8_t y2 = vaddq_s16(vreinterpretq_s16_u16(vshll_n_u8(vld1_u8(y + i), 1)), vdupq_n_s16(1));
+		uint8x8_t r = vqshrun_n_s16(vaddq_s16(y2, vqdmulhq_s16(crw, cr_const0)), 1);
+		uint8x8_t g = vqshrun_n_s16(vaddq_s16(vaddq_s16(y2, vqdmulhq_s16(crw, cr_const1)), vqdmulhq_s16(cbw, cb_const0)), 1);
+		uint8x8_t b = vqshrun_n_s16(vaddq_s16(y2, vqdmulhq_s16(cbw, cb_const1)), 1);
+		if (step == 4)
+		{
+			uint8x8x4_t o = {{r, g, b, vdup_n_u8(255)}};
+			vst4_u8(out, o);
+		}
+		else
+		{
+			uint8x8x3_t o = {{r, g, b}};
+			vst3_u8(out, o);
+		}
+		out += 8 * step;
+	}
+#endif
+
+	stbi__YCbCr_to_RGB_fast_row(out, y + i, pcb + i, pcr + i, count - i, step);
+}
+#endif
+
+#if defined(STBI_SSE2) || defined(STBI_NEON)
+static void stbi__CMYK_to_RGB_simd(stbi_uc *out, const stbi_uc *c, const stbi_uc *m, const stbi_uc *y, const stbi_uc *k, int count, int step)
+{
+	int i = 0;
+
+#ifdef STBI_SSE2
+	__m128i zero = _mm_setzero_si128();
+	for (; i + 7 < count; i += 8)
+	{
+		__m128i kw = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(k + i)), zero);
+		__m128i rw = stbi__blinn_8x8_simd(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(c + i)), zero), kw);
+		__m128i gw = stbi__blinn_8x8_simd(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(m + i)), zero), kw);
+		__m128i bw = stbi__blinn_8x8_simd(_mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(y + i)), zero), kw);
+		stbi__store_rgb_simd(out, rw, gw, bw, step);
+		out += 8 * step;
+	}
+#endif
+
+#ifdef STBI_NEON
+	for (; i + 7 < count; i += 8)
+	{
+		// x * k / 255 rounded is (p + ((p + 128) >> 8) + 128) >> 8, p = x * k
+		uint8x8_t kb = vld1_u8(k + i);
+		uint16x8_t pr = vmull_u8(vld1_u8(c + i), kb);
+		uint16x8_t pg = vmull_u8(vld1_u8(m + i), kb);
+		uint16x8_t pb = vmull_u8(vld1_u8(y + i), kb);
+		uint8x8x4_t o;
+		o.val[0] = vraddhn_u16(pr, vrshrq_n_u16(pr, 8));
+		o.val[1] = vraddhn_u16(pg, vrshrq_n_u16(pg, 8));
+		o.val[2] = vraddhn_u16(pb, vrshrq_n_u16(pb, 8));
+		o.val[3] = vdup_n_u8(255);
+		if (step == 4)
+			vst4_u8(out, o);
+		else
+		{
+			uint8x8x3_t o3;
+			o3.val[0] = o.val[0];
+			o3.val[1] = o.val[1];
+			o3.val[2] = o.val[2];
+			vst3_u8(out, o3);
+		}
+		out += 8 * step;
+	}
+#endif
+
+	stbi__CMYK_to_RGB_row(out, c + i, m + i, y + i, k + i, count - i, step);
+}
+
+// the YCbCr half is the same arithmetic as stbi__YCbCr_to_RGB_simd, done for
+// step 3 as well, and the result is inverted and multiplied by K while it's
+// still in registers
+static void stbi__YCCK_to_RGB_simd(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, const stbi_uc *k, int count, int step)
+{
+	int i = 0;
+
+#ifdef STBI_SSE2
+	__m128i signflip = _mm_set1_epi8(-0x80);
+	__m128i cr_const0 = _mm_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
+	__m128i cr_const1 = _mm_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
+	__m128i cb_const0 = _mm_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
+	__m128i cb_const1 = _mm_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
+	__m128i y_bias = _mm_set1_epi8((char)(unsigned char)128);
+	__m128i zero = _mm_setzero_si128();
+	__m128i x255 = _mm_set1_epi16(255);
+
+	for (; i + 7 < count; i += 8)
+	{
+		// load
+		__m128i y_bytes = _mm_loadl_epi64((__m128i *)(y + i));
+		__m128i cr_bytes = _mm_loadl_epi64((__m128i *)(pcr + i));
+		__m128i cb_bytes = _mm_loadl_epi64((__m128i *)(pcb + i));
+		__m128i kw = _mm_unpacklo_epi8(_mm_loadl_epi64((__m128i *)(k + i)), zero);
+		__m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
+		__m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+
+		// unpack to short (and left-shift cr, cb by 8)
+		__m128i yw = _mm_unpacklo_epi8(y_bias, y_bytes);
+		__m128i crw = _mm_unpacklo_epi8(zero, cr_biased);
+		__m128i cbw = _mm_unpacklo_epi8(zero, cb_biased);
+
+		// color transform
+		__m128i yws = _mm_srli_epi16(yw, 4);
+		__m128i cr0 = _mm_mulhi_epi16(cr_const0, crw);
+		__m128i cb0 = _mm_mulhi_epi16(cb_const0, cbw);
+		__m128i cb1 = _mm_mulhi_epi16(cbw, cb_const1);
+		__m128i cr1 = _mm_mulhi_epi16(crw, cr_const1);
+		__m128i rws = _mm_add_epi16(cr0, yws);
+		__m128i gwt = _mm_add_epi16(cb0, yws);
+		__m128i bws = _mm_add_epi16(yws, cb1);
+		__m128i gws = _mm_add_epi16(gwt, cr1);
+
+		// descale and clamp to 0..255, then invert
+		__m128i rw = _mm_xor_si128(_mm_max_epi16(_mm_min_epi16(_mm_srai_epi16(rws, 4), x255), zero), x255);
+		__m128i gw = _mm_xor_si128(_mm_max_epi16(_mm_min_epi16(_mm_srai_epi16(gws, 4), x255), zero), x255);
+		__m128i bw = _mm_xor_si128(_mm_max_epi16(_mm_min_epi16(_mm_srai_epi16(bws, 4), x255), zero), x255);
+
+		stbi__store_rgb_simd(out, stbi__blinn_8x8_simd(rw, kw), stbi__blinn_8x8_simd(gw, kw), stbi__blinn_8x8_simd(bw, kw), step);
+		out += 8 * step;
+	}
+#endif
+
+#ifdef STBI_NEON
+	uint8x8_t signflip = vdup_n_u8(0x80);
+	int16x8_t cr_const0 = vdupq_n_s16((short)(1.40200f * 4096.0f + 0.5f));
+	int16x8_t cr_const1 = vdupq_n_s16(-(short)(0.71414f * 4096.0f + 0.5f));
+	int16x8_t cb_const0 = vdupq_n_s16(-(short)(0.34414f * 4096.0f + 0.5f));
+	int16x8_t cb_const1 = vdupq_n_s16((short)(1.77200f * 4096.0f + 0.5f));
+
+	for (; i + 7 < count; i += 8)
+	{
+		// load
+		uint8x8_t y_bytes = vld1_u8(y + i);
+		uint8x8_t cr_bytes = vld1_u8(pcr + i);
+		uint8x8_t cb_bytes = vld1_u8(pcb + i);
+		uint8x8_t kb = vld1_u8(k + i);
+		int8x8_t cr_biased = vreinterpret_s8_u8(vsub_u8(cr_bytes, signflip));
+		int8x8_t cb_biased = vreinterpret_s8_u8(vsub_u8(cb_bytes, signflip));
+
+		// expand to s16
+		int16x8_t yws = vreinterpretq_s16_u16(vshll_n_u8(y_bytes, 4));
+		int16x8_t crw = vshll_n_s8(cr_biased, 7);
+		int16x8_t cbw = vshll_n_s8(cb_biased, 7);
+
+		// color transform
+		int16x8_t cr0 = vqdmulhq_s16(crw, cr_const0);
+		int16x8_t cb0 = vqdmulhq_s16(cbw, cb_const0);
+		int16x8_t cr1 = vqdmulhq_s16(crw, cr_const1);
+		int16x8_t cb1 = vqdmulhq_s16(cbw, cb_const1);
+		int16x8_t rws = vaddq_s16(yws, cr0);
+		int16x8_t gws = vaddq_s16(vaddq_s16(yws, cb0), cr1);
+		int16x8_t bws = vaddq_s16(yws, cb1);
+
+		// undo scaling, round, convert to byte, invert and multiply by K
+		uint16x8_t pr = vmull_u8(vmvn_u8(vqrshrun_n_s16(rws, 4)), kb);
+		uint16x8_t pg = vmull_u8(vmvn_u8(vqrshrun_n_s16(gws, 4)), kb);
+		uint16x8_t pb = vmull_u8(vmvn_u8(vqrshrun_n_s16(bws, 4)), kb);
+		uint8x8x4_t o;
+		o.val[0] = vraddhn_u16(pr, vrshrq_n_u16(pr, 8));
+		o.val[1] = vraddhn_u16(pg, vrshrq_n_u16(pg, 8));
+		o.val[2] = vraddhn_u16(pb, vrshrq_n_u16(pb, 8));
+		o.val[3] = vdup_n_u8(255);
+
+		// store, interleaving r/g/b(/a)
+		if (step == 4)
+			vst4_u8(out, o);
+		else
+		{
+			uint8x8x3_t o3;
+			o3.val[0] = o.val[0];
+			o3.val[1] = o.val[1];
+			o3.val[2] = o.val[2];
+			vst3_u8(out, o3);
+		}
+		out += 8 * step;
+	}
+#endif
+
+	stbi__YCCK_to_RGB_row(out, y + i, pcb + i, pcr + i, k + i, count - i, step);
+}
+#endif
+
+// options a load sets up before decoding; all off
+static void stbi__jpeg_reset_options(stbi__jpeg *j)
+{
+	j->out = NULL;
+	j->scale = stbi__jpeg_scale_shift;
+	j->crop_w = 0;
+	j->stream = 0;
+	j->planar = 0;
+	j->preview = NULL;
+	j->scans = 0;
+	j->coefficients = 0;
+	j->exif = 0;
+	j->exif_thumb = NULL;
+	j->parent_orientation = 0;
+	j->profile = stbi__jpeg_profile;
+	j->index = NULL;
+}
+
+// set up the kernels, with no huffman tables or spare buffers yet
+static void stbi__setup_jpeg(stbi__jpeg *j)
+{
+	int i;
+	j->idct_block_kernel = stbi__idct_block;
+	j->idct_block2_kernel = NULL;
+	j->idct_low_kernel = stbi__idct_block_low;
+	j->idct_aan_kernel = stbi__idct_block_aan;
+	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
+	j->YCbCr_to_RGB_fast_kernel = stbi__YCbCr_to_RGB_row; // no faster in scalar code
+	j->CMYK_to_RGB_kernel = stbi__CMYK_to_RGB_row;
+	j->YCCK_to_RGB_kernel = stbi__YCCK_to_RGB_row;
+	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+	j->resample_row_h_2_kernel = stbi__resample_row_h_2;
+	j->resample_row_v_2_kernel = stbi__resample_row_v_2;
+	j->resample_row_generic_kernel = stbi__resample_row_generic;
+
+#ifdef STBI_SSE2
+	if (stbi__sse2_available())
+	{
+		j->idct_block_kernel = stbi__idct_simd;
+		j->idct_low_kernel = stbi__idct_simd_low;
+		j->idct_aan_kernel = NULL; // the SIMD IDCT is faster still
+		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+		j->YCbCr_to_RGB_fast_kernel = stbi__YCbCr_to_RGB_fast_simd;
+		j->CMYK_to_RGB_kernel = stbi__CMYK_to_RGB_simd;
+		j->YCCK_to_RGB_kernel = stbi__YCCK_to_RGB_simd;
+		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+		j->resample_row_h_2_kernel = stbi__resample_row_h_2_simd;
+		j->resample_row_v_2_kernel = stbi__resample_row_v_2_simd;
+		j->resample_row_generic_kernel = stbi__resample_row_generic_simd;
+	}
+#endif
+
+#ifdef STBI_AVX2
+	if (stbi__avx2_available())
+		j->idct_block2_kernel = stbi__idct_simd2;
+#endif
+
+#ifdef STBI_NEON
+	j->idct_block_kernel = stbi__idct_simd;
+	j->idct_low_kernel = stbi__idct_simd; // the full kernel is already cheap enough on NEON
+	j->idct_aan_kernel = NULL;
+	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
+	j->YCbCr_to_RGB_fast_kernel = stbi__YCbCr_to_RGB_fast_simd;
+	j->CMYK_to_RGB_kernel = stbi__CMYK_to_RGB_simd;
+	j->YCCK_to_RGB_kernel = stbi__YCCK_to_RGB_simd;
+	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+	j->resample_row_h_2_kernel = stbi__resample_row_h_2_simd;
+	j->resample_row_v_2_kernel = stbi__resample_row_v_2_simd;
+	j->resample_row_generic_kernel = stbi__resample_row_generic_simd;
+#endif
+
+	j->huff_valid = 0;
+	j->keep = 0;
+	for (i = 0; i < STBI__JPEG_SPARES; ++i)
+		j->spare[i] = NULL;
+	stbi__jpeg_reset_options(j);
+}
+
+// clean up the temporary component buffers
+static void stbi__cleanup_jpeg(stbi__jpeg *j)
+{
+	stbi__free_jpeg_components(j, j->s->img_n, 0);
+}
+
+// put a resampler in the state it would be in after producing image row j,
+// so a band of rows can be converted without running through the ones above
+static void stbi__resample_seek(stbi__jpeg *z, stbi__resample *r, int k, int j)
+{
+	int t = (r->vs >> 1) + j;
+	int last = z->img_comp[k].y - 1, row0 = z->img_comp[k].row0;
+	stbi_uc *data = z->img_comp[k].data + r->x0;
+	r->ystep = t % r->vs;
+	r->ypos = t / r->vs;
+	r->line1 = data + z->img_comp[k].w2 * ((r->ypos < last ? r->ypos : last) - row0);
+	r->line0 = r->ypos == 0 ? r->line1 : data + z->img_comp[k].w2 * ((r->ypos - 1 < last ? r->ypos - 1 : last) - row0);
+}
+
+// line buffer big enough for upsampling the output region's columns, plus
+// the pixel either side of it, with upsample factor of 4
+static int stbi__jpeg_linebuf_size(stbi__jpeg *z)
+{
+	return z->crop_w + 16;
+}
+
+// colour convert one scanline of upsampled components
+static void stbi__jpeg_convert_row(stbi__jpeg *z, stbi__jpeg_output *o, stbi_uc *out, stbi_uc **coutput)
+{
+	int i, w = z->crop_w;
+	int n = o->n;
+	void (*YCbCr_to_RGB)(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step) =
+		z->profile == STBI_JPEG_FASTEST ? z->YCbCr_to_RGB_fast_kernel : z->YCbCr_to_RGB_kernel;
+	if (n >= 3)
+	{
+		stbi_uc *y = coutput[0];
+		if (z->s->img_n == 3)
+		{
+			if (o->is_rgb)
+			{
+				for (i = 0; i < w; ++i)
+				{
+					out[0] = y[i];
+					out[1] = coutput[1][i];
+					out[2] = coutput[2][i];
+					out[3] = 255;
+					out += n;
+				}
+			}
+			else
+			{
+				YCbCr_to_RGB(out, y, coutput[1], coutput[2], w, n);
+			}
+		}
+		else if (z->s->img_n == 4)
+		{
+			if (z->app14_color_transform == 0)
+			{ // CMYK
+				z->CMYK_to_RGB_kernel(out, y, coutput[1], coutput[2], coutput[3], w, n);
+			}
+			else if (z->app14_color_transform == 2)
+			{ // YCCK
+				z->YCCK_to_RGB_kernel(out, y, coutput[1], coutput[2], coutput[3], w, n);
+			}
+			else
+			{ // YCbCr + alpha?  Ignore the fourth channel for now
+				YCbCr_to_RGB(out, y, coutput[1], coutput[2], w, n);
+			}
+		}
+		else
+			for (i = 0; i < w; ++i)
+			{
+				out[0] = out[1] = out[2] = y[i];
+				out[3] = 255; // not used if n==3
+				out += n;
+			}
+	}
+	else
+	{
+		if (o->is_rgb)
+		{
+			if (n == 1)
+				for (i = 0; i < w; ++i)
+					*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+			else
+			{
+				for (i = 0; i < w; ++i, out += 2)
+				{
+					out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
+					out[1] = 255;
+				}
+			}
+		}
+		else if (z->s->img_n == 4 && z->app14_color_transform == 0)
+		{
+			for (i = 0; i < w; ++i)
+			{
+				stbi_uc m = coutput[3][i];
+				stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
+				stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
+				stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
+				out[0] = stbi__compute_y(r, g, b);
+				out[1] = 255;
+				out += n;
+			}
+		}
+		else if (z->s->img_n == 4 && z->app14_color_transform == 2)
+		{
+			for (i = 0; i < w; ++i)
+			{
+				out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
+				out[1] = 255;
+				out += n;
+			}
+		}
+		else
+		{
+			stbi_uc *y = coutput[0];
+			if (n == 1)
+				for (i = 0; i < w; ++i)
+					out[i] = y[i];
+			else
+				for (i = 0; i < w; ++i)
+				{
+					*out++ = y[i];
+					*out++ = 255;
+				}
+		}
+	}
+}
+
+// rows converted at a time when turning the output upright
+#define STBI__JPEG_ORIENT_ROWS 16
+
+// copy output rows j0..j1-1, converted into 'rows', to where they go in the
+// image turned upright from EXIF orientation o->orient. a turned image is
+// written a column at a time, each column being a row of output; doing a
+// few rows at once makes that a run of pixels instead of one per page
+static void stbi__jpeg_orient_rows(stbi__jpeg *z, stbi__jpeg_output *o, const stbi_uc *rows, int j0, int j1)
+{
+	int i, j, k, n = o->n, w = z->crop_w, h = z->crop_h, stride = n * w, m = j1 - j0, at, dj, step;
+	stbi_uc *out;
+	// pixel i of row j goes to pixel at + j * dj + i * step of the output
+	switch (o->orient)
+	{
+	case 2: // flipped horizontally
+		at = w - 1, dj = w, step = -1;
+		break;
+	case 3: // turned 180
+		at = h * w - 1, dj = -w, step = -1;
+		break;
+	case 4: // flipped vertically
+		at = (h - 1) * w, dj = -w, step = 1;
+		break;
+	case 5: // transposed
+		at = 0, dj = 1, step = h;
+		break;
+	case 6: // needs turning 90 clockwise
+		at = h - 1, dj = -1, step = h;
+		break;
+	case 7: // transversed
+		at = w * h - 1, dj = -1, step = -h;
+		break;
+	default: // 8, needs turning 90 anticlockwise
+		at = (w - 1) * h, dj = 1, step = -h;
+		break;
+	}
+	at += j0 * dj;
+
+	if (o->orient < 5)
+	{
+		for (j = 0; j < m; ++j, rows += stride)
+		{
+			const stbi_uc *row = rows;
+			out = o->output + (at + j * dj) * n;
+			if (step == 1)
+			{
+				memcpy(out, row, stride);
+				continue;
+			}
+			if (n == 3)
+			{
+				for (i = 0; i < w; ++i, row += 3, out -= 3)
+				{
+					out[0] = row[0];
+					out[1] = row[1];
+					out[2] = row[2];
+				}
+			}
+			else
+			{
+				for (i = 0; i < w; ++i, row += n, out -= n)
+					for (k = 0; k < n; ++k)
+						out[k] = row[k];
+			}
+		}
+		return;
+	}
+
+	// output row i gets pixel i of each row, next to each other
+	dj *= n;
+	for (i = 0; i < w; ++i, rows += n)
+	{
+		const stbi_uc *col = rows;
+		out = o->output + (at + i * step) * n;
+		switch (n)
+		{
+		case 1:
+			for (j = 0; j < m; ++j, col += stride, out += dj)
+				out[0] = col[0];
+			break;
+		case 3:
+			for (j = 0; j < m; ++j, col += stride, out += dj)
+			{
+				out[0] = col[0];
+				out[1] = col[1];
+				out[2] = col[2];
+			}
+			break;
+		default:
+			for (j = 0; j < m; ++j, col += stride, out += dj)
+				for (k = 0; k < n; ++k)
+					out[k] = col[k];
+			break;
+		}
+	}
+}
 
-		// interleave even and odd pixels, then undo scaling.
-		__m128i int0 = _mm_unpacklo_epi16(even, odd);
-		__m128i int1 = _mm_unpackhi_epi16(even, odd);
-		__m128i de0 = _mm_srli_epi16(int0, 4);
-		__m128i de1 = _mm_srli_epi16(int1, 4);
+// resample and colour convert output rows y0..y1-1 into out, using
+// linebuf[k] as scratch space for component k. rows count from the top of
+// the output region. note the colour converters may write one byte past
+// the end of each row. when reorienting, out is instead scratch space for
+// STBI__JPEG_ORIENT_ROWS rows, which rows go through on their way to
+// o->output
+static void stbi__jpeg_output_rows(stbi__jpeg *z, stbi__jpeg_output *o, stbi_uc **linebuf, stbi_uc *out, int y0, int y1)
+{
+	stbi__resample res_comp[4];
+	stbi_uc *coutput[4] = {NULL, NULL, NULL, NULL};
+	int j, k, j0 = y0;
+	for (k = 0; k < o->decode_n; ++k)
+	{
+		res_comp[k] = o->res_comp[k];
+		stbi__resample_seek(z, &res_comp[k], k, z->crop_y + y0);
+	}
+	for (j = y0; j < y1; ++j)
+	{
+		for (k = 0; k < o->decode_n; ++k)
+		{
+			stbi__resample *r = &res_comp[k];
+			int y_bot = r->ystep >= (r->vs >> 1);
+			coutput[k] = r->resample(linebuf[k],
+											 y_bot ? r->line1 : r->line0,
+											 y_bot ? r->line0 : r->line1,
+											 r->w_lores, r->hs) +
+							 r->xoff;
+			if (++r->ystep >= r->vs)
+			{
+				r->ystep = 0;
+				r->line0 = r->line1;
+				if (++r->ypos < z->img_comp[k].y)
+					r->line1 += z->img_comp[k].w2;
+			}
+		}
+		stbi__jpeg_convert_row(z, o, out, coutput);
+		out += o->n * z->crop_w;
+		if (o->orient && (j + 1 - j0 == STBI__JPEG_ORIENT_ROWS || j + 1 == y1))
+		{
+			out -= o->n * z->crop_w * (j + 1 - j0);
+			stbi__jpeg_orient_rows(z, o, out, j0, j + 1);
+			j0 = j + 1;
+		}
+	}
+}
 
-		// pack and write output
-		__m128i outv = _mm_packus_epi16(de0, de1);
-		_mm_storeu_si128((__m128i *)(out + i * 2), outv);
-#elif defined(STBI_NEON)
-		// load and perform the vertical filtering pass
-		// this uses 3*x + y = 4*x + (y - x)
-		uint8x8_t farb = vld1_u8(in_far + i);
-		uint8x8_t nearb = vld1_u8(in_near + i);
-		int16x8_t diff = vreinterpretq_s16_u16(vsubl_u8(farb, nearb));
-		int16x8_t nears = vreinterpretq_s16_u16(vshll_n_u8(nearb, 2));
-		int16x8_t curr = vaddq_s16(nears, diff); // current row
+// where output_rows should convert output row y0 and on to
+static stbi_uc *stbi__jpeg_output_at(stbi__jpeg *z, stbi__jpeg_output *o, int y0)
+{
+	return o->orient ? o->orow : o->output + o->n * z->crop_w * y0;
+}
 
-		// horizontal filter works the same based on shifted vers of current
-		// row. "prev" is current row shifted right by 1 pixel; we need to
-		// insert the previous pixel value (from t1).
-		// "next" is current row shifted left by 1 pixel, with first pixel
-		// of next block of 8 pixels added in.
-		int16x8_t prv0 = vextq_s16(curr, curr, 7);
-		int16x8_t nxt0 = vextq_s16(curr, curr, 1);
-		int16x8_t prev = vsetq_lane_s16(t1, prv0, 0);
-		int16x8_t next = vsetq_lane_s16(3 * in_near[i + 8] + in_far[i + 8], nxt0, 7);
+// convert output rows y0..y1-1 into out when the memory after them isn't
+// ours, e.g. other threads may be converting the rows below: the last row
+// goes through the scratch row, so the byte it writes past its end can't
+// land on a row that's already finished
+static void stbi__jpeg_output_band(stbi__jpeg *z, stbi__jpeg_output *o, stbi_uc **linebuf, stbi_uc *scratch, stbi_uc *out, int y0, int y1)
+{
+	int stride = o->n * z->crop_w;
+	if (o->orient)
+	{
+		stbi__jpeg_output_rows(z, o, linebuf, scratch, y0, y1);
+		return;
+	}
+	stbi__jpeg_output_rows(z, o, linebuf, out, y0, y1 - 1);
+	stbi__jpeg_output_rows(z, o, linebuf, scratch, y1 - 1, y1);
+	memcpy(out + stride * (y1 - y0 - 1), scratch, stride);
+}
 
-		// horizontal filter, polyphase implementation since it's convenient:
-		// even pixels = 3*cur + prev = cur*4 + (prev - cur)
-		// odd  pixels = 3*cur + next = cur*4 + (next - cur)
-		// note the shared term.
-		int16x8_t curs = vshlq_n_s16(curr, 2);
-		int16x8_t prvd = vsubq_s16(prev, curr);
-		int16x8_t nxtd = vsubq_s16(next, curr);
-		int16x8_t even = vaddq_s16(curs, prvd);
-		int16x8_t odd = vaddq_s16(curs, nxtd);
+#ifdef STBI_JPEG_THREADS
 
-		// undo scaling and round, then store with even/odd phases interleaved
-		uint8x8x2_t o;
-		o.val[0] = vqrshrun_n_s16(even, 4);
-		o.val[1] = vqrshrun_n_s16(odd, 4);
-		vst2_u8(out + i * 2, o);
+// size of the per-thread line buffers and scratch row used by output_band
+static int stbi__jpeg_band_buffer_size(stbi__jpeg *z, stbi__jpeg_output *o)
+{
+	return o->decode_n * stbi__jpeg_linebuf_size(z) + o->n * z->crop_w * (o->orient ? STBI__JPEG_ORIENT_ROWS : 1) + 1;
+}
+
+static stbi_uc *stbi__jpeg_band_buffers(stbi__jpeg *z, stbi__jpeg_output *o, stbi_uc *buf, stbi_uc **linebuf)
+{
+	int k;
+	for (k = 0; k < o->decode_n; ++k)
+		linebuf[k] = buf + k * stbi__jpeg_linebuf_size(z);
+	return buf + o->decode_n * stbi__jpeg_linebuf_size(z);
+}
+
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi__jpeg_output *o;
+	stbi_uc *buffers; // line buffers and a scratch row for each worker
+	int buffer_size;
+	int y0, rows_per_worker;
+} stbi__jpeg_output_job;
+
+static void stbi__jpeg_output_worker(void *arg, int worker, int nworkers)
+{
+	stbi__jpeg_output_job *job = (stbi__jpeg_output_job *)arg;
+	stbi__jpeg *z = job->z;
+	int y0 = job->y0 + job->rows_per_worker * worker, y1 = y0 + job->rows_per_worker;
+	stbi_uc *linebuf[4], *scratch;
+	STBI_NOTUSED(nworkers);
+	if (y1 > z->crop_h)
+		y1 = z->crop_h;
+	if (y0 >= y1)
+		return;
+	scratch = stbi__jpeg_band_buffers(z, job->o, job->buffers + worker * job->buffer_size, linebuf);
+	stbi__jpeg_output_band(z, job->o, linebuf, scratch, job->o->output + job->o->n * z->crop_w * y0, y0, y1);
+}
 #endif
 
-		// "previous" value for next iter
-		t1 = 3 * in_near[i + 7] + in_far[i + 7];
+// work out the output format from the markers seen so far
+static void stbi__jpeg_output_format(stbi__jpeg *z, stbi__jpeg_output *o)
+{
+	// determine actual number of components to generate
+	o->n = o->req_comp ? o->req_comp : z->s->img_n >= 3 ? 3
+																		 : 1;
+
+	o->is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
+	o->transform = z->app14_color_transform;
+
+	if (z->s->img_n == 3 && o->n < 3 && !o->is_rgb)
+		o->decode_n = 1;
+	else
+		o->decode_n = z->s->img_n;
+}
+
+// set up the line buffers and resamplers for converting the planes
+static int stbi__jpeg_prepare_resample(stbi__jpeg *z, stbi__jpeg_output *o)
+{
+	int k;
+
+	stbi__jpeg_output_format(z, o);
+
+	for (k = 0; k < o->decode_n; ++k)
+	{
+		stbi__resample *r = &o->res_comp[k];
+
+		if (!z->img_comp[k].linebuf)
+			z->img_comp[k].linebuf = (stbi_uc *)stbi__jpeg_alloc_buf(z, stbi__jpeg_linebuf_size(z));
+		if (!z->img_comp[k].linebuf)
+			return stbi__err("outofmem", "Out of memory");
+
+		// only the columns under the output region are upsampled, plus one
+		// either side for the filters
+		stbi__jpeg_expansion(z, k, &r->hs, &r->vs);
+		r->x0 = z->crop_x / r->hs - 1 > 0 ? z->crop_x / r->hs - 1 : 0;
+		r->xoff = z->crop_x - r->x0 * r->hs;
+		r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
+		if (r->w_lores > (z->crop_x + z->crop_w - 1) / r->hs + 2)
+			r->w_lores = (z->crop_x + z->crop_w - 1) / r->hs + 2;
+		r->w_lores -= r->x0;
+		r->ystep = r->vs >> 1;
+		r->ypos = 0;
+		r->line0 = r->line1 = z->img_comp[k].data + r->x0;
+
+		if (r->hs == 1 && r->vs == 1)
+			r->resample = resample_row_1;
+		else if (z->profile == STBI_JPEG_FASTEST || (z->profile == STBI_JPEG_FAST && r->hs == 2 && r->vs == 2))
+			r->resample = r->hs == 1 ? resample_row_1 : z->resample_row_generic_kernel; // replicate
+		else if (r->hs == 1 && r->vs == 2)
+			r->resample = z->resample_row_v_2_kernel;
+		else if (r->hs == 2 && r->vs == 1)
+			r->resample = z->resample_row_h_2_kernel;
+		else if (r->hs == 2 && r->vs == 2)
+			r->resample = z->resample_row_hv_2_kernel;
+		else
+			r->resample = z->resample_row_generic_kernel;
 	}
+	return 1;
+}
 
-	t0 = t1;
-	t1 = 3 * in_near[i] + in_far[i];
-	out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+// allocate the output image and set up the resamplers
+static int stbi__jpeg_prepare_output(stbi__jpeg *z, stbi__jpeg_output *o)
+{
+	int orientation = z->parent_orientation ? z->parent_orientation : z->orientation;
+	if (!stbi__jpeg_prepare_resample(z, o))
+		return 0;
+	o->rows_done = 0;
+	// o->orient starts out as whether to reorient at all
+	o->orient = o->orient && orientation > 1 ? orientation : 0;
+	o->output = (stbi_uc *)stbi__malloc_mad3(o->n, z->crop_w, z->crop_h + (o->orient ? STBI__JPEG_ORIENT_ROWS : 0), 1);
+	if (!o->output)
+		return stbi__err("outofmem", "Out of memory");
+	o->orow = o->output + o->n * z->crop_w * z->crop_h;
+	return 1;
+}
 
-	for (++i; i < w; ++i)
+// reconstruct the image from the coefficients decoded so far, leaving
+// them as they are, and show it to the preview callback
+static int stbi__jpeg_preview(stbi__jpeg *z)
+{
+	stbi__jpeg_output *o = z->out;
+	stbi_uc *linebuf[4];
+	int k, row;
+	if (!o->output && !stbi__jpeg_prepare_output(z, o))
+		return 0;
+	for (row = 0; row < stbi__jpeg_mcu_rows_used(z); ++row)
+		stbi__jpeg_finish_row(z, row, 1);
+	for (k = 0; k < o->decode_n; ++k)
+		linebuf[k] = z->img_comp[k].linebuf;
+	stbi__jpeg_output_rows(z, o, linebuf, stbi__jpeg_output_at(z, o, 0), 0, z->crop_h);
+	if (!z->preview(z->preview_user, o->output, o->orient >= 5 ? z->crop_h : z->crop_w, o->orient >= 5 ? z->crop_w : z->crop_h, o->n, ++z->scans))
+		return stbi__err("cancelled", "Stopped by the scan callback");
+	return 1;
+}
+
+// number of output rows, counting from the top of the output region, that
+// only depend on the first 'rows' MCU rows, an MCU row being plane_rows[k]
+// rows of component k
+static int stbi__jpeg_rows_ready(stbi__jpeg *z, stbi__jpeg_output *o, int rows, int *plane_rows)
+{
+	int k, limit = z->crop_y + z->crop_h;
+	for (k = 0; k < o->decode_n; ++k)
 	{
-		t0 = t1;
-		t1 = 3 * in_near[i] + in_far[i];
-		out[i * 2 - 1] = stbi__div16(3 * t0 + t1 + 8);
-		out[i * 2] = stbi__div16(3 * t1 + t0 + 8);
+		int vs = o->res_comp[k].vs;
+		// image row j needs plane row (j + vs/2) / vs
+		int j = rows * plane_rows[k] * vs - (vs >> 1);
+		if (j < limit)
+			limit = j;
 	}
-	out[w * 2 - 1] = stbi__div4(t1 + 2);
+	return limit > z->crop_y ? limit - z->crop_y : 0;
+}
 
-	STBI_NOTUSED(hs);
+// converts output rows as they become ready. a streamed scan is decoded an
+// MCU row at a time into the windowed planes, each row being converted
+// before the window moves on; an image that isn't streamed has full planes
+// with every row ready from the start
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi__jpeg_output *o;
+	stbi_uc *linebuf[4];
+	int rows_out;   // output rows converted so far
+	int rows_ready; // output rows that can be converted from the planes
+	int failed;     // the scan couldn't be decoded any further
+	// decoding MCU rows, until the scan ends or gives up early
+	int mcu_row, mcu_rows, mcus_per_row, pos, end, stopped;
+	int plane_rows[4];
+} stbi__jpeg_rowdec;
+
+// a random-access index (stbi__jpeg_build_index) for a single baseline
+// scan: the entropy decoder's state at the start of every few MCU rows, so
+// a region can be decoded from the last of those above it instead of from
+// the top. all little-endian 32-bit words:
+//    header: magic, file length, offset of the scan data, MCUs per row,
+//            MCU rows, restart interval, number of checkpoints
+//    each checkpoint: first MCU, byte and bit (0-7) in the file of the
+//            next unread bit, restart interval MCUs left, DC predictor of
+//            each of 4 components
+#define STBI__JPEG_INDEX_MAGIC 0x31584a53 // "SJX1"
+#define STBI__JPEG_INDEX_HEADER 7
+#define STBI__JPEG_INDEX_CHECKPOINT 8
+
+// start the streamed scan r at the last checkpoint in z->index above the
+// MCU rows the output region depends on. an index that doesn't match the
+// image is ignored, and the scan is decoded from the top
+static void stbi__jpeg_index_seek(stbi__jpeg *z, stbi__jpeg_rowdec *r)
+{
+	stbi_uc *base = z->s->img_buffer_original;
+	const stbi_uc *p = z->index;
+	stbi__uint32 h[STBI__JPEG_INDEX_HEADER], c[STBI__JPEG_INDEX_CHECKPOINT];
+	stbi__uint32 todo = z->restart_interval ? z->restart_interval : 0x7fffffff;
+	int i, k, row = r->mcu_rows, best = -1;
+
+	for (i = 0; i < STBI__JPEG_INDEX_HEADER; ++i)
+		h[i] = stbi__exif_get(p + 4 * i, 4, 1);
+	if (z->s->io.read || h[1] != (stbi__uint32)(z->s->img_buffer_end - base) || h[2] != (stbi__uint32)(z->s->img_buffer - base) ||
+		 h[3] != (stbi__uint32)r->mcus_per_row || h[4] != (stbi__uint32)((stbi__jpeg_scan_mcus(z) + r->mcus_per_row - 1) / r->mcus_per_row) ||
+		 h[5] != (stbi__uint32)z->restart_interval)
+		return;
+
+	// the first MCU row with a block under the region
+	for (k = 0; k < z->s->img_n; ++k)
+	{
+		int by = z->img_comp[k].by0 / (z->scan_n == 1 ? 1 : z->img_comp[k].v);
+		if (by < row)
+			row = by;
+	}
 
-	return out;
+	for (i = 0; i < (int)h[6]; ++i)
+	{
+		const stbi_uc *q = p + 4 * (STBI__JPEG_INDEX_HEADER + STBI__JPEG_INDEX_CHECKPOINT * i);
+		stbi__uint32 pos = stbi__exif_get(q, 4, 1);
+		if (pos % r->mcus_per_row == 0 && pos / r->mcus_per_row <= (stbi__uint32)row && (best < 0 || pos > c[0]))
+		{
+			for (k = 0; k < STBI__JPEG_INDEX_CHECKPOINT; ++k)
+				c[k] = stbi__exif_get(q + 4 * k, 4, 1);
+			best = i;
+		}
+	}
+	// the checkpoint has to be within the scan for the seek to be safe
+	if (best < 0 || c[0] == 0 || c[0] >= (stbi__uint32)r->end || c[1] < h[2] || c[1] >= h[1] || c[2] > 7 || c[3] < 1 || c[3] > todo)
+		return;
+	// and a DC predictor from a real image fits in 16 bits
+	for (k = 0; k < 4; ++k)
+		if ((int)c[4 + k] < -32768 || (int)c[4 + k] > 32767)
+			return;
+
+	stbi__jpeg_seek_bit(z, base, (size_t)c[1] * 8 + c[2]);
+	z->todo = (int)c[3];
+	for (k = 0; k < 4; ++k)
+		z->img_comp[k].dc_pred = (int)c[4 + k];
+	r->pos = (int)c[0];
+	r->mcu_row = r->pos / r->mcus_per_row;
 }
-#endif
 
-static stbi_uc *stbi__resample_row_generic(stbi_uc *out, stbi_uc *in_near, stbi_uc *in_far, int w, int hs)
+static void stbi__jpeg_rowdec_init(stbi__jpeg_rowdec *r, stbi__jpeg *z, stbi__jpeg_output *o)
 {
-	// resample with nearest-neighbor
-	int i, j;
-	STBI_NOTUSED(in_far);
-	for (i = 0; i < w; ++i)
-		for (j = 0; j < hs; ++j)
-			out[i * hs + j] = in_near[i];
-	return out;
+	int k;
+	r->z = z;
+	r->o = o;
+	for (k = 0; k < o->decode_n; ++k)
+		r->linebuf[k] = z->img_comp[k].linebuf;
+	r->rows_out = r->failed = 0;
+	r->rows_ready = z->crop_h;
+	if (z->banded)
+	{
+		// every scan is in, so MCU rows are only reconstructed
+		r->mcu_rows = stbi__jpeg_mcu_rows_used(z);
+		for (k = 0; k < z->s->img_n; ++k)
+			r->plane_rows[k] = z->img_comp[k].v << z->img_comp[k].bshift;
+		r->mcu_row = r->pos = r->end = 0;
+		r->stopped = 1;
+		r->rows_ready = 0;
+	}
+	else if (z->stream)
+	{
+		// decoding stopped at the start of the scan; it needn't go past the
+		// MCU rows under the output region
+		if (z->scan_n == 1)
+			r->mcus_per_row = stbi__jpeg_blocks(z->img_comp[z->order[0]].x, z->img_comp[z->order[0]].bshift);
+		else
+			r->mcus_per_row = z->img_mcu_x;
+		r->end = stbi__jpeg_scan_end(z);
+		r->mcu_rows = (r->end + r->mcus_per_row - 1) / r->mcus_per_row;
+		for (k = 0; k < z->s->img_n; ++k)
+			r->plane_rows[k] = (z->scan_n == 1 ? 1 : z->img_comp[k].v) << z->img_comp[k].bshift;
+		r->mcu_row = r->pos = r->stopped = 0;
+		r->rows_ready = 0;
+		stbi__jpeg_reset(z);
+		if (z->index)
+			stbi__jpeg_index_seek(z, r);
+	}
 }
 
-// this is a reduced-precision calculation of YCbCr-to-RGB introduced
-// to make sure the code produces the same results in both SIMD and scalar
-#define stbi__float2fixed(x) (((int)((x)*4096.0f + 0.5f)) << 8)
-static void stbi__YCbCr_to_RGB_row(stbi_uc *out, const stbi_uc *y, const stbi_uc *pcb, const stbi_uc *pcr, int count, int step)
+// decode the next MCU row of a streamed scan, or reconstruct the next one
+// of a banded image. the window of each plane moves down by an MCU row, keeping the rows above it that the output rows
+// still to come are upsampled from
+static int stbi__jpeg_rowdec_next(stbi__jpeg_rowdec *r)
 {
-	int i;
-	for (i = 0; i < count; ++i)
+	stbi__jpeg *z = r->z;
+	int k, row = r->mcu_row++;
+	for (k = 0; k < z->s->img_n; ++k)
 	{
-		int y_fixed = (y[i] << 20) + (1 << 19); // rounding
-		int r, g, b;
-		int cr = pcr[i] - 128;
-		int cb = pcb[i] - 128;
-		r = y_fixed + cr * stbi__float2fixed(1.40200f);
-		g = y_fixed + (cr * -stbi__float2fixed(0.71414f)) + ((cb * -stbi__float2fixed(0.34414f)) & 0xffff0000);
-		b = y_fixed + cb * stbi__float2fixed(1.77200f);
-		r >>= 20;
-		g >>= 20;
-		b >>= 20;
-		if ((unsigned)r > 255)
+		int w2 = z->img_comp[k].w2;
+		if (row > 0)
+			memmove(z->img_comp[k].data, z->img_comp[k].data + w2 * r->plane_rows[k], w2 * STBI__JPEG_STREAM_HISTORY);
+		z->img_comp[k].row0 = row * r->plane_rows[k] - STBI__JPEG_STREAM_HISTORY;
+	}
+	if (z->banded)
+	{
+		stbi__jpeg_finish_row(z, row, 0);
+		if (!stbi__jpeg_release_rows(z, row + 1))
+			return 0;
+	}
+	else if (!r->stopped)
+	{
+		// like the serial decoder, give up on the rest of the scan if an
+		// interval doesn't end at a restart marker
+		int end = (row + 1) * r->mcus_per_row < r->end ? (row + 1) * r->mcus_per_row : r->end;
+		int res = stbi__jpeg_decode_baseline_run(z, &r->pos, end, NULL);
+		if (res == 0)
+			return 0;
+		r->stopped = res < 0;
+	}
+	if (r->mcu_row == r->mcu_rows)
+		r->rows_ready = z->crop_h;
+	else
+		r->rows_ready = stbi__jpeg_rows_ready(z, r->o, r->mcu_row, r->plane_rows);
+	return 1;
+}
+
+// convert up to 'rows' more output rows into out, decoding MCU rows as
+// they're needed. without a scratch row the memory after out has to be
+// ours, for the byte the converters write past the last row. returns the
+// number of rows written; once nothing more can be had, rows_out is set to
+// the end and failed to 1
+static int stbi__jpeg_rowdec_output(stbi__jpeg_rowdec *r, stbi_uc *out, stbi_uc *scratch, int rows)
+{
+	stbi__jpeg *z = r->z;
+	int done = 0, stride = r->o->n * z->crop_w;
+	while (done < rows && r->rows_out < z->crop_h)
+	{
+		int n = rows - done;
+		if (r->rows_out == r->rows_ready)
 		{
-			if (r < 0)
-				r = 0;
-			else
-				r = 255;
+			if (!stbi__jpeg_rowdec_next(r))
+			{
+				r->rows_out = z->crop_h;
+				r->failed = 1;
+				break;
+			}
+			continue;
 		}
-		if ((unsigned)g > 255)
+		if (n > r->rows_ready - r->rows_out)
+			n = r->rows_ready - r->rows_out;
+		if (scratch)
+			stbi__jpeg_output_band(z, r->o, r->linebuf, scratch, out + stride * done, r->rows_out, r->rows_out + n);
+		else
+			stbi__jpeg_output_rows(z, r->o, r->linebuf, r->o->orient ? r->o->orow : out + stride * done, r->rows_out, r->rows_out + n);
+		r->rows_out += n;
+		done += n;
+	}
+	return done;
+}
+
+// once every output row is out, pass over whatever of the streamed scan
+// wasn't needed (the last output row can be ready before the last MCU row
+// under it is decoded) and carry on through the markers after it, as
+// stbi__decode_jpeg_image would have
+static int stbi__jpeg_rowdec_finish(stbi__jpeg_rowdec *r)
+{
+	stbi__jpeg *z = r->z;
+	int cut = (r->pos < r->end && !r->stopped) || r->end < stbi__jpeg_scan_mcus(z);
+	// a banded image was decoded to EOI before any row was reconstructed
+	if (z->banded)
+		return 1;
+	if ((z->marker == STBI__MARKER_none || STBI__RESTART(z->marker)) && cut)
+	{
+		z->marker = STBI__MARKER_none;
+		stbi__jpeg_skip_scan(z);
+	}
+	stbi__jpeg_end_scan(z);
+	z->stream = 2;
+	return stbi__decode_jpeg_markers(z);
+}
+
+#ifdef STBI_JPEG_THREADS
+// a baseline scan without usable restart intervals has to be entropy decoded
+// serially, but the rest of the work doesn't: the calling thread decodes one
+// MCU row at a time into a ring of coefficient slots, and the other threads
+// IDCT the rows and convert output rows as soon as the planes under them
+// are complete. by the time the scan ends most of the image is finished.
+// the end of a progressive image works the same way, minus the decoding:
+// every row is ready at once, and they're reconstructed straight out of
+// the coefficient buffers.
+typedef struct
+{
+	stbi__jpeg *z;
+	stbi__mutex lock;
+	stbi__cond changed;
+	short *coeff; // num_slots slots of one MCU row each, NULL when finishing
+	int slot_size, num_slots;
+	int *slot_row; // row held by each slot, -1 if free
+	stbi_uc *row_done;
+	int rows, mcus_per_row;
+	int plane_rows[4]; // component rows reconstructed per row
+	int rows_decoded, rows_claimed, rows_complete; // complete = reconstructed, from the top
+	int out_claimed;
+	int finished, error;
+	stbi_uc *buffers; // line buffers and a scratch row for each worker
+	int buffer_size;
+} stbi__jpeg_pipe;
+
+// number of output rows that only depend on reconstructed MCU rows
+static int stbi__jpeg_pipe_output_limit(stbi__jpeg_pipe *p)
+{
+	if (p->rows_complete == p->rows)
+		return p->z->crop_h;
+	return stbi__jpeg_rows_ready(p->z, p->z->out, p->rows_complete, p->plane_rows);
+}
+
+// reconstruct a row that's been claimed, with the lock held on entry and exit
+static void stbi__jpeg_pipe_idct_row(stbi__jpeg_pipe *p, int row)
+{
+	int slot = p->coeff ? row % p->num_slots : 0, complete;
+	stbi__mutex_unlock(&p->lock);
+	if (p->coeff)
+		stbi__jpeg_baseline_mcus(p->z, row * p->mcus_per_row, p->mcus_per_row, p->coeff + slot * p->slot_size, 0, 1);
+	else
+		stbi__jpeg_finish_row(p->z, row, 0);
+	stbi__mutex_lock(&p->lock);
+	complete = p->rows_complete;
+	if (p->coeff)
+		p->slot_row[slot] = -1;
+	p->row_done[row] = 1;
+	while (p->rows_complete < p->rows && p->row_done[p->rows_complete])
+		++p->rows_complete;
+	// only rows that every thread is done with can be let go. no output is
+	// made once that fails, but the rows still being reconstructed are
+	// below the ones that may be gone
+	if (!p->coeff && !p->error && complete < p->rows_complete && !stbi__jpeg_release_rows(p->z, p->rows_complete))
+		p->error = 1;
+	stbi__cond_broadcast(&p->changed);
+}
+
+static void stbi__jpeg_pipe_consume(stbi__jpeg_pipe *p, int worker)
+{
+	stbi__jpeg *z = p->z;
+	stbi__jpeg_output *o = z->out;
+	stbi_uc *linebuf[4], *scratch;
+	int band = (8 >> z->scale) * z->img_v_max;
+	scratch = stbi__jpeg_band_buffers(z, o, p->buffers + worker * p->buffer_size, linebuf);
+	stbi__mutex_lock(&p->lock);
+	for (;;)
+	{
+		int limit = stbi__jpeg_pipe_output_limit(p);
+		// reconstruction first, it's what frees slots for the decoder. with
+		// no decoder waiting, convert each band while its rows are still in
+		// cache
+		if (p->rows_claimed < p->rows_decoded && (p->coeff || limit - p->out_claimed < band))
 		{
-			if (g < 0)
-				g = 0;
-			else
-				g = 255;
+			stbi__jpeg_pipe_idct_row(p, p->rows_claimed++);
+			continue;
 		}
-		if ((unsigned)b > 255)
+		if (!p->error && p->out_claimed < limit)
 		{
-			if (b < 0)
-				b = 0;
+			int y0 = p->out_claimed;
+			int y1 = limit - y0 > band ? y0 + band : limit;
+			p->out_claimed = y1;
+			stbi__mutex_unlock(&p->lock);
+			stbi__jpeg_output_band(z, o, linebuf, scratch, o->output + o->n * z->crop_w * y0, y0, y1);
+			stbi__mutex_lock(&p->lock);
+			continue;
+		}
+		// rows still being reconstructed elsewhere may release more output
+		if (p->finished && p->rows_complete == p->rows_decoded)
+			break;
+		stbi__cond_wait(&p->changed, &p->lock);
+	}
+	stbi__mutex_unlock(&p->lock);
+}
+
+static void stbi__jpeg_pipe_produce(stbi__jpeg_pipe *p)
+{
+	stbi__jpeg *z = p->z;
+	int row, pos = 0, error = 0;
+	for (row = 0; row < p->rows; ++row)
+	{
+		int slot = row % p->num_slots, first = pos, r;
+		short *coeff = p->coeff + slot * p->slot_size;
+		stbi__mutex_lock(&p->lock);
+		while (p->slot_row[slot] >= 0)
+		{
+			// help out rather than wait, so this can't stall if no other
+			// thread could be started
+			if (p->rows_claimed < p->rows_decoded)
+				stbi__jpeg_pipe_idct_row(p, p->rows_claimed++);
 			else
-				b = 255;
+				stbi__cond_wait(&p->changed, &p->lock);
 		}
-		out[0] = (stbi_uc)r;
-		out[1] = (stbi_uc)g;
-		out[2] = (stbi_uc)b;
-		out[3] = 255;
-		out += step;
+		stbi__mutex_unlock(&p->lock);
+
+		r = stbi__jpeg_decode_baseline_run(z, &pos, first + p->mcus_per_row, coeff);
+		if (r == 0)
+		{
+			error = 1;
+			break;
+		}
+		if (pos < first + p->mcus_per_row)
+		{
+			// the scan stopped early; the serial decoder would still have
+			// reconstructed the MCUs it got through
+			stbi__jpeg_baseline_mcus(z, first, pos - first, coeff, 0, 1);
+			break;
+		}
+		stbi__mutex_lock(&p->lock);
+		p->slot_row[slot] = row;
+		p->rows_decoded = row + 1;
+		stbi__cond_broadcast(&p->changed);
+		stbi__mutex_unlock(&p->lock);
+		if (r < 0)
+			break;
+	}
+	stbi__mutex_lock(&p->lock);
+	p->error = error;
+	p->finished = 1;
+	stbi__cond_broadcast(&p->changed);
+	stbi__mutex_unlock(&p->lock);
+}
+
+static void stbi__jpeg_pipe_worker(void *arg, int worker, int nworkers)
+{
+	stbi__jpeg_pipe *p = (stbi__jpeg_pipe *)arg;
+	STBI_NOTUSED(nworkers);
+	if (worker == 0 && p->coeff)
+		stbi__jpeg_pipe_produce(p);
+	stbi__jpeg_pipe_consume(p, worker);
+}
+
+// per-thread line buffers, plus the synchronisation everything needs
+static int stbi__jpeg_pipe_init(stbi__jpeg_pipe *p, stbi__jpeg *z, int nworkers)
+{
+	p->z = z;
+	p->buffer_size = stbi__jpeg_band_buffer_size(z, z->out);
+	p->row_done = (stbi_uc *)stbi__malloc(p->rows);
+	p->buffers = (stbi_uc *)stbi__malloc_mad2(nworkers, p->buffer_size, 0);
+	if (!p->row_done || !p->buffers)
+	{
+		STBI_FREE(p->row_done);
+		STBI_FREE(p->buffers);
+		return 0;
 	}
+	memset(p->row_done, 0, p->rows);
+	p->rows_decoded = p->rows_claimed = p->rows_complete = 0;
+	p->out_claimed = 0;
+	p->finished = p->error = 0;
+	stbi__mutex_init(&p->lock);
+	stbi__cond_init(&p->changed);
+	return 1;
 }
 
-#if defined(STBI_SSE2) || defined(STBI_NEON)
-static void stbi__YCbCr_to_RGB_simd(stbi_uc *out, stbi_uc const *y, stbi_uc const *pcb, stbi_uc const *pcr, int count, int step)
+static void stbi__jpeg_pipe_free(stbi__jpeg_pipe *p)
 {
-	int i = 0;
+	stbi__cond_destroy(&p->changed);
+	stbi__mutex_destroy(&p->lock);
+	STBI_FREE(p->row_done);
+	STBI_FREE(p->buffers);
+}
 
-#ifdef STBI_SSE2
-	// step == 3 is pretty ugly on the final interleave, and i'm not convinced
-	// it's useful in practice (you wouldn't use it for textures, for example).
-	// so just accelerate step == 4 case.
-	if (step == 4)
+static int stbi__jpeg_decode_pipelined(stbi__jpeg *z)
+{
+	stbi__jpeg_pipe p;
+	void *raw_coeff;
+	int nworkers = stbi__jpeg_thread_count, i;
+
+	if (z->scan_n == 1)
 	{
-		// this is a fairly straightforward implementation and not super-optimized.
-		__m128i signflip = _mm_set1_epi8(-0x80);
-		__m128i cr_const0 = _mm_set1_epi16((short)(1.40200f * 4096.0f + 0.5f));
-		__m128i cr_const1 = _mm_set1_epi16(-(short)(0.71414f * 4096.0f + 0.5f));
-		__m128i cb_const0 = _mm_set1_epi16(-(short)(0.34414f * 4096.0f + 0.5f));
-		__m128i cb_const1 = _mm_set1_epi16((short)(1.77200f * 4096.0f + 0.5f));
-		__m128i y_bias = _mm_set1_epi8((char)(unsigned char)128);
-		__m128i xw = _mm_set1_epi16(255); // alpha channel
+		int n = z->order[0];
+		p.mcus_per_row = stbi__jpeg_blocks(z->img_comp[n].x, z->img_comp[n].bshift);
+	}
+	else
+		p.mcus_per_row = z->img_mcu_x;
+	p.rows = (stbi__jpeg_scan_end(z) + p.mcus_per_row - 1) / p.mcus_per_row;
+	if (p.rows < 2)
+		return stbi__jpeg_decode_baseline_from(z, 0);
+	for (i = 0; i < z->s->img_n; ++i)
+		p.plane_rows[i] = (z->scan_n == 1 ? 1 : z->img_comp[i].v) << z->img_comp[i].bshift;
+
+	// the output has to exist before any of it can be produced
+	if (!z->out->output && !stbi__jpeg_prepare_output(z, z->out))
+		return 0;
 
-		for (; i + 7 < count; i += 8)
-		{
-			// load
-			__m128i y_bytes = _mm_loadl_epi64((__m128i *)(y + i));
-			__m128i cr_bytes = _mm_loadl_epi64((__m128i *)(pcr + i));
-			__m128i cb_bytes = _mm_loadl_epi64((__m128i *)(pcb + i));
-			__m128i cr_biased = _mm_xor_si128(cr_bytes, signflip); // -128
-			__m128i cb_biased = _mm_xor_si128(cb_bytes, signflip); // -128
+	// two slots per reconstructing thread keeps the decoder busy
+	p.num_slots = 2 * (nworkers - 1) < p.rows ? 2 * (nworkers - 1) : p.rows;
+	p.slot_size = p.mcus_per_row * stbi__jpeg_blocks_per_mcu(z) * 64;
+	p.slot_row = (int *)stbi__malloc_mad2(p.num_slots, sizeof(int), 0);
+	raw_coeff = stbi__malloc_mad3(p.num_slots, p.slot_size, sizeof(short), 15);
+	if (!p.slot_row || !raw_coeff || !stbi__jpeg_pipe_init(&p, z, nworkers))
+	{
+		// not enough memory to pipeline, which doesn't mean there isn't
+		// enough to decode
+		STBI_FREE(p.slot_row);
+		STBI_FREE(raw_coeff);
+		return stbi__jpeg_decode_baseline_from(z, 0);
+	}
+	p.coeff = (short *)(((size_t)raw_coeff + 15) & ~15);
+	for (i = 0; i < p.num_slots; ++i)
+		p.slot_row[i] = -1;
 
-			// unpack to short (and left-shift cr, cb by 8)
-			__m128i yw = _mm_unpacklo_epi8(y_bias, y_bytes);
-			__m128i crw = _mm_unpacklo_epi8(_mm_setzero_si128(), cr_biased);
-			__m128i cbw = _mm_unpacklo_epi8(_mm_setzero_si128(), cb_biased);
+	stbi__jpeg_parallel(stbi__jpeg_pipe_worker, &p, nworkers);
 
-			// color transform
-			__m128i yws = _mm_srli_epi16(yw, 4);
-			__m128i cr0 = _mm_mulhi_epi16(cr_const0, crw);
-			__m128i cb0 = _mm_mulhi_epi16(cb_const0, cbw);
-			__m128i cb1 = _mm_mulhi_epi16(cbw, cb_const1);
-			__m128i cr1 = _mm_mulhi_epi16(crw, cr_const1);
-			__m128i rws = _mm_add_epi16(cr0, yws);
-			__m128i gwt = _mm_add_epi16(cb0, yws);
-			__m128i bws = _mm_add_epi16(yws, cb1);
-			__m128i gws = _mm_add_epi16(gwt, cr1);
+	stbi__jpeg_pipe_free(&p);
+	STBI_FREE(p.slot_row);
+	STBI_FREE(raw_coeff);
+	if (p.error)
+		return 0;
+	z->out->rows_done = p.out_claimed;
+	return 1;
+}
 
-			// descale
-			__m128i rw = _mm_srai_epi16(rws, 4);
-			__m128i bw = _mm_srai_epi16(bws, 4);
-			__m128i gw = _mm_srai_epi16(gws, 4);
+// returns 0 if the caller has to finish the image serially instead, -1 if
+// the coefficients of finished rows couldn't be let go
+static int stbi__jpeg_finish_parallel(stbi__jpeg *z)
+{
+	stbi__jpeg_pipe p;
+	int nworkers = stbi__jpeg_thread_count, i;
 
-			// back to byte, set up for transpose
-			__m128i brb = _mm_packus_epi16(rw, bw);
-			__m128i gxb = _mm_packus_epi16(gw, xw);
+	p.rows = stbi__jpeg_mcu_rows_used(z);
+	if (p.rows < 2)
+		return 0;
+	for (i = 0; i < z->s->img_n; ++i)
+		p.plane_rows[i] = z->img_comp[i].v << z->img_comp[i].bshift;
+	if (!z->out->output && !stbi__jpeg_prepare_output(z, z->out))
+		return 0;
+	if (!stbi__jpeg_pipe_init(&p, z, nworkers))
+		return 0;
+	p.coeff = NULL;
+	p.rows_decoded = p.rows;
+	p.finished = 1;
 
-			// transpose to interleave channels
-			__m128i t0 = _mm_unpacklo_epi8(brb, gxb);
-			__m128i t1 = _mm_unpackhi_epi8(brb, gxb);
-			__m128i o0 = _mm_unpacklo_epi16(t0, t1);
-			__m128i o1 = _mm_unpackhi_epi16(t0, t1);
+	stbi__jpeg_parallel(stbi__jpeg_pipe_worker, &p, nworkers);
 
-			// store
-			_mm_storeu_si128((__m128i *)(out + 0), o0);
-			_mm_storeu_si128((__m128i *)(out + 16), o1);
-			out += 32;
-		}
-	}
+	stbi__jpeg_pipe_free(&p);
+	if (p.error)
+		return -1;
+	z->out->rows_done = p.out_claimed;
+	return 1;
+}
 #endif
 
-#ifdef STBI_NEON
-	// in this version, step=3 support would be easy to add. but is there demand?
-	if (step == 4)
-	{
-		// this is a fairly straightforward implementation and not super-optimized.
-		uint8x8_t signflip = vdup_n_u8(0x80);
-		int16x8_t cr_const0 = vdupq_n_s16((short)(1.40200f * 4096.0f + 0.5f));
-		int16x8_t cr_const1 = vdupq_n_s16(-(short)(0.71414f * 4096.0f + 0.5f));
-		int16x8_t cb_const0 = vdupq_n_s16(-(short)(0.34414f * 4096.0f + 0.5f));
-		int16x8_t cb_const1 = vdupq_n_s16((short)(1.77200f * 4096.0f + 0.5f));
-
-		for (; i + 7 < count; i += 8)
-		{
-			// load
-			uint8x8_t y_bytes = vld1_u8(y + i);
-			uint8x8_t cr_bytes = vld1_u8(pcr + i);
-			uint8x8_t cb_bytes = vld1_u8(pcb + i);
-			int8x8_t cr_biased = vreinterpret_s8_u8(vsub_u8(cr_bytes, signflip));
-			int8x8_t cb_biased = vreinterpret_s8_u8(vsub_u8(cb_bytes, signflip));
+static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+{
+	stbi__jpeg_output o;
+	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
 
-			// expand to s16
-			int16x8_t yws = vreinterpretq_s16_u16(vshll_n_u8(y_bytes, 4));
-			int16x8_t crw = vshll_n_s8(cr_biased, 7);
-			int16x8_t cbw = vshll_n_s8(cb_biased, 7);
+	// validate req_comp
+	if (req_comp < 0 || req_comp > 4)
+		return stbi__errpuc("bad req_comp", "Internal error");
 
-			// color transform
-			int16x8_t cr0 = vqdmulhq_s16(crw, cr_const0);
-			int16x8_t cb0 = vqdmulhq_s16(cbw, cb_const0);
-			int16x8_t cr1 = vqdmulhq_s16(crw, cr_const1);
-			int16x8_t cb1 = vqdmulhq_s16(cbw, cb_const1);
-			int16x8_t rws = vaddq_s16(yws, cr0);
-			int16x8_t gws = vaddq_s16(vaddq_s16(yws, cb0), cr1);
-			int16x8_t bws = vaddq_s16(yws, cb1);
+	o.req_comp = req_comp;
+	o.output = NULL;
+	o.orient = stbi__jpeg_orient_on_load;
+	if (o.orient)
+		z->exif |= STBI__EXIF_orientation;
+	z->out = &o;
+
+	// decoding on one thread, a single baseline scan is reconstructed and
+	// converted an MCU row at a time instead of into whole planes; the
+	// threaded decoders need the whole planes
+#ifdef STBI_JPEG_THREADS
+	z->stream = stbi__jpeg_thread_count <= 1 || z->index; // seeking needs the serial decoder
+#else
+	z->stream = 1;
+#endif
 
-			// undo scaling, round, convert to byte
-			uint8x8x4_t o;
-			o.val[0] = vqrshrun_n_s16(rws, 4);
-			o.val[1] = vqrshrun_n_s16(gws, 4);
-			o.val[2] = vqrshrun_n_s16(bws, 4);
-			o.val[3] = vdup_n_u8(255);
+	// load a jpeg image from whichever source, but leave in YCbCr format;
+	// a pipelined scan may already convert some or all of the output
+	if (!stbi__decode_jpeg_image(z) || (!o.output && !stbi__jpeg_prepare_output(z, &o)))
+	{
+		if (o.output)
+			STBI_FREE(o.output);
+		stbi__cleanup_jpeg(z);
+		return NULL;
+	}
 
-			// store, interleaving r/g/b/a
-			vst4_u8(out, o);
-			out += 8 * 4;
+	if (z->stream)
+	{
+		// the output format is settled by the markers before the scan, as
+		// an image with colour markers after it isn't streamed
+		stbi__jpeg_rowdec r;
+		stbi__jpeg_rowdec_init(&r, z, &o);
+		stbi__jpeg_rowdec_output(&r, o.output, NULL, z->crop_h);
+		if (r.failed || !stbi__jpeg_rowdec_finish(&r))
+		{
+			STBI_FREE(o.output);
+			stbi__cleanup_jpeg(z);
+			return NULL;
+		}
+		o.rows_done = z->crop_h;
+	}
+	else
+	{
+		// the output may have been set up at the start of a scan, and an
+		// Adobe marker after it can still change the colour transform, of
+		// YCbCr/RGB or of CMYK/YCCK
+		stbi__jpeg_output f = o;
+		stbi__jpeg_output_format(z, &f);
+		if (f.is_rgb != o.is_rgb || f.transform != o.transform)
+		{
+			int k;
+			for (k = 0; k < o.decode_n; ++k)
+			{
+				stbi__jpeg_free_buf(z, z->img_comp[k].linebuf);
+				z->img_comp[k].linebuf = NULL;
+			}
+			STBI_FREE(o.output);
+			o.output = NULL;
+			if (!stbi__jpeg_prepare_output(z, &o))
+			{
+				if (o.output)
+					STBI_FREE(o.output);
+				stbi__cleanup_jpeg(z);
+				return NULL;
+			}
 		}
 	}
+
+	// resample and color-convert the rest
+	if (o.rows_done < z->crop_h)
+	{
+		stbi_uc *linebuf[4];
+		int k;
+#ifdef STBI_JPEG_THREADS
+		stbi__jpeg_output_job job;
+		int nworkers = stbi__jpeg_thread_count;
+		int rows = z->crop_h - o.rows_done;
+
+		// split the rows into one band per thread, each with its own line
+		// buffers; if those can't be had, just convert serially
+		job.buffers = NULL;
+		job.buffer_size = stbi__jpeg_band_buffer_size(z, &o);
+		if (nworkers > 1 && rows >= 16 * nworkers)
+			job.buffers = (stbi_uc *)stbi__malloc_mad2(nworkers, job.buffer_size, 0);
+		if (job.buffers)
+		{
+			job.z = z;
+			job.o = &o;
+			job.y0 = o.rows_done;
+			job.rows_per_worker = (rows + nworkers - 1) / nworkers;
+			stbi__jpeg_parallel(stbi__jpeg_output_worker, &job, nworkers);
+			STBI_FREE(job.buffers);
+		}
+		else
 #endif
+		{
+			for (k = 0; k < o.decode_n; ++k)
+				linebuf[k] = z->img_comp[k].linebuf;
+			stbi__jpeg_output_rows(z, &o, linebuf, stbi__jpeg_output_at(z, &o, o.rows_done), o.rows_done, z->crop_h);
+		}
+	}
 
-	for (; i < count; ++i)
+	stbi__cleanup_jpeg(z);
+	*out_x = o.orient >= 5 ? z->crop_h : z->crop_w;
+	*out_y = o.orient >= 5 ? z->crop_w : z->crop_h;
+	if (comp)
+		*comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+	return o.output;
+}
+
+static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+{
+	unsigned char *result;
+	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	STBI_NOTUSED(ri);
+	j->s = s;
+	stbi__setup_jpeg(j);
+	result = load_jpeg_image(j, x, y, comp, req_comp);
+	STBI_FREE(j);
+	return result;
+}
+
+// stbi__jpeg_load with its own STBI_JPEG_* profile, whatever
+// stbi_jpeg_set_profile says
+static stbi_uc *stbi__jpeg_load_profile(stbi__context *s, int *x, int *y, int *comp, int req_comp, int profile)
+{
+	unsigned char *result;
+	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j)
+		return stbi__errpuc("outofmem", "Out of memory");
+	j->s = s;
+	stbi__setup_jpeg(j);
+	j->profile = stbi__jpeg_clamp_profile(profile);
+	result = load_jpeg_image(j, x, y, comp, req_comp);
+	STBI_FREE(j);
+	return result;
+}
+
+// load only a rectangle of the image at the size it's decoded at. blocks
+// before the rectangle still have to be huffman decoded, but nothing
+// outside it is reconstructed or colour converted, and decoding stops
+// after the last block it needs
+static stbi_uc *stbi__jpeg_load_region(stbi__context *s, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	unsigned char *result;
+	stbi__jpeg *j;
+	if (w <= 0 || h <= 0)
+		return stbi__errpuc("bad region", "Region is outside the image");
+	j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j)
+		return stbi__errpuc("outofmem", "Out of memory");
+	j->s = s;
+	stbi__setup_jpeg(j);
+	j->crop_x = x;
+	j->crop_y = y;
+	j->crop_w = w;
+	j->crop_h = h;
+	result = load_jpeg_image(j, out_w, out_h, comp, req_comp);
+	STBI_FREE(j);
+	return result;
+}
+
+// huffman decode 'count' MCUs of a baseline scan, keeping nothing but the
+// DC predictors
+static int stbi__jpeg_skip_mcus(stbi__jpeg *z, int count)
+{
+	int k, b, diff;
+	for (; count > 0; --count)
 	{
-		int y_fixed = (y[i] << 20) + (1 << 19); // rounding
-		int r, g, b;
-		int cr = pcr[i] - 128;
-		int cb = pcb[i] - 128;
-		r = y_fixed + cr * stbi__float2fixed(1.40200f);
-		g = y_fixed + cr * -stbi__float2fixed(0.71414f) + ((cb * -stbi__float2fixed(0.34414f)) & 0xffff0000);
-		b = y_fixed + cb * stbi__float2fixed(1.77200f);
-		r >>= 20;
-		g >>= 20;
-		b >>= 20;
-		if ((unsigned)r > 255)
+		for (k = 0; k < z->scan_n; ++k)
 		{
-			if (r < 0)
-				r = 0;
-			else
-				r = 255;
+			int n = z->order[k], ha = z->img_comp[n].ha;
+			int blocks = z->scan_n == 1 ? 1 : z->img_comp[n].h * z->img_comp[n].v;
+			for (b = 0; b < blocks; ++b)
+			{
+				if (!stbi__jpeg_skip_block(z, z->huff_dc + z->img_comp[n].hd, z->huff_ac + ha, z->multi_ac[ha], &diff))
+					return stbi__err("bad huffman code", "Corrupt JPEG");
+				z->img_comp[n].dc_pred += diff;
+			}
 		}
-		if ((unsigned)g > 255)
+	}
+	return 1;
+}
+
+static void stbi__jpeg_put32(stbi_uc *p, stbi__uint32 v)
+{
+	p[0] = (stbi_uc)v;
+	p[1] = (stbi_uc)(v >> 8);
+	p[2] = (stbi_uc)(v >> 16);
+	p[3] = (stbi_uc)(v >> 24);
+}
+
+// make one pass over the entropy-coded data of a single-scan baseline image
+// in memory, checkpointing the decoder at the start of every 'rows' MCU
+// rows, and return the index (see stbi__jpeg_index_seek) in *len bytes.
+// a row whose start is too close to a restart marker to tell where the
+// decoder is gets its checkpoint from the next row instead
+static stbi_uc *stbi__jpeg_build_index(stbi__context *s, int rows, int *len)
+{
+	stbi__jpeg *z;
+	stbi_uc *index = NULL, *base = s->img_buffer_original;
+	int count = 0, cap = 0, pos = 0, end, per_row, due = 0;
+	if (s->io.read)
+		return stbi__errpuc("not in memory", "Indexing needs the whole file in memory");
+	z = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!z)
+		return stbi__errpuc("outofmem", "Out of memory");
+	z->s = s;
+	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
+	stbi__setup_jpeg(z);
+	z->stream = 1;
+	if (!stbi__decode_jpeg_image(z))
+		goto fail;
+	// anything that isn't a single baseline scan ends up in whole planes
+	if (z->stream != 1)
+	{
+		stbi__err("not indexable", "Only single-scan baseline JPEGs can be indexed");
+		goto fail;
+	}
+
+	per_row = z->scan_n == 1 ? stbi__jpeg_blocks(z->img_comp[z->order[0]].x, z->img_comp[z->order[0]].bshift) : z->img_mcu_x;
+	end = stbi__jpeg_scan_mcus(z);
+	if (rows < 1)
+		rows = 1;
+	cap = STBI__JPEG_INDEX_HEADER * 4;
+	index = (stbi_uc *)stbi__malloc(cap);
+	if (!index)
+	{
+		stbi__err("outofmem", "Out of memory");
+		goto fail;
+	}
+	stbi__jpeg_put32(index, STBI__JPEG_INDEX_MAGIC);
+	stbi__jpeg_put32(index + 4, (stbi__uint32)(s->img_buffer_end - base));
+	stbi__jpeg_put32(index + 8, (stbi__uint32)(s->img_buffer - base));
+	stbi__jpeg_put32(index + 12, (stbi__uint32)per_row);
+	stbi__jpeg_put32(index + 16, (stbi__uint32)((end + per_row - 1) / per_row));
+	stbi__jpeg_put32(index + 20, (stbi__uint32)z->restart_interval);
+
+	stbi__jpeg_reset(z);
+	while (pos < end)
+	{
+		int row_end = pos + per_row < end ? pos + per_row : end;
+		if (pos > 0 && pos / per_row % rows == 0)
+			due = 1;
+		if (due && !z->nomore)
 		{
-			if (g < 0)
-				g = 0;
-			else
-				g = 255;
+			size_t bit = stbi__jpeg_bit_pos(z, base);
+			stbi_uc *q, *grown;
+			int k;
+			if (cap < (STBI__JPEG_INDEX_HEADER + STBI__JPEG_INDEX_CHECKPOINT * (count + 1)) * 4)
+			{
+				cap = cap * 2 + STBI__JPEG_INDEX_CHECKPOINT * 4;
+				grown = (stbi_uc *)STBI_REALLOC(index, cap);
+				if (!grown)
+				{
+					stbi__err("outofmem", "Out of memory");
+					goto fail;
+				}
+				index = grown;
+			}
+			q = index + 4 * (STBI__JPEG_INDEX_HEADER + STBI__JPEG_INDEX_CHECKPOINT * count++);
+			stbi__jpeg_put32(q, (stbi__uint32)pos);
+			stbi__jpeg_put32(q + 4, (stbi__uint32)(bit / 8));
+			stbi__jpeg_put32(q + 8, (stbi__uint32)(bit & 7));
+			stbi__jpeg_put32(q + 12, (stbi__uint32)z->todo);
+			for (k = 0; k < 4; ++k)
+				stbi__jpeg_put32(q + 16 + 4 * k, (stbi__uint32)z->img_comp[k].dc_pred);
+			due = 0;
 		}
-		if ((unsigned)b > 255)
+		// same restart handling as stbi__jpeg_decode_baseline_run
+		while (pos < row_end)
 		{
-			if (b < 0)
-				b = 0;
-			else
-				b = 255;
+			int n = row_end - pos < z->todo ? row_end - pos : z->todo;
+			if (!stbi__jpeg_skip_mcus(z, n))
+				goto fail;
+			pos += n;
+			z->todo -= n;
+			if (z->todo <= 0)
+			{
+				if (z->code_bits < 24)
+					stbi__grow_buffer_unsafe(z);
+				if (!STBI__RESTART(z->marker))
+				{
+					end = pos;
+					break;
+				}
+				stbi__jpeg_reset(z);
+			}
 		}
-		out[0] = (stbi_uc)r;
-		out[1] = (stbi_uc)g;
-		out[2] = (stbi_uc)b;
-		out[3] = 255;
-		out += step;
 	}
+
+	stbi__jpeg_put32(index + 24, (stbi__uint32)count);
+	*len = 4 * (STBI__JPEG_INDEX_HEADER + STBI__JPEG_INDEX_CHECKPOINT * count);
+	stbi__cleanup_jpeg(z);
+	STBI_FREE(z);
+	return index;
+
+fail:
+	if (index)
+		STBI_FREE(index);
+	stbi__cleanup_jpeg(z);
+	STBI_FREE(z);
+	return NULL;
+}
+
+// stbi__jpeg_load_region for an image in memory, given an index of it from
+// stbi__jpeg_build_index: decoding starts at the checkpoint nearest above
+// the rectangle, so a tile near the bottom of a big image costs about as
+// much as one near the top
+static stbi_uc *stbi__jpeg_load_region_indexed(stbi__context *s, const stbi_uc *index, int index_len, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	unsigned char *result;
+	stbi__jpeg *j;
+	if (!index || index_len < STBI__JPEG_INDEX_HEADER * 4 || stbi__exif_get(index, 4, 1) != STBI__JPEG_INDEX_MAGIC ||
+		 (stbi__uint32)(index_len / 4 - STBI__JPEG_INDEX_HEADER) / STBI__JPEG_INDEX_CHECKPOINT < stbi__exif_get(index + 24, 4, 1))
+		return stbi__errpuc("bad index", "Corrupt JPEG index");
+	if (w <= 0 || h <= 0)
+		return stbi__errpuc("bad region", "Region is outside the image");
+	j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j)
+		return stbi__errpuc("outofmem", "Out of memory");
+	j->s = s;
+	stbi__setup_jpeg(j);
+	j->crop_x = x;
+	j->crop_y = y;
+	j->crop_w = w;
+	j->crop_h = h;
+	j->index = index;
+	result = load_jpeg_image(j, out_w, out_h, comp, req_comp);
+	STBI_FREE(j);
+	return result;
 }
-#endif
 
-// set up the kernels
-static void stbi__setup_jpeg(stbi__jpeg *j)
+// load the whole image, showing it to 'callback' after each scan if it's
+// progressive, so a first approximation can be used while the rest of the
+// file is decoded. baseline images don't call it
+static stbi_uc *stbi__jpeg_load_progressive(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_jpeg_scan_callback callback, void *user)
 {
-	j->idct_block_kernel = stbi__idct_block;
-	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_row;
-	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2;
+	unsigned char *result;
+	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j)
+		return stbi__errpuc("outofmem", "Out of memory");
+	j->s = s;
+	stbi__setup_jpeg(j);
+	j->preview = callback;
+	j->preview_user = user;
+	result = load_jpeg_image(j, x, y, comp, req_comp);
+	STBI_FREE(j);
+	return result;
+}
 
-#ifdef STBI_SSE2
-	if (stbi__sse2_available())
+// decode into the component planes of 'p' (see image_api.h) and hand them
+// over as they are: no upsampling, no colour conversion and no output image
+static stbi_uc *stbi__jpeg_load_planar(stbi__context *s, stbi_jpeg_planes *p)
+{
+	stbi_uc *result;
+	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	int k;
+	if (!j)
+		return stbi__errpuc("outofmem", "Out of memory");
+	j->s = s;
+	s->img_n = 0; // make stbi__cleanup_jpeg safe
+	stbi__setup_jpeg(j);
+	j->planar = 1;
+	if (!stbi__decode_jpeg_image(j))
 	{
-		j->idct_block_kernel = stbi__idct_simd;
-		j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-		j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
+		stbi__cleanup_jpeg(j);
+		STBI_FREE(j);
+		return NULL;
 	}
-#endif
+	p->x = s->img_x;
+	p->y = s->img_y;
+	p->n = s->img_n;
+	if (s->img_n == 3)
+		p->ycc = !(j->rgb == 3 || (j->app14_color_transform == 0 && !j->jfif));
+	else
+		p->ycc = s->img_n == 4 && j->app14_color_transform == 2;
+	for (k = 0; k < s->img_n; ++k)
+	{
+		p->data[k] = j->img_comp[k].data;
+		p->w[k] = j->img_comp[k].x;
+		p->h[k] = j->img_comp[k].y;
+		p->stride[k] = j->img_comp[k].w2;
+	}
+	result = (stbi_uc *)j->img_comp[0].raw_data;
+	j->img_comp[0].raw_data = NULL;
+	stbi__cleanup_jpeg(j);
+	STBI_FREE(j);
+	return result;
+}
 
-#ifdef STBI_NEON
-	j->idct_block_kernel = stbi__idct_simd;
-	j->YCbCr_to_RGB_kernel = stbi__YCbCr_to_RGB_simd;
-	j->resample_row_hv_2_kernel = stbi__resample_row_hv_2_simd;
-#endif
+// entropy decode every scan into the coefficient arrays of 'c' (see
+// image_api.h), with no dequantization, IDCT or output image
+static short *stbi__jpeg_load_coefficients(stbi__context *s, stbi_jpeg_coefficients *c)
+{
+	short *result;
+	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	int k, i;
+	if (!j)
+		return (short *)stbi__errpuc("outofmem", "Out of memory");
+	j->s = s;
+	s->img_n = 0; // make stbi__cleanup_jpeg safe
+	stbi__setup_jpeg(j);
+	j->scale = 0;
+	j->coefficients = 1;
+	if (!stbi__decode_jpeg_image(j))
+	{
+		stbi__cleanup_jpeg(j);
+		STBI_FREE(j);
+		return NULL;
+	}
+	c->x = s->img_x;
+	c->y = s->img_y;
+	c->n = s->img_n;
+	c->jfif = j->jfif;
+	c->transform = j->app14_color_transform;
+	for (k = 0; k < s->img_n; ++k)
+	{
+		c->id[k] = j->img_comp[k].id;
+		c->h[k] = j->img_comp[k].h;
+		c->v[k] = j->img_comp[k].v;
+		c->blocks_w[k] = j->img_comp[k].coeff_w;
+		c->blocks_h[k] = j->img_comp[k].coeff_h;
+		c->coeff[k] = j->img_comp[k].coeff;
+		for (i = 0; i < 64; ++i)
+			c->quant[k][i] = j->dequant[j->img_comp[k].tq][i];
+	}
+	result = (short *)j->img_comp[0].raw_coeff;
+	j->img_comp[0].raw_coeff = NULL;
+	stbi__cleanup_jpeg(j);
+	STBI_FREE(j);
+	return result;
 }
 
-// clean up the temporary component buffers
-static void stbi__cleanup_jpeg(stbi__jpeg *j)
+// the JPEG thumbnail a camera put in the EXIF data, found by reading the
+// markers up to the frame header; the image itself is never decoded. the
+// image's EXIF orientation goes in *orientation, if asked for
+static stbi_uc *stbi__jpeg_exif_thumbnail(stbi__context *s, int *len, int *orientation)
 {
-	stbi__free_jpeg_components(j, j->s->img_n, 0);
+	stbi_uc *result;
+	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j)
+		return stbi__errpuc("outofmem", "Out of memory");
+	j->s = s;
+	stbi__setup_jpeg(j);
+	j->exif = STBI__EXIF_thumbnail;
+	if (!stbi__decode_jpeg_header(j, STBI__SCAN_header))
+	{
+		STBI_FREE(j->exif_thumb);
+		STBI_FREE(j);
+		return NULL;
+	}
+	result = j->exif_thumb;
+	if (result && len)
+		*len = j->exif_thumb_len;
+	if (orientation)
+		*orientation = j->orientation;
+	STBI_FREE(j);
+	if (!result)
+		return stbi__errpuc("no thumbnail", "JPEG has no EXIF thumbnail");
+	return result;
 }
 
-typedef struct
+// decode the EXIF thumbnail as a JPEG of its own. when orienting on load,
+// it's turned upright by the orientation of the image it came from, like
+// the image itself would be
+static stbi_uc *stbi__jpeg_load_thumbnail(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
-	resample_row_func resample;
-	stbi_uc *line0, *line1;
-	int hs, vs;  // expansion factor in each axis
-	int w_lores; // horizontal pixels pre-expansion
-	int ystep;   // how far through vertical expansion we are
-	int ypos;    // which pre-expansion row we're on
-} stbi__resample;
+	stbi__context ts;
+	stbi__jpeg *j;
+	stbi_uc *result, *thumb;
+	int len, orientation;
+	thumb = stbi__jpeg_exif_thumbnail(s, &len, &orientation);
+	if (!thumb)
+		return NULL;
+	j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
+	if (!j)
+	{
+		STBI_FREE(thumb);
+		return stbi__errpuc("outofmem", "Out of memory");
+	}
+	stbi__start_mem(&ts, thumb, len);
+	j->s = &ts;
+	stbi__setup_jpeg(j);
+	j->parent_orientation = orientation;
+	result = load_jpeg_image(j, x, y, comp, req_comp);
+	STBI_FREE(j);
+	STBI_FREE(thumb);
+	return result;
+}
 
-// fast 0..255 * 0..255 => 0..255 rounded multiplication
-static stbi_uc stbi__blinn_8x8(stbi_uc x, stbi_uc y)
+// streaming decode: output rows are handed out as soon as they can be
+// converted, without an output image. a baseline image with a single scan
+// (nearly all of them) is decoded an MCU row at a time into planes that
+// only hold that row, so memory use doesn't depend on the image height.
+// anything else is decoded up front into full planes, which are converted
+// as rows are asked for. stbi_jpeg_stream itself is declared in
+// image_api.h
+struct stbi_jpeg_stream
 {
-	unsigned int t = x * y + 128;
-	return (stbi_uc)((t + (t >> 8)) >> 8);
+	stbi__context s;
+	stbi__jpeg z;
+	stbi__jpeg_output o;
+	stbi__jpeg_rowdec r;
+	stbi_uc *scratch; // one output row, and the byte converters write past it
+};
+
+STBIDEF void stbi_jpeg_stream_close(stbi_jpeg_stream *st)
+{
+	if (st)
+	{
+		stbi__cleanup_jpeg(&st->z);
+		STBI_FREE(st->scratch);
+		STBI_FREE(st);
+	}
 }
 
-static stbi_uc *load_jpeg_image(stbi__jpeg *z, int *out_x, int *out_y, int *comp, int req_comp)
+static stbi_jpeg_stream *stbi__jpeg_stream_open(stbi_jpeg_stream *st, int *x, int *y, int *comp, int req_comp)
 {
-	int n, decode_n, is_rgb;
+	stbi__jpeg *z = &st->z;
+	z->s = &st->s;
 	z->s->img_n = 0; // make stbi__cleanup_jpeg safe
-
-	// validate req_comp
+	st->scratch = NULL;
 	if (req_comp < 0 || req_comp > 4)
-		return stbi__errpuc("bad req_comp", "Internal error");
-
-	// load a jpeg image from whichever source, but leave in YCbCr format
-	if (!stbi__decode_jpeg_image(z))
 	{
-		stbi__cleanup_jpeg(z);
+		STBI_FREE(st);
+		return (stbi_jpeg_stream *)stbi__errpuc("bad req_comp", "Internal error");
+	}
+	stbi__setup_jpeg(z);
+	z->stream = 1;
+	st->o.req_comp = req_comp;
+	st->o.output = NULL;
+	st->o.orient = 0;
+	if (!stbi__decode_jpeg_image(z) || !stbi__jpeg_prepare_resample(z, &st->o))
+	{
+		stbi_jpeg_stream_close(st);
 		return NULL;
 	}
-
-	// determine actual number of components to generate
-	n = req_comp ? req_comp : z->s->img_n >= 3 ? 3
-															 : 1;
-
-	is_rgb = z->s->img_n == 3 && (z->rgb == 3 || (z->app14_color_transform == 0 && !z->jfif));
-
-	if (z->s->img_n == 3 && n < 3 && !is_rgb)
-		decode_n = 1;
-	else
-		decode_n = z->s->img_n;
-
-	// resample and color-convert
+	st->scratch = (stbi_uc *)stbi__malloc_mad2(st->o.n, z->s->img_x, 1);
+	if (!st->scratch)
 	{
-		int k;
-		unsigned int i, j;
-		stbi_uc *output;
-		stbi_uc *coutput[4] = {NULL, NULL, NULL, NULL};
+		stbi_jpeg_stream_close(st);
+		return (stbi_jpeg_stream *)stbi__errpuc("outofmem", "Out of memory");
+	}
+	stbi__jpeg_rowdec_init(&st->r, z, &st->o);
+	*x = z->s->img_x;
+	*y = z->s->img_y;
+	if (comp)
+		*comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
+	return st;
+}
 
-		stbi__resample res_comp[4];
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+	stbi_jpeg_stream *st = (stbi_jpeg_stream *)stbi__malloc(sizeof(stbi_jpeg_stream));
+	if (!st)
+		return (stbi_jpeg_stream *)stbi__errpuc("outofmem", "Out of memory");
+	stbi__start_mem(&st->s, buffer, len);
+	return stbi__jpeg_stream_open(st, x, y, comp, req_comp);
+}
 
-		for (k = 0; k < decode_n; ++k)
-		{
-			stbi__resample *r = &res_comp[k];
+STBIDEF stbi_jpeg_stream *stbi_jpeg_stream_open_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+	stbi_jpeg_stream *st = (stbi_jpeg_stream *)stbi__malloc(sizeof(stbi_jpeg_stream));
+	if (!st)
+		return (stbi_jpeg_stream *)stbi__errpuc("outofmem", "Out of memory");
+	stbi__start_callbacks(&st->s, (stbi_io_callbacks *)clbk, user);
+	return stbi__jpeg_stream_open(st, x, y, comp, req_comp);
+}
 
-			// allocate line buffer big enough for upsampling off the edges
-			// with upsample factor of 4
-			z->img_comp[k].linebuf = (stbi_uc *)stbi__malloc(z->s->img_x + 3);
-			if (!z->img_comp[k].linebuf)
-			{
-				stbi__cleanup_jpeg(z);
-				return stbi__errpuc("outofmem", "Out of memory");
-			}
+// convert up to 'rows' more rows into out, img_x * comp bytes each, with
+// comp the req_comp the stream was opened with (or the file's components
+// if 0). returns the number of rows written, 0 once every row has been
+// read, or -1 if the data is too broken to go on (stbi_failure_reason says
+// why). a call that runs into broken data still returns the rows it wrote
+// before it, and the next call returns -1
+STBIDEF int stbi_jpeg_stream_read_scanlines(stbi_jpeg_stream *st, stbi_uc *out, int rows)
+{
+	int n = stbi__jpeg_rowdec_output(&st->r, out, st->scratch, rows);
+	return n == 0 && st->r.failed ? -1 : n;
+}
 
-			r->hs = z->img_h_max / z->img_comp[k].h;
-			r->vs = z->img_v_max / z->img_comp[k].v;
-			r->ystep = r->vs >> 1;
-			r->w_lores = (z->s->img_x + r->hs - 1) / r->hs;
-			r->ypos = 0;
-			r->line0 = r->line1 = z->img_comp[k].data;
-
-			if (r->hs == 1 && r->vs == 1)
-				r->resample = resample_row_1;
-			else if (r->hs == 1 && r->vs == 2)
-				r->resample = stbi__resample_row_v_2;
-			else if (r->hs == 2 && r->vs == 1)
-				r->resample = stbi__resample_row_h_2;
-			else if (r->hs == 2 && r->vs == 2)
-				r->resample = z->resample_row_hv_2_kernel;
-			else
-				r->resample = stbi__resample_row_generic;
-		}
+// a decoder for one image after another, such as the frames of a Motion
+// JPEG stream or a batch of photos. huffman tables are only rebuilt when a
+// frame defines them differently from the last, and the planes and line
+// buffers a frame frees are kept for the next. frames that leave out their
+// DHT segment, as MJPEG does, are decoded with the standard tables. a
+// decoder is only ever used by one thread at a time. stbi_jpeg_decoder
+// itself is declared in image_api.h
+struct stbi_jpeg_decoder
+{
+	stbi__context s;
+	stbi__jpeg z;
+	int profile; // STBI_JPEG_* for its loads, or -1 for stbi_jpeg_set_profile's
+};
 
-		// can't error after this so, this is safe
-		output = (stbi_uc *)stbi__malloc_mad3(n, z->s->img_x, z->s->img_y, 1);
-		if (!output)
-		{
-			stbi__cleanup_jpeg(z);
-			return stbi__errpuc("outofmem", "Out of memory");
-		}
+STBIDEF stbi_jpeg_decoder *stbi_jpeg_decoder_create(void)
+{
+	stbi_jpeg_decoder *d = (stbi_jpeg_decoder *)stbi__malloc(sizeof(stbi_jpeg_decoder));
+	if (!d)
+		return (stbi_jpeg_decoder *)stbi__errpuc("outofmem", "Out of memory");
+	d->z.s = &d->s;
+	d->s.img_n = 0;
+	stbi__setup_jpeg(&d->z);
+	d->z.keep = 1;
+	d->profile = -1;
+	return d;
+}
 
-		// now go ahead and resample
-		for (j = 0; j < z->s->img_y; ++j)
-		{
-			stbi_uc *out = output + n * z->s->img_x * j;
-			for (k = 0; k < decode_n; ++k)
-			{
-				stbi__resample *r = &res_comp[k];
-				int y_bot = r->ystep >= (r->vs >> 1);
-				coutput[k] = r->resample(z->img_comp[k].linebuf,
-												 y_bot ? r->line1 : r->line0,
-												 y_bot ? r->line0 : r->line1,
-												 r->w_lores, r->hs);
-				if (++r->ystep >= r->vs)
-				{
-					r->ystep = 0;
-					r->line0 = r->line1;
-					if (++r->ypos < z->img_comp[k].y)
-						r->line1 += z->img_comp[k].w2;
-				}
-			}
-			if (n >= 3)
-			{
-				stbi_uc *y = coutput[0];
-				if (z->s->img_n == 3)
-				{
-					if (is_rgb)
-					{
-						for (i = 0; i < z->s->img_x; ++i)
-						{
-							out[0] = y[i];
-							out[1] = coutput[1][i];
-							out[2] = coutput[2][i];
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else
-					{
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else if (z->s->img_n == 4)
-				{
-					if (z->app14_color_transform == 0)
-					{ // CMYK
-						for (i = 0; i < z->s->img_x; ++i)
-						{
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(coutput[0][i], m);
-							out[1] = stbi__blinn_8x8(coutput[1][i], m);
-							out[2] = stbi__blinn_8x8(coutput[2][i], m);
-							out[3] = 255;
-							out += n;
-						}
-					}
-					else if (z->app14_color_transform == 2)
-					{ // YCCK
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-						for (i = 0; i < z->s->img_x; ++i)
-						{
-							stbi_uc m = coutput[3][i];
-							out[0] = stbi__blinn_8x8(255 - out[0], m);
-							out[1] = stbi__blinn_8x8(255 - out[1], m);
-							out[2] = stbi__blinn_8x8(255 - out[2], m);
-							out += n;
-						}
-					}
-					else
-					{ // YCbCr + alpha?  Ignore the fourth channel for now
-						z->YCbCr_to_RGB_kernel(out, y, coutput[1], coutput[2], z->s->img_x, n);
-					}
-				}
-				else
-					for (i = 0; i < z->s->img_x; ++i)
-					{
-						out[0] = out[1] = out[2] = y[i];
-						out[3] = 255; // not used if n==3
-						out += n;
-					}
-			}
-			else
-			{
-				if (is_rgb)
-				{
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i)
-							*out++ = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-					else
-					{
-						for (i = 0; i < z->s->img_x; ++i, out += 2)
-						{
-							out[0] = stbi__compute_y(coutput[0][i], coutput[1][i], coutput[2][i]);
-							out[1] = 255;
-						}
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 0)
-				{
-					for (i = 0; i < z->s->img_x; ++i)
-					{
-						stbi_uc m = coutput[3][i];
-						stbi_uc r = stbi__blinn_8x8(coutput[0][i], m);
-						stbi_uc g = stbi__blinn_8x8(coutput[1][i], m);
-						stbi_uc b = stbi__blinn_8x8(coutput[2][i], m);
-						out[0] = stbi__compute_y(r, g, b);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else if (z->s->img_n == 4 && z->app14_color_transform == 2)
-				{
-					for (i = 0; i < z->s->img_x; ++i)
-					{
-						out[0] = stbi__blinn_8x8(255 - coutput[0][i], coutput[3][i]);
-						out[1] = 255;
-						out += n;
-					}
-				}
-				else
-				{
-					stbi_uc *y = coutput[0];
-					if (n == 1)
-						for (i = 0; i < z->s->img_x; ++i)
-							out[i] = y[i];
-					else
-						for (i = 0; i < z->s->img_x; ++i)
-						{
-							*out++ = y[i];
-							*out++ = 255;
-						}
-				}
-			}
-		}
-		stbi__cleanup_jpeg(z);
-		*out_x = z->s->img_x;
-		*out_y = z->s->img_y;
-		if (comp)
-			*comp = z->s->img_n >= 3 ? 3 : 1; // report original components, not output
-		return output;
+STBIDEF void stbi_jpeg_decoder_free(stbi_jpeg_decoder *d)
+{
+	int i;
+	if (d)
+	{
+		for (i = 0; i < STBI__JPEG_SPARES; ++i)
+			STBI_FREE(d->z.spare[i]);
+		STBI_FREE(d);
 	}
 }
 
-static void *stbi__jpeg_load(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi__result_info *ri)
+// the profile for this decoder's loads, whatever stbi_jpeg_set_profile
+// says, so threads each with their own decoder can use different ones.
+// -1 goes back to following stbi_jpeg_set_profile
+STBIDEF void stbi_jpeg_decoder_set_profile(stbi_jpeg_decoder *d, int profile)
 {
-	unsigned char *result;
-	stbi__jpeg *j = (stbi__jpeg *)stbi__malloc(sizeof(stbi__jpeg));
-	STBI_NOTUSED(ri);
-	j->s = s;
-	stbi__setup_jpeg(j);
-	result = load_jpeg_image(j, x, y, comp, req_comp);
-	STBI_FREE(j);
-	return result;
+	d->profile = profile < 0 ? -1 : stbi__jpeg_clamp_profile(profile);
+}
+
+// decode the image d->s has been pointed at, as stbi__jpeg_load would
+static stbi_uc *stbi__jpeg_decoder_load(stbi_jpeg_decoder *d, int *x, int *y, int *comp, int req_comp)
+{
+	stbi__jpeg_reset_options(&d->z);
+	if (d->profile >= 0)
+		d->z.profile = d->profile;
+	return load_jpeg_image(&d->z, x, y, comp, req_comp);
 }
 
 static int stbi__jpeg_test(stbi__context *s)
@@ -2484,6 +6974,7 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 	int result;
 	stbi__jpeg *j = (stbi__jpeg *)(stbi__malloc(sizeof(stbi__jpeg)));
 	j->s = s;
+	stbi__setup_jpeg(j);
 	result = stbi__jpeg_info_raw(j, x, y, comp);
 	STBI_FREE(j);
 	return result;
@@ -2496,12 +6987,19 @@ static int stbi__jpeg_info(stbi__context *s, int *x, int *y, int *comp)
 //      - all output is written to a single output buffer (can malloc/realloc)
 //    performance
 //      - fast huffman
+//      - most of each block is decoded by a loop with a 64-bit bit buffer
+//        refilled a word at a time, pre-decoded length and distance tables
+//        (two short literals per entry) and wide match copies
 
 #ifndef STBI_NO_ZLIB
 
 // fast-way is faster to check than jpeg huffman, but slow way is slower
 #define STBI__ZFAST_BITS 9 // accelerate all cases in default tables
 #define STBI__ZFAST_MASK ((1 << STBI__ZFAST_BITS) - 1)
+// the fast loop's literal/length table is wider, so that it can hold two
+// short literals in one entry
+#define STBI__ZPAIR_BITS 11
+#define STBI__ZPAIR_MASK ((1 << STBI__ZPAIR_BITS) - 1)
 
 // zlib-style huffman encoding
 // (jpegs packs from left, zlib from right, so can't share code)
@@ -2603,6 +7101,10 @@ typedef struct
 	int z_expandable;
 
 	stbi__zhuffman z_length, z_distance;
+
+	// the current block's fast tables, pre-decoded for
+	// stbi__parse_huffman_block_fast (see stbi__zfast_entry)
+	stbi__uint32 zfast_length[1 << STBI__ZPAIR_BITS], zfast_distance[1 << STBI__ZFAST_BITS];
 } stbi__zbuf;
 
 stbi_inline static int stbi__zeof(stbi__zbuf *z)
@@ -2640,12 +7142,14 @@ stbi_inline static unsigned int stbi__zreceive(stbi__zbuf *z, int n)
 	return k;
 }
 
-static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
+// decode the code at the bottom of 'bits' the slow way, returning the
+// symbol and putting the code's length in *len
+static int stbi__zhuffman_decode_bits(stbi__zhuffman *z, unsigned int bits, int *len)
 {
 	int b, s, k;
 	// not resolved by fast table, so compute it the slow way
 	// use jpeg approach, which requires MSbits at top
-	k = stbi__bit_reverse(a->code_buffer, 16);
+	k = stbi__bit_reverse(bits & 0xffff, 16);
 	for (s = STBI__ZFAST_BITS + 1;; ++s)
 		if (k < z->maxcode[s])
 			break;
@@ -2657,9 +7161,18 @@ static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
 		return -1; // some data was corrupt somewhere!
 	if (z->size[b] != s)
 		return -1; // was originally an assert, but report failure instead.
+	*len = s;
+	return z->value[b];
+}
+
+static int stbi__zhuffman_decode_slowpath(stbi__zbuf *a, stbi__zhuffman *z)
+{
+	int s, v = stbi__zhuffman_decode_bits(z, a->code_buffer, &s);
+	if (v < 0)
+		return -1;
 	a->code_buffer >>= s;
 	a->num_bits -= s;
-	return z->value[b];
+	return v;
 }
 
 stbi_inline static int stbi__zhuffman_decode(stbi__zbuf *a, stbi__zhuffman *z)
@@ -2725,12 +7238,209 @@ static const int stbi__zdist_base[32] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49
 static const int stbi__zdist_extra[32] =
 	 {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
 
+// a fast table entry for a literal/length symbol (distance symbols when
+// 'dist'): (literal << 16) | STBI__ZLITERAL | code length,
+// STBI__ZEND_BLOCK | code length, or for lengths and distances
+// (base << 16) | (extra bits << 4) | code length. an entry of 0 is a code
+// longer than the table, for the slow decoder. in the literal/length
+// table, two literals whose codes fit in it together are one entry,
+// (second << 24) | (first << 16) | STBI__ZLITERAL | STBI__ZPAIR | both
+// codes' length
+#define STBI__ZLITERAL 0x100
+#define STBI__ZEND_BLOCK 0x200
+#define STBI__ZPAIR 0x400
+
+static stbi__uint32 stbi__zfast_entry(int sym, int len, int dist)
+{
+	if (dist)
+		return ((stbi__uint32)stbi__zdist_base[sym] << 16) | (stbi__zdist_extra[sym] << 4) | len;
+	if (sym < 256)
+		return ((stbi__uint32)sym << 16) | STBI__ZLITERAL | len;
+	if (sym == 256)
+		return STBI__ZEND_BLOCK | len;
+	return ((stbi__uint32)stbi__zlength_base[sym - 257] << 16) | (stbi__zlength_extra[sym - 257] << 4) | len;
+}
+
+static void stbi__zbuild_fast(stbi__zbuf *a)
+{
+	int i;
+	for (i = 0; i < (1 << STBI__ZFAST_BITS); ++i)
+	{
+		int d = a->z_distance.fast[i];
+		a->zfast_distance[i] = d ? stbi__zfast_entry(d & 511, d >> 9, 1) : 0;
+	}
+	for (i = 0; i < (1 << STBI__ZPAIR_BITS); ++i)
+	{
+		int b = a->z_length.fast[i & STBI__ZFAST_MASK], s = b >> 9, b2;
+		a->zfast_length[i] = b ? stbi__zfast_entry(b & 511, s, 0) : 0;
+		if (!b || (b & 511) >= 256)
+			continue;
+		b2 = a->z_length.fast[(i >> s) & STBI__ZFAST_MASK];
+		if (b2 && (b2 & 511) < 256 && s + (b2 >> 9) <= STBI__ZPAIR_BITS)
+			a->zfast_length[i] = ((stbi__uint32)(b2 & 511) << 24) | ((stbi__uint32)(b & 511) << 16) | STBI__ZLITERAL | STBI__ZPAIR | (s + (b2 >> 9));
+	}
+}
+
+stbi_inline static stbi__uint64 stbi__zload64(const stbi_uc *p)
+{
+	return (stbi__uint64)p[0] | ((stbi__uint64)p[1] << 8) | ((stbi__uint64)p[2] << 16) | ((stbi__uint64)p[3] << 24) |
+			 ((stbi__uint64)p[4] << 32) | ((stbi__uint64)p[5] << 40) | ((stbi__uint64)p[6] << 48) | ((stbi__uint64)p[7] << 56);
+}
+
+// room the fast loop needs at the end of the output: the longest match,
+// plus what its last 16-byte store can write past it
+#define STBI__ZFAST_MARGIN (258 + 16)
+
+// decode a block while at least a word of input is left and there's room
+// for any match in the output. refilled a word at a time, the 64-bit bit
+// buffer always holds the 48 bits a length/distance pair can take, so no
+// code needs a check for more input. returns 1 at the end of the block, 0
+// on an error, or -1 on getting near the end of either buffer, with the
+// bit buffer given back to a->code_buffer whole bytes and all
+static int stbi__parse_huffman_block_fast(stbi__zbuf *a)
+{
+	stbi_uc *in = a->zbuffer, *in_end = a->zbuffer_end, *out = (stbi_uc *)a->zout;
+	stbi_uc *start = (stbi_uc *)a->zout_start, *out_end = (stbi_uc *)a->zout_end;
+	const stbi__uint32 *lengths = a->zfast_length, *distances = a->zfast_distance;
+	stbi__uint64 bits = a->code_buffer;
+	int nbits = a->num_bits, result = -1;
+	while (in_end - in >= 8 && out_end - out >= STBI__ZFAST_MARGIN)
+	{
+		stbi__uint32 e;
+		stbi_uc *src;
+		int len, dist, s, n;
+		// bits above nbits are the start of the byte the next refill reads
+		// again, so or-ing it back in changes nothing
+		bits |= stbi__zload64(in) << nbits;
+		in += (63 - nbits) >> 3;
+		nbits |= 56;
+
+		e = lengths[bits & STBI__ZPAIR_MASK];
+		if (!e)
+		{
+			int sym = stbi__zhuffman_decode_bits(&a->z_length, (unsigned int)bits, &s);
+			if (sym < 0)
+			{
+				result = stbi__err("bad huffman code", "Corrupt PNG");
+				break;
+			}
+			e = stbi__zfast_entry(sym, s, 0);
+		}
+		if (e & STBI__ZLITERAL)
+		{
+			// a run of literals from the table can go on without a refill
+			// while there are bits for one more entry. both bytes of an
+			// entry are always stored, and the second kept if it's a pair
+			do
+			{
+				bits >>= e & 15;
+				nbits -= e & 15;
+				out[0] = (stbi_uc)(e >> 16);
+				out[1] = (stbi_uc)(e >> 24);
+				out += 1 + ((e / STBI__ZPAIR) & 1);
+				e = lengths[bits & STBI__ZPAIR_MASK];
+			} while ((e & STBI__ZLITERAL) && nbits >= STBI__ZPAIR_BITS);
+			continue;
+		}
+		if (e & STBI__ZEND_BLOCK)
+		{
+			bits >>= e & 15;
+			nbits -= e & 15;
+			result = 1;
+			break;
+		}
+		s = e & 15;
+		n = (e >> 4) & 15;
+		len = (int)(e >> 16) + (int)((bits >> s) & ((1u << n) - 1));
+		bits >>= s + n;
+		nbits -= s + n;
+
+		e = distances[bits & STBI__ZFAST_MASK];
+		if (!e)
+		{
+			int sym = stbi__zhuffman_decode_bits(&a->z_distance, (unsigned int)bits, &s);
+			if (sym < 0)
+			{
+				result = stbi__err("bad huffman code", "Corrupt PNG");
+				break;
+			}
+			e = stbi__zfast_entry(sym, s, 1);
+		}
+		s = e & 15;
+		n = (e >> 4) & 15;
+		dist = (int)(e >> 16) + (int)((bits >> s) & ((1u << n) - 1));
+		bits >>= s + n;
+		nbits -= s + n;
+		if (dist == 0 || out - start < dist)
+		{
+			result = stbi__err("bad dist", "Corrupt PNG");
+			break;
+		}
+
+		// copy in chunks as wide as the distance allows, so a chunk never
+		// reads what it writes; the last one can run past the match
+		src = out - dist;
+		if (dist >= 16)
+		{
+			stbi_uc *end = out + len;
+			do
+			{
+				memcpy(out, src, 16);
+				out += 16;
+				src += 16;
+			} while (out < end);
+			out = end;
+		}
+		else if (dist >= 8)
+		{
+			stbi_uc *end = out + len;
+			do
+			{
+				memcpy(out, src, 8);
+				out += 8;
+				src += 8;
+			} while (out < end);
+			out = end;
+		}
+		else if (dist == 1)
+		{ // run of one byte; common in images.
+			memset(out, *src, len);
+			out += len;
+		}
+		else
+		{
+			// symbols 286 and 287 are lengths of 0
+			for (; len > 0; --len)
+				*out++ = *src++;
+		}
+	}
+	// hand back the whole bytes still in the bit buffer
+	in -= nbits >> 3;
+	nbits &= 7;
+	a->code_buffer = (stbi__uint32)(bits & ((1u << nbits) - 1));
+	a->num_bits = nbits;
+	a->zbuffer = in;
+	a->zout = (char *)out;
+	return result;
+}
+
 static int stbi__parse_huffman_block(stbi__zbuf *a)
 {
 	char *zout = a->zout;
 	for (;;)
 	{
-		int z = stbi__zhuffman_decode(a, &a->z_length);
+		int z;
+		// this loop only takes over near the ends of the input and output
+		if (a->zbuffer_end - a->zbuffer >= 8 && a->zout_end - zout >= STBI__ZFAST_MARGIN)
+		{
+			int r;
+			a->zout = zout;
+			r = stbi__parse_huffman_block_fast(a);
+			if (r >= 0)
+				return r;
+			zout = a->zout;
+		}
+		z = stbi__zhuffman_decode(a, &a->z_length);
 		if (z < 256)
 		{
 			if (z < 0)
@@ -2762,7 +7472,8 @@ static int stbi__parse_huffman_block(stbi__zbuf *a)
 			dist = stbi__zdist_base[z];
 			if (stbi__zdist_extra[z])
 				dist += stbi__zreceive(a, stbi__zdist_extra[z]);
-			if (zout - a->zout_start < dist)
+			// distance symbols 30 and 31 don't occur, and have no distance
+			if (dist == 0 || zout - a->zout_start < dist)
 				return stbi__err("bad dist", "Corrupt PNG");
 			if (zout + len > a->zout_end)
 			{
@@ -2976,6 +7687,7 @@ static int stbi__parse_zlib(stbi__zbuf *a, int parse_header)
 				if (!stbi__compute_huffman_codes(a))
 					return 0;
 			}
+			stbi__zbuild_fast(a);
 			if (!stbi__parse_huffman_block(a))
 				return 0;
 		}
@@ -1,6 +1,56 @@
 static const unsigned char stbiw__jpg_ZigZag[] = {0, 1, 5, 6, 14, 15, 27, 28, 2, 4, 7, 13, 16, 26, 29, 42, 3, 8, 12, 17, 25, 30, 41, 43, 9, 11, 18,
 																  24, 31, 40, 44, 53, 10, 19, 23, 32, 39, 45, 52, 54, 20, 22, 33, 38, 46, 51, 55, 60, 21, 34, 37, 47, 50, 56, 59, 61, 35, 36, 48, 49, 57, 58, 62, 63};
 
+// the standard Huffman tables (JPEG spec K.3), which stbi_write_jpg writes with
+static const unsigned char stbiw__jpg_std_dc_luminance_nrcodes[] = {0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
+static const unsigned char stbiw__jpg_std_dc_luminance_values[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const unsigned char stbiw__jpg_std_ac_luminance_nrcodes[] = {0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
+static const unsigned char stbiw__jpg_std_ac_luminance_values[] = {
+	 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
+	 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+	 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
+	 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+	 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
+	 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+	 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+static const unsigned char stbiw__jpg_std_dc_chrominance_nrcodes[] = {0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
+static const unsigned char stbiw__jpg_std_dc_chrominance_values[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
+static const unsigned char stbiw__jpg_std_ac_chrominance_nrcodes[] = {0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
+static const unsigned char stbiw__jpg_std_ac_chrominance_values[] = {
+	 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
+	 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+	 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
+	 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+	 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
+	 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+	 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
+// and their codes, as {code, length} for each symbol
+static const unsigned short stbiw__jpg_YDC_HT[256][2] = {{0, 2}, {2, 3}, {3, 3}, {4, 3}, {5, 3}, {6, 3}, {14, 4}, {30, 5}, {62, 6}, {126, 7}, {254, 8}, {510, 9}};
+static const unsigned short stbiw__jpg_UVDC_HT[256][2] = {{0, 2}, {1, 2}, {2, 2}, {6, 3}, {14, 4}, {30, 5}, {62, 6}, {126, 7}, {254, 8}, {510, 9}, {1022, 10}, {2046, 11}};
+static const unsigned short stbiw__jpg_YAC_HT[256][2] = {
+	 {10, 4}, {0, 2}, {1, 2}, {4, 3}, {11, 4}, {26, 5}, {120, 7}, {248, 8}, {1014, 10}, {65410, 16}, {65411, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {12, 4}, {27, 5}, {121, 7}, {502, 9}, {2038, 11}, {65412, 16}, {65413, 16}, {65414, 16}, {65415, 16}, {65416, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {28, 5}, {249, 8}, {1015, 10}, {4084, 12}, {65417, 16}, {65418, 16}, {65419, 16}, {65420, 16}, {65421, 16}, {65422, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {58, 6}, {503, 9}, {4085, 12}, {65423, 16}, {65424, 16}, {65425, 16}, {65426, 16}, {65427, 16}, {65428, 16}, {65429, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {59, 6}, {1016, 10}, {65430, 16}, {65431, 16}, {65432, 16}, {65433, 16}, {65434, 16}, {65435, 16}, {65436, 16}, {65437, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {122, 7}, {2039, 11}, {65438, 16}, {65439, 16}, {65440, 16}, {65441, 16}, {65442, 16}, {65443, 16}, {65444, 16}, {65445, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {123, 7}, {4086, 12}, {65446, 16}, {65447, 16}, {65448, 16}, {65449, 16}, {65450, 16}, {65451, 16}, {65452, 16}, {65453, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {250, 8}, {4087, 12}, {65454, 16}, {65455, 16}, {65456, 16}, {65457, 16}, {65458, 16}, {65459, 16}, {65460, 16}, {65461, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {504, 9}, {32704, 15}, {65462, 16}, {65463, 16}, {65464, 16}, {65465, 16}, {65466, 16}, {65467, 16}, {65468, 16}, {65469, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {505, 9}, {65470, 16}, {65471, 16}, {65472, 16}, {65473, 16}, {65474, 16}, {65475, 16}, {65476, 16}, {65477, 16}, {65478, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {506, 9}, {65479, 16}, {65480, 16}, {65481, 16}, {65482, 16}, {65483, 16}, {65484, 16}, {65485, 16}, {65486, 16}, {65487, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {1017, 10}, {65488, 16}, {65489, 16}, {65490, 16}, {65491, 16}, {65492, 16}, {65493, 16}, {65494, 16}, {65495, 16}, {65496, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {1018, 10}, {65497, 16}, {65498, 16}, {65499, 16}, {65500, 16}, {65501, 16}, {65502, 16}, {65503, 16}, {65504, 16}, {65505, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {2040, 11}, {65506, 16}, {65507, 16}, {65508, 16}, {65509, 16}, {65510, 16}, {65511, 16}, {65512, 16}, {65513, 16}, {65514, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {65515, 16}, {65516, 16}, {65517, 16}, {65518, 16}, {65519, 16}, {65520, 16}, {65521, 16}, {65522, 16}, {65523, 16}, {65524, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {2041, 11}, {65525, 16}, {65526, 16}, {65527, 16}, {65528, 16}, {65529, 16}, {65530, 16}, {65531, 16}, {65532, 16}, {65533, 16}, {65534, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}};
+static const unsigned short stbiw__jpg_UVAC_HT[256][2] = {
+	 {0, 2}, {1, 2}, {4, 3}, {10, 4}, {24, 5}, {25, 5}, {56, 6}, {120, 7}, {500, 9}, {1014, 10}, {4084, 12}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {11, 4}, {57, 6}, {246, 8}, {501, 9}, {2038, 11}, {4085, 12}, {65416, 16}, {65417, 16}, {65418, 16}, {65419, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {26, 5}, {247, 8}, {1015, 10}, {4086, 12}, {32706, 15}, {65420, 16}, {65421, 16}, {65422, 16}, {65423, 16}, {65424, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {27, 5}, {248, 8}, {1016, 10}, {4087, 12}, {65425, 16}, {65426, 16}, {65427, 16}, {65428, 16}, {65429, 16}, {65430, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {58, 6}, {502, 9}, {65431, 16}, {65432, 16}, {65433, 16}, {65434, 16}, {65435, 16}, {65436, 16}, {65437, 16}, {65438, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {59, 6}, {1017, 10}, {65439, 16}, {65440, 16}, {65441, 16}, {65442, 16}, {65443, 16}, {65444, 16}, {65445, 16}, {65446, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {121, 7}, {2039, 11}, {65447, 16}, {65448, 16}, {65449, 16}, {65450, 16}, {65451, 16}, {65452, 16}, {65453, 16}, {65454, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {122, 7}, {2040, 11}, {65455, 16}, {65456, 16}, {65457, 16}, {65458, 16}, {65459, 16}, {65460, 16}, {65461, 16}, {65462, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {249, 8}, {65463, 16}, {65464, 16}, {65465, 16}, {65466, 16}, {65467, 16}, {65468, 16}, {65469, 16}, {65470, 16}, {65471, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {503, 9}, {65472, 16}, {65473, 16}, {65474, 16}, {65475, 16}, {65476, 16}, {65477, 16}, {65478, 16}, {65479, 16}, {65480, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {504, 9}, {65481, 16}, {65482, 16}, {65483, 16}, {65484, 16}, {65485, 16}, {65486, 16}, {65487, 16}, {65488, 16}, {65489, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {505, 9}, {65490, 16}, {65491, 16}, {65492, 16}, {65493, 16}, {65494, 16}, {65495, 16}, {65496, 16}, {65497, 16}, {65498, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {506, 9}, {65499, 16}, {65500, 16}, {65501, 16}, {65502, 16}, {65503, 16}, {65504, 16}, {65505, 16}, {65506, 16}, {65507, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {2041, 11}, {65508, 16}, {65509, 16}, {65510, 16}, {65511, 16}, {65512, 16}, {65513, 16}, {65514, 16}, {65515, 16}, {65516, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {16352, 14}, {65517, 16}, {65518, 16}, {65519, 16}, {65520, 16}, {65521, 16}, {65522, 16}, {65523, 16}, {65524, 16}, {65525, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {1018, 10}, {32707, 15}, {65526, 16}, {65527, 16}, {65528, 16}, {65529, 16}, {65530, 16}, {65531, 16}, {65532, 16}, {65533, 16}, {65534, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}};
+
+// the DHT segment with all four standard tables: luminance DC and AC as
+// tables 0, chrominance as tables 1
+static void stbiw__jpg_writeHuffmanTables(stbi__write_context *s)
+{
+	static const unsigned char head[] = {0xFF, 0xC4, 0x01, 0xA2, 0};
+	s->func(s->context, (void *)head, sizeof(head));
+	s->func(s->context, (void *)(stbiw__jpg_std_dc_luminance_nrcodes + 1), sizeof(stbiw__jpg_std_dc_luminance_nrcodes) - 1);
+	s->func(s->context, (void *)stbiw__jpg_std_dc_luminance_values, sizeof(stbiw__jpg_std_dc_luminance_values));
+	stbiw__putc(s, 0x10); // HTYACinfo
+	s->func(s->context, (void *)(stbiw__jpg_std_ac_luminance_nrcodes + 1), sizeof(stbiw__jpg_std_ac_luminance_nrcodes) - 1);
+	s->func(s->context, (void *)stbiw__jpg_std_ac_luminance_values, sizeof(stbiw__jpg_std_ac_luminance_values));
+	stbiw__putc(s, 1); // HTUDCinfo
+	s->func(s->context, (void *)(stbiw__jpg_std_dc_chrominance_nrcodes + 1), sizeof(stbiw__jpg_std_dc_chrominance_nrcodes) - 1);
+	s->func(s->context, (void *)stbiw__jpg_std_dc_chrominance_values, sizeof(stbiw__jpg_std_dc_chrominance_values));
+	stbiw__putc(s, 0x11); // HTUACinfo
+	s->func(s->context, (void *)(stbiw__jpg_std_ac_chrominance_nrcodes + 1), sizeof(stbiw__jpg_std_ac_chrominance_nrcodes) - 1);
+	s->func(s->context, (void *)stbiw__jpg_std_ac_chrominance_values, sizeof(stbiw__jpg_std_ac_chrominance_values));
+}
+
 static void stbiw__jpg_writeBits(stbi__write_context *s, int *bitBufP, int *bitCntP, const unsigned short *bs)
 {
 	int bitBuf = *bitBufP, bitCnt = *bitCntP;
@@ -85,37 +135,13 @@ static void stbiw__jpg_calcBits(int val, unsigned short bits[2])
 	bits[0] = val & ((1 << bits[1]) - 1);
 }
 
-static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2])
+// huffman code one block's quantized coefficients, in zigzag order,
+// against the previous block's DC. returns this block's DC
+static int stbiw__jpg_encodeDU(stbi__write_context *s, int *bitBuf, int *bitCnt, const int *DU, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2])
 {
 	const unsigned short EOB[2] = {HTAC[0x00][0], HTAC[0x00][1]};
 	const unsigned short M16zeroes[2] = {HTAC[0xF0][0], HTAC[0xF0][1]};
-	int dataOff, i, j, n, diff, end0pos, x, y;
-	int DU[64];
-
-	// DCT rows
-	for (dataOff = 0, n = du_stride * 8; dataOff < n; dataOff += du_stride)
-	{
-		stbiw__jpg_DCT(&CDU[dataOff], &CDU[dataOff + 1], &CDU[dataOff + 2], &CDU[dataOff + 3], &CDU[dataOff + 4], &CDU[dataOff + 5], &CDU[dataOff + 6], &CDU[dataOff + 7]);
-	}
-	// DCT columns
-	for (dataOff = 0; dataOff < 8; ++dataOff)
-	{
-		stbiw__jpg_DCT(&CDU[dataOff], &CDU[dataOff + du_stride], &CDU[dataOff + du_stride * 2], &CDU[dataOff + du_stride * 3], &CDU[dataOff + du_stride * 4],
-							&CDU[dataOff + du_stride * 5], &CDU[dataOff + du_stride * 6], &CDU[dataOff + du_stride * 7]);
-	}
-	// Quantize/descale/zigzag the coefficients
-	for (y = 0, j = 0; y < 8; ++y)
-	{
-		for (x = 0; x < 8; ++x, ++j)
-		{
-			float v;
-			i = y * du_stride + x;
-			v = CDU[i] * fdtbl[j];
-			// DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? ceilf(v - 0.5f) : floorf(v + 0.5f));
-			// ceilf() and floorf() are C99, not C89, but I /think/ they're not needed here anyway?
-			DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
-		}
-	}
+	int i, diff, end0pos;
 
 	// Encode DC
 	diff = DU[0] - DC;
@@ -169,38 +195,41 @@ static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt
 	return DU[0];
 }
 
+static int stbiw__jpg_processDU(stbi__write_context *s, int *bitBuf, int *bitCnt, float *CDU, int du_stride, float *fdtbl, int DC, const unsigned short HTDC[256][2], const unsigned short HTAC[256][2])
+{
+	int dataOff, i, j, n, x, y;
+	int DU[64];
+
+	// DCT rows
+	for (dataOff = 0, n = du_stride * 8; dataOff < n; dataOff += du_stride)
+	{
+		stbiw__jpg_DCT(&CDU[dataOff], &CDU[dataOff + 1], &CDU[dataOff + 2], &CDU[dataOff + 3], &CDU[dataOff + 4], &CDU[dataOff + 5], &CDU[dataOff + 6], &CDU[dataOff + 7]);
+	}
+	// DCT columns
+	for (dataOff = 0; dataOff < 8; ++dataOff)
+	{
+		stbiw__jpg_DCT(&CDU[dataOff], &CDU[dataOff + du_stride], &CDU[dataOff + du_stride * 2], &CDU[dataOff + du_stride * 3], &CDU[dataOff + du_stride * 4],
+							&CDU[dataOff + du_stride * 5], &CDU[dataOff + du_stride * 6], &CDU[dataOff + du_stride * 7]);
+	}
+	// Quantize/descale/zigzag the coefficients
+	for (y = 0, j = 0; y < 8; ++y)
+	{
+		for (x = 0; x < 8; ++x, ++j)
+		{
+			float v;
+			i = y * du_stride + x;
+			v = CDU[i] * fdtbl[j];
+			// DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? ceilf(v - 0.5f) : floorf(v + 0.5f));
+			// ceilf() and floorf() are C99, not C89, but I /think/ they're not needed here anyway?
+			DU[stbiw__jpg_ZigZag[j]] = (int)(v < 0 ? v - 0.5f : v + 0.5f);
+		}
+	}
+
+	return stbiw__jpg_encodeDU(s, bitBuf, bitCnt, DU, DC, HTDC, HTAC);
+}
+
 static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, int comp, const void *data, int quality)
 {
-	// Constants that don't pollute global namespace
-	static const unsigned char std_dc_luminance_nrcodes[] = {0, 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0};
-	static const unsigned char std_dc_luminance_values[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
-	static const unsigned char std_ac_luminance_nrcodes[] = {0, 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d};
-	static const unsigned char std_ac_luminance_values[] = {
-		 0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07, 0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08,
-		 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0, 0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
-		 0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59,
-		 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
-		 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6,
-		 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
-		 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
-	static const unsigned char std_dc_chrominance_nrcodes[] = {0, 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0};
-	static const unsigned char std_dc_chrominance_values[] = {0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11};
-	static const unsigned char std_ac_chrominance_nrcodes[] = {0, 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77};
-	static const unsigned char std_ac_chrominance_values[] = {
-		 0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71, 0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91,
-		 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0, 0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
-		 0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58,
-		 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
-		 0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4,
-		 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
-		 0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8, 0xf9, 0xfa};
-	// Huffman tables
-	static const unsigned short YDC_HT[256][2] = {{0, 2}, {2, 3}, {3, 3}, {4, 3}, {5, 3}, {6, 3}, {14, 4}, {30, 5}, {62, 6}, {126, 7}, {254, 8}, {510, 9}};
-	static const unsigned short UVDC_HT[256][2] = {{0, 2}, {1, 2}, {2, 2}, {6, 3}, {14, 4}, {30, 5}, {62, 6}, {126, 7}, {254, 8}, {510, 9}, {1022, 10}, {2046, 11}};
-	static const unsigned short YAC_HT[256][2] = {
-		 {10, 4}, {0, 2}, {1, 2}, {4, 3}, {11, 4}, {26, 5}, {120, 7}, {248, 8}, {1014, 10}, {65410, 16}, {65411, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {12, 4}, {27, 5}, {121, 7}, {502, 9}, {2038, 11}, {65412, 16}, {65413, 16}, {65414, 16}, {65415, 16}, {65416, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {28, 5}, {249, 8}, {1015, 10}, {4084, 12}, {65417, 16}, {65418, 16}, {65419, 16}, {65420, 16}, {65421, 16}, {65422, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {58, 6}, {503, 9}, {4085, 12}, {65423, 16}, {65424, 16}, {65425, 16}, {65426, 16}, {65427, 16}, {65428, 16}, {65429, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {59, 6}, {1016, 10}, {65430, 16}, {65431, 16}, {65432, 16}, {65433, 16}, {65434, 16}, {65435, 16}, {65436, 16}, {65437, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {122, 7}, {2039, 11}, {65438, 16}, {65439, 16}, {65440, 16}, {65441, 16}, {65442, 16}, {65443, 16}, {65444, 16}, {65445, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {123, 7}, {4086, 12}, {65446, 16}, {65447, 16}, {65448, 16}, {65449, 16}, {65450, 16}, {65451, 16}, {65452, 16}, {65453, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {250, 8}, {4087, 12}, {65454, 16}, {65455, 16}, {65456, 16}, {65457, 16}, {65458, 16}, {65459, 16}, {65460, 16}, {65461, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {504, 9}, {32704, 15}, {65462, 16}, {65463, 16}, {65464, 16}, {65465, 16}, {65466, 16}, {65467, 16}, {65468, 16}, {65469, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {505, 9}, {65470, 16}, {65471, 16}, {65472, 16}, {65473, 16}, {65474, 16}, {65475, 16}, {65476, 16}, {65477, 16}, {65478, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {506, 9}, {65479, 16}, {65480, 16}, {65481, 16}, {65482, 16}, {65483, 16}, {65484, 16}, {65485, 16}, {65486, 16}, {65487, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {1017, 10}, {65488, 16}, {65489, 16}, {65490, 16}, {65491, 16}, {65492, 16}, {65493, 16}, {65494, 16}, {65495, 16}, {65496, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {1018, 10}, {65497, 16}, {65498, 16}, {65499, 16}, {65500, 16}, {65501, 16}, {65502, 16}, {65503, 16}, {65504, 16}, {65505, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {2040, 11}, {65506, 16}, {65507, 16}, {65508, 16}, {65509, 16}, {65510, 16}, {65511, 16}, {65512, 16}, {65513, 16}, {65514, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {65515, 16}, {65516, 16}, {65517, 16}, {65518, 16}, {65519, 16}, {65520, 16}, {65521, 16}, {65522, 16}, {65523, 16}, {65524, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {2041, 11}, {65525, 16}, {65526, 16}, {65527, 16}, {65528, 16}, {65529, 16}, {65530, 16}, {65531, 16}, {65532, 16}, {65533, 16}, {65534, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}};
-	static const unsigned short UVAC_HT[256][2] = {
-		 {0, 2}, {1, 2}, {4, 3}, {10, 4}, {24, 5}, {25, 5}, {56, 6}, {120, 7}, {500, 9}, {1014, 10}, {4084, 12}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {11, 4}, {57, 6}, {246, 8}, {501, 9}, {2038, 11}, {4085, 12}, {65416, 16}, {65417, 16}, {65418, 16}, {65419, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {26, 5}, {247, 8}, {1015, 10}, {4086, 12}, {32706, 15}, {65420, 16}, {65421, 16}, {65422, 16}, {65423, 16}, {65424, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {27, 5}, {248, 8}, {1016, 10}, {4087, 12}, {65425, 16}, {65426, 16}, {65427, 16}, {65428, 16}, {65429, 16}, {65430, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {58, 6}, {502, 9}, {65431, 16}, {65432, 16}, {65433, 16}, {65434, 16}, {65435, 16}, {65436, 16}, {65437, 16}, {65438, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {59, 6}, {1017, 10}, {65439, 16}, {65440, 16}, {65441, 16}, {65442, 16}, {65443, 16}, {65444, 16}, {65445, 16}, {65446, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {121, 7}, {2039, 11}, {65447, 16}, {65448, 16}, {65449, 16}, {65450, 16}, {65451, 16}, {65452, 16}, {65453, 16}, {65454, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {122, 7}, {2040, 11}, {65455, 16}, {65456, 16}, {65457, 16}, {65458, 16}, {65459, 16}, {65460, 16}, {65461, 16}, {65462, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {249, 8}, {65463, 16}, {65464, 16}, {65465, 16}, {65466, 16}, {65467, 16}, {65468, 16}, {65469, 16}, {65470, 16}, {65471, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {503, 9}, {65472, 16}, {65473, 16}, {65474, 16}, {65475, 16}, {65476, 16}, {65477, 16}, {65478, 16}, {65479, 16}, {65480, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {504, 9}, {65481, 16}, {65482, 16}, {65483, 16}, {65484, 16}, {65485, 16}, {65486, 16}, {65487, 16}, {65488, 16}, {65489, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {505, 9}, {65490, 16}, {65491, 16}, {65492, 16}, {65493, 16}, {65494, 16}, {65495, 16}, {65496, 16}, {65497, 16}, {65498, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {506, 9}, {65499, 16}, {65500, 16}, {65501, 16}, {65502, 16}, {65503, 16}, {65504, 16}, {65505, 16}, {65506, 16}, {65507, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {2041, 11}, {65508, 16}, {65509, 16}, {65510, 16}, {65511, 16}, {65512, 16}, {65513, 16}, {65514, 16}, {65515, 16}, {65516, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {16352, 14}, {65517, 16}, {65518, 16}, {65519, 16}, {65520, 16}, {65521, 16}, {65522, 16}, {65523, 16}, {65524, 16}, {65525, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {1018, 10}, {32707, 15}, {65526, 16}, {65527, 16}, {65528, 16}, {65529, 16}, {65530, 16}, {65531, 16}, {65532, 16}, {65533, 16}, {65534, 16}, {0, 0}, {0, 0}, {0, 0}, {0, 0}, {0, 0}};
 	static const int YQT[] = {16, 11, 10, 16, 24, 40, 51, 61, 12, 12, 14, 19, 26, 58, 60, 55, 14, 13, 16, 24, 40, 57, 69, 56, 14, 17, 22, 29, 51, 87, 80, 62, 18, 22,
 									  37, 56, 68, 109, 103, 77, 24, 35, 55, 64, 81, 104, 113, 92, 49, 64, 78, 87, 103, 121, 120, 101, 72, 92, 95, 98, 112, 100, 103, 99};
 	static const int UVQT[] = {17, 18, 24, 47, 99, 99, 99, 99, 18, 21, 26, 66, 99, 99, 99, 99, 24, 26, 56, 99, 99, 99, 99, 99, 47, 66, 99, 99, 99, 99, 99, 99,
@@ -247,23 +276,13 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 		static const unsigned char head0[] = {0xFF, 0xD8, 0xFF, 0xE0, 0, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0, 0xFF, 0xDB, 0, 0x84, 0};
 		static const unsigned char head2[] = {0xFF, 0xDA, 0, 0xC, 3, 1, 0, 2, 0x11, 3, 0x11, 0, 0x3F, 0};
 		const unsigned char head1[] = {0xFF, 0xC0, 0, 0x11, 8, (unsigned char)(height >> 8), STBIW_UCHAR(height), (unsigned char)(width >> 8), STBIW_UCHAR(width),
-												 3, 1, (unsigned char)(subsample ? 0x22 : 0x11), 0, 2, 0x11, 1, 3, 0x11, 1, 0xFF, 0xC4, 0x01, 0xA2, 0};
+												 3, 1, (unsigned char)(subsample ? 0x22 : 0x11), 0, 2, 0x11, 1, 3, 0x11, 1};
 		s->func(s->context, (void *)head0, sizeof(head0));
 		s->func(s->context, (void *)YTable, sizeof(YTable));
 		stbiw__putc(s, 1);
 		s->func(s->context, UVTable, sizeof(UVTable));
 		s->func(s->context, (void *)head1, sizeof(head1));
-		s->func(s->context, (void *)(std_dc_luminance_nrcodes + 1), sizeof(std_dc_luminance_nrcodes) - 1);
-		s->func(s->context, (void *)std_dc_luminance_values, sizeof(std_dc_luminance_values));
-		stbiw__putc(s, 0x10); // HTYACinfo
-		s->func(s->context, (void *)(std_ac_luminance_nrcodes + 1), sizeof(std_ac_luminance_nrcodes) - 1);
-		s->func(s->context, (void *)std_ac_luminance_values, sizeof(std_ac_luminance_values));
-		stbiw__putc(s, 1); // HTUDCinfo
-		s->func(s->context, (void *)(std_dc_chrominance_nrcodes + 1), sizeof(std_dc_chrominance_nrcodes) - 1);
-		s->func(s->context, (void *)std_dc_chrominance_values, sizeof(std_dc_chrominance_values));
-		stbiw__putc(s, 0x11); // HTUACinfo
-		s->func(s->context, (void *)(std_ac_chrominance_nrcodes + 1), sizeof(std_ac_chrominance_nrcodes) - 1);
-		s->func(s->context, (void *)std_ac_chrominance_values, sizeof(std_ac_chrominance_values));
+		stbiw__jpg_writeHuffmanTables(s);
 		s->func(s->context, (void *)head2, sizeof(head2));
 	}
 
@@ -300,10 +319,10 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 							V[pos] = +0.50000f * r - 0.41869f * g - 0.08131f * b;
 						}
 					}
-					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 0, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 8, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 128, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 136, 16, fdtbl_Y, DCY, YDC_HT, YAC_HT);
+					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 0, 16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 8, 16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 128, 16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y + 136, 16, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
 
 					// subsample U,V
 					{
@@ -318,8 +337,8 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 								subV[pos] = (V[j + 0] + V[j + 1] + V[j + 16] + V[j + 17]) * 0.25f;
 							}
 						}
-						DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-						DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+						DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subU, 8, fdtbl_UV, DCU, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
+						DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, subV, 8, fdtbl_UV, DCV, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
 					}
 				}
 			}
@@ -347,9 +366,9 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 						}
 					}
 
-					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y, DCY, YDC_HT, YAC_HT);
-					DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, UVDC_HT, UVAC_HT);
-					DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, UVDC_HT, UVAC_HT);
+					DCY = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, Y, 8, fdtbl_Y, DCY, stbiw__jpg_YDC_HT, stbiw__jpg_YAC_HT);
+					DCU = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, U, 8, fdtbl_UV, DCU, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
+					DCV = stbiw__jpg_processDU(s, &bitBuf, &bitCnt, V, 8, fdtbl_UV, DCV, stbiw__jpg_UVDC_HT, stbiw__jpg_UVAC_HT);
 				}
 			}
 		}
@@ -365,6 +384,529 @@ static int stbi_write_jpg_core(stbi__write_context *s, int width, int height, in
 	return 1;
 }
 
+// where the blocks of a transformed, cropped image come from
+typedef struct
+{
+	const stbi_jpeg_coefficients *c;
+	int transpose, flipx, flipy;
+	int hs[4], vs[4], bx0[4], by0[4];
+	int ow, oh, ohmax, ovmax, mcu_x, mcu_y;
+} stbiw__jpg_xform;
+
+// component k's size in output blocks: whole MCUs for an interleaved scan,
+// just the blocks the image covers for a scan of k on its own
+static void stbiw__jpg_xformBlocks(const stbiw__jpg_xform *t, int k, int interleaved, int *bw, int *bh)
+{
+	int oh_k = t->transpose ? t->vs[k] : t->hs[k], ov_k = t->transpose ? t->hs[k] : t->vs[k];
+	*bw = interleaved ? t->mcu_x * oh_k : (t->ow * oh_k + 8 * t->ohmax - 1) / (8 * t->ohmax);
+	*bh = interleaved ? t->mcu_y * ov_k : (t->oh * ov_k + 8 * t->ovmax - 1) / (8 * t->ovmax);
+}
+
+// output block (bx,by) of component k, in zigzag order. returns 0 if a
+// coefficient is out of the range the huffman codes can carry, as clamping
+// it would no longer be lossless
+static int stbiw__jpg_xformBlock(const stbiw__jpg_xform *t, int k, int bx, int by, int *DU)
+{
+	static const short zero[64] = {0};
+	const stbi_jpeg_coefficients *c = t->c;
+	int obw, obh, sx, sy, m;
+	const short *b;
+	stbiw__jpg_xformBlocks(t, k, 1, &obw, &obh);
+	// undo the flips, then the transpose, to find the block this one
+	// comes from
+	if (t->flipx)
+		bx = obw - 1 - bx;
+	if (t->flipy)
+		by = obh - 1 - by;
+	sx = t->bx0[k] + (t->transpose ? by : bx);
+	sy = t->by0[k] + (t->transpose ? bx : by);
+	b = sx < c->blocks_w[k] && sy < c->blocks_h[k] ? c->coeff[k] + 64 * (sx + sy * c->blocks_w[k]) : zero;
+	for (m = 0; m < 64; ++m)
+	{
+		// output frequency (fu,fv) is (fv,fu) in a transposed block, and
+		// the odd ones change sign when flipped
+		int fu = m & 7, fv = m >> 3;
+		int q = b[t->transpose ? fu * 8 + fv : m];
+		if ((t->flipx && (fu & 1)) ^ (t->flipy && (fv & 1)))
+			q = -q;
+		// the huffman codes only go up to 8-bit baseline's ranges
+		if (q < (m ? -1023 : -1024) || q > 1023)
+			return 0;
+		DU[stbiw__jpg_ZigZag[m]] = q;
+	}
+	return 1;
+}
+
+// check every block the output takes before anything is written
+static int stbiw__jpg_xformCheck(const stbiw__jpg_xform *t)
+{
+	int DU[64], i, j, k, bw, bh;
+	for (k = 0; k < t->c->n; ++k)
+	{
+		stbiw__jpg_xformBlocks(t, k, 1, &bw, &bh);
+		for (j = 0; j < bh; ++j)
+			for (i = 0; i < bw; ++i)
+				if (!stbiw__jpg_xformBlock(t, k, i, j, DU))
+					return 0;
+	}
+	return 1;
+}
+
+// the entropy coder for re-encoding coefficients. on a statistics pass
+// ('counting' set) symbols are only counted into freq, otherwise they're
+// written with the codes in HT
+typedef struct
+{
+	stbi__write_context *s;
+	int bitBuf, bitCnt, counting, eobrun;
+	unsigned int *freq;
+	unsigned short (*HT)[2];
+} stbiw__jpg_coder;
+
+static void stbiw__jpg_codeSymbol(stbiw__jpg_coder *e, int sym, int val, int len)
+{
+	if (e->counting)
+	{
+		++e->freq[sym];
+		return;
+	}
+	stbiw__jpg_writeBits(e->s, &e->bitBuf, &e->bitCnt, e->HT[sym]);
+	if (len)
+	{
+		unsigned short bits[2];
+		bits[0] = (unsigned short)(val & ((1 << len) - 1));
+		bits[1] = (unsigned short)len;
+		stbiw__jpg_writeBits(e->s, &e->bitBuf, &e->bitCnt, bits);
+	}
+}
+
+// end a run of blocks that have nothing left in the band. a run of one is
+// the plain EOB
+static void stbiw__jpg_codeEOBRun(stbiw__jpg_coder *e)
+{
+	if (e->eobrun)
+	{
+		int n = 0;
+		while (e->eobrun >> (n + 1))
+			++n;
+		stbiw__jpg_codeSymbol(e, n << 4, e->eobrun, n);
+		e->eobrun = 0;
+	}
+}
+
+// code the band ss..se (zigzag) of one block's ACs. a sequential scan
+// ends each block with its own EOB, a progressive one runs them together
+static void stbiw__jpg_codeBand(stbiw__jpg_coder *e, const int *DU, int ss, int se, int progressive)
+{
+	int k, r = 0;
+	for (k = ss; k <= se; ++k)
+	{
+		unsigned short bits[2];
+		if (DU[k] == 0)
+		{
+			++r;
+			continue;
+		}
+		stbiw__jpg_codeEOBRun(e);
+		for (; r > 15; r -= 16)
+			stbiw__jpg_codeSymbol(e, 0xF0, 0, 0);
+		stbiw__jpg_calcBits(DU[k], bits);
+		stbiw__jpg_codeSymbol(e, (r << 4) + bits[1], bits[0], bits[1]);
+		r = 0;
+	}
+	if (r > 0 && (++e->eobrun == 0x7FFF || !progressive))
+		stbiw__jpg_codeEOBRun(e);
+}
+
+// code one block's part of a scan. component 0 uses tables 0 and the rest
+// tables 1; freq and HT hold DC tables 0 and 1, then AC tables 0 and 1
+static void stbiw__jpg_codeBlock(stbiw__jpg_coder *e, const int *DU, int k, int ss, int se, int progressive, int *DC, unsigned int freq[4][257], unsigned short HT[4][256][2])
+{
+	int tbl = k ? 1 : 0;
+	if (ss == 0)
+	{
+		int diff = DU[0] - DC[k];
+		e->freq = freq[tbl];
+		e->HT = HT[tbl];
+		if (diff == 0)
+		{
+			stbiw__jpg_codeSymbol(e, 0, 0, 0);
+		}
+		else
+		{
+			unsigned short bits[2];
+			stbiw__jpg_calcBits(diff, bits);
+			stbiw__jpg_codeSymbol(e, bits[1], bits[0], bits[1]);
+		}
+		DC[k] = DU[0];
+		ss = 1;
+	}
+	if (se >= ss)
+	{
+		e->freq = freq[2 + tbl];
+		e->HT = HT[2 + tbl];
+		stbiw__jpg_codeBand(e, DU, ss, se, progressive);
+	}
+}
+
+// code the band ss..se of component comp, or of all the components
+// interleaved an MCU at a time if comp < 0
+static void stbiw__jpg_codeScan(stbiw__jpg_coder *e, const stbiw__jpg_xform *t, int comp, int ss, int se, int progressive, unsigned int freq[4][257], unsigned short HT[4][256][2])
+{
+	int DC[4] = {0, 0, 0, 0}, DU[64], i, j, k, u, v, bw, bh;
+	e->eobrun = 0;
+	if (comp < 0 && t->c->n > 1)
+	{
+		for (j = 0; j < t->mcu_y; ++j)
+		{
+			for (i = 0; i < t->mcu_x; ++i)
+			{
+				for (k = 0; k < t->c->n; ++k)
+				{
+					int oh_k = t->transpose ? t->vs[k] : t->hs[k], ov_k = t->transpose ? t->hs[k] : t->vs[k];
+					for (v = 0; v < ov_k; ++v)
+					{
+						for (u = 0; u < oh_k; ++u)
+						{
+							stbiw__jpg_xformBlock(t, k, i * oh_k + u, j * ov_k + v, DU);
+							stbiw__jpg_codeBlock(e, DU, k, ss, se, progressive, DC, freq, HT);
+						}
+					}
+				}
+			}
+		}
+	}
+	else
+	{
+		k = comp < 0 ? 0 : comp;
+		stbiw__jpg_xformBlocks(t, k, 0, &bw, &bh);
+		for (j = 0; j < bh; ++j)
+		{
+			for (i = 0; i < bw; ++i)
+			{
+				stbiw__jpg_xformBlock(t, k, i, j, DU);
+				stbiw__jpg_codeBlock(e, DU, k, ss, se, progressive, DC, freq, HT);
+			}
+		}
+	}
+	stbiw__jpg_codeEOBRun(e);
+}
+
+// the huffman table that codes symbols with these counts in the fewest
+// bits, with no code longer than 16 bits or made of all ones (JPEG spec K.2)
+static void stbiw__jpg_optimalTable(const unsigned int *count, unsigned char bits[17], unsigned char vals[256], unsigned short HT[256][2])
+{
+	unsigned int freq[257];
+	int codesize[257], others[257], nbits[258];
+	int i, j, n, code;
+	for (i = 0; i < 257; ++i)
+	{
+		freq[i] = i < 256 ? count[i] : 1; // 256 reserves the all ones code
+		codesize[i] = 0;
+		others[i] = -1;
+	}
+	memset(nbits, 0, sizeof(nbits));
+
+	// huffman's algorithm, merging the two least frequent trees each time
+	for (;;)
+	{
+		int c1 = -1, c2 = -1;
+		for (i = 0; i < 257; ++i)
+		{
+			if (!freq[i])
+				continue;
+			if (c1 < 0 || freq[i] <= freq[c1])
+			{
+				c2 = c1;
+				c1 = i;
+			}
+			else if (c2 < 0 || freq[i] <= freq[c2])
+			{
+				c2 = i;
+			}
+		}
+		if (c2 < 0)
+			break;
+		freq[c1] += freq[c2];
+		freq[c2] = 0;
+		for (++codesize[c1]; others[c1] >= 0; ++codesize[c1])
+			c1 = others[c1];
+		others[c1] = c2;
+		for (++codesize[c2]; others[c2] >= 0; ++codesize[c2])
+			c2 = others[c2];
+	}
+	for (i = 0; i < 257; ++i)
+		if (codesize[i])
+			++nbits[codesize[i]];
+
+	// shorten codes longer than 16 bits: move pairs of them up to a shorter
+	// code's level, which drops down a level in exchange
+	for (i = 257; i > 16; --i)
+	{
+		while (nbits[i] > 0)
+		{
+			for (j = i - 2; nbits[j] == 0; --j)
+			{
+			}
+			nbits[i] -= 2;
+			++nbits[i - 1];
+			nbits[j + 1] += 2;
+			--nbits[j];
+		}
+	}
+	// and drop the reserved code, which is one of the longest
+	for (i = 16; i > 0 && nbits[i] == 0; --i)
+	{
+	}
+	if (i > 0)
+		--nbits[i];
+
+	bits[0] = 0;
+	for (i = 1; i <= 16; ++i)
+		bits[i] = (unsigned char)nbits[i];
+	n = 0;
+	for (i = 1; i < 258; ++i)
+		for (j = 0; j < 256; ++j)
+			if (codesize[j] == i)
+				vals[n++] = (unsigned char)j;
+
+	memset(HT, 0, 256 * sizeof(HT[0]));
+	code = n = 0;
+	for (i = 1; i <= 16; ++i)
+	{
+		for (j = 0; j < bits[i]; ++j, ++n, ++code)
+		{
+			HT[vals[n]][0] = (unsigned short)code;
+			HT[vals[n]][1] = (unsigned short)i;
+		}
+		code <<= 1;
+	}
+}
+
+static void stbiw__jpg_writeDHT(stbi__write_context *s, int tcth, const unsigned char bits[17], const unsigned char *vals)
+{
+	int i, n = 0;
+	for (i = 1; i <= 16; ++i)
+		n += bits[i];
+	stbiw__putc(s, 0xFF);
+	stbiw__putc(s, 0xC4);
+	stbiw__putc(s, (19 + n) >> 8);
+	stbiw__putc(s, (19 + n) & 255);
+	stbiw__putc(s, tcth);
+	s->func(s->context, (void *)(bits + 1), 16);
+	s->func(s->context, (void *)vals, n);
+}
+
+// write the coefficients of the w x h rectangle at (x,y) with a transform
+// applied, without going back to pixels: blocks are moved, transposed and
+// have the signs of their odd frequencies flipped. the rectangle's top left
+// is moved up and left onto an MCU boundary, and it's clipped to the image.
+// a block flipped to the other side has to be whole, so in a flipped
+// direction the rectangle is trimmed to whole MCUs, as jpegtran -trim does,
+// and it fails if that leaves nothing. it also fails if a coefficient is
+// too big for 8-bit baseline's huffman codes.
+//
+// 'optimize' codes each scan with huffman tables built from its own symbol
+// counts instead of the standard ones, costing a second pass over the
+// blocks. 'progressive' (which needs optimize) writes a progressive JPEG by
+// spectral selection: the DCs, then the luminance's low frequencies, the
+// other components, and the rest of the luminance
+static int stbi_write_jpg_transformed_core(stbi__write_context *s, const stbi_jpeg_coefficients *c, int transform, int x, int y, int w, int h, int optimize, int progressive)
+{
+	static const unsigned short fillBits[] = {0x7F, 7};
+	stbiw__jpg_xform t;
+	stbiw__jpg_coder e;
+	unsigned int freq[4][257];
+	unsigned short HT[4][256][2];
+	int tq[4], scans[6][3], nscans = 0;
+	int hmax = 1, vmax = 1, ntables = 0, sixteen = 0;
+	int i, k, m, sc;
+
+	if (!c || c->n < 1 || c->n > 4 || transform < 0 || transform > 7)
+		return 0;
+	t.c = c;
+	t.transpose = (transform & 4) != 0;
+	t.flipx = (transform & 1) != 0;
+	t.flipy = (transform & 2) != 0;
+	for (k = 0; k < c->n; ++k)
+	{
+		// a lone component is coded a block at a time whatever its factors
+		t.hs[k] = c->n == 1 ? 1 : c->h[k];
+		t.vs[k] = c->n == 1 ? 1 : c->v[k];
+		hmax = t.hs[k] > hmax ? t.hs[k] : hmax;
+		vmax = t.vs[k] > vmax ? t.vs[k] : vmax;
+	}
+	optimize |= progressive;
+
+	// the rectangle, in the image as stored
+	if (x < 0 || y < 0 || x >= c->x || y >= c->y || w <= 0 || h <= 0)
+		return 0;
+	w += x % (8 * hmax);
+	x -= x % (8 * hmax);
+	h += y % (8 * vmax);
+	y -= y % (8 * vmax);
+	w = w < c->x - x ? w : c->x - x;
+	h = h < c->y - y ? h : c->y - y;
+	if (t.transpose ? t.flipy : t.flipx)
+		w -= w % (8 * hmax);
+	if (t.transpose ? t.flipx : t.flipy)
+		h -= h % (8 * vmax);
+	if (w <= 0 || h <= 0)
+		return 0;
+	for (k = 0; k < c->n; ++k)
+	{
+		t.bx0[k] = x / (8 * hmax) * t.hs[k];
+		t.by0[k] = y / (8 * vmax) * t.vs[k];
+	}
+
+	// the output image
+	t.ow = t.transpose ? h : w;
+	t.oh = t.transpose ? w : h;
+	t.ohmax = t.transpose ? vmax : hmax;
+	t.ovmax = t.transpose ? hmax : vmax;
+	t.mcu_x = (t.ow + 8 * t.ohmax - 1) / (8 * t.ohmax);
+	t.mcu_y = (t.oh + 8 * t.ovmax - 1) / (8 * t.ovmax);
+	if (!stbiw__jpg_xformCheck(&t))
+		return 0;
+
+	// the scans, as {component or -1 for all, first, last coefficient}
+	scans[nscans][0] = -1;
+	scans[nscans][1] = 0;
+	scans[nscans++][2] = progressive ? 0 : 63;
+	if (progressive)
+	{
+		scans[nscans][0] = 0;
+		scans[nscans][1] = 1;
+		scans[nscans++][2] = 5;
+		for (k = 1; k < c->n; ++k)
+		{
+			scans[nscans][0] = k;
+			scans[nscans][1] = 1;
+			scans[nscans++][2] = 63;
+		}
+		scans[nscans][0] = 0;
+		scans[nscans][1] = 6;
+		scans[nscans++][2] = 63;
+	}
+
+	// share quantization tables between components that have the same one
+	for (k = 0; k < c->n; ++k)
+	{
+		for (tq[k] = 0; tq[k] < k; ++tq[k])
+			if (!memcmp(c->quant[tq[k]], c->quant[k], sizeof(c->quant[k])))
+				break;
+		if (tq[k] == k)
+			tq[k] = ntables++;
+		else
+			tq[k] = tq[tq[k]];
+		for (i = 0; i < 64; ++i)
+			if (c->quant[k][i] > 255)
+				sixteen = 1;
+	}
+
+	// Write Headers
+	{
+		static const unsigned char jfif[] = {0xFF, 0xE0, 0, 0x10, 'J', 'F', 'I', 'F', 0, 1, 1, 0, 0, 1, 0, 1, 0, 0};
+		unsigned char adobe[] = {0xFF, 0xEE, 0, 0xE, 'A', 'd', 'o', 'b', 'e', 0, 0x64, 0, 0, 0, 0, STBIW_UCHAR(c->transform)};
+		stbiw__putc(s, 0xFF);
+		stbiw__putc(s, 0xD8);
+		if (c->jfif)
+			s->func(s->context, (void *)jfif, sizeof(jfif));
+		if (c->transform >= 0)
+			s->func(s->context, (void *)adobe, sizeof(adobe));
+		for (m = 0; m < ntables; ++m)
+		{
+			int len = 3 + (sixteen ? 128 : 64), zz[64];
+			for (k = 0; tq[k] != m; ++k)
+			{
+			}
+			// a transposed block needs the table transposed too
+			for (i = 0; i < 64; ++i)
+				zz[stbiw__jpg_ZigZag[i]] = c->quant[k][t.transpose ? (i & 7) * 8 + (i >> 3) : i];
+			stbiw__putc(s, 0xFF);
+			stbiw__putc(s, 0xDB);
+			stbiw__putc(s, len >> 8);
+			stbiw__putc(s, len & 255);
+			stbiw__putc(s, (sixteen << 4) | m);
+			for (i = 0; i < 64; ++i)
+			{
+				if (sixteen)
+					stbiw__putc(s, zz[i] >> 8);
+				stbiw__putc(s, zz[i] & 255);
+			}
+		}
+		{
+			const unsigned char sof[] = {0xFF, (unsigned char)(progressive ? 0xC2 : sixteen ? 0xC1 : 0xC0), 0, STBIW_UCHAR(8 + 3 * c->n), 8, (unsigned char)(t.oh >> 8), STBIW_UCHAR(t.oh),
+												  (unsigned char)(t.ow >> 8), STBIW_UCHAR(t.ow), STBIW_UCHAR(c->n)};
+			s->func(s->context, (void *)sof, sizeof(sof));
+		}
+		for (k = 0; k < c->n; ++k)
+		{
+			stbiw__putc(s, c->id[k]);
+			stbiw__putc(s, t.transpose ? (t.vs[k] << 4) | t.hs[k] : (t.hs[k] << 4) | t.vs[k]);
+			stbiw__putc(s, tq[k]);
+		}
+	}
+
+	e.s = s;
+	e.bitBuf = e.bitCnt = 0;
+	if (!optimize)
+	{
+		memcpy(HT[0], stbiw__jpg_YDC_HT, sizeof(HT[0]));
+		memcpy(HT[1], stbiw__jpg_UVDC_HT, sizeof(HT[1]));
+		memcpy(HT[2], stbiw__jpg_YAC_HT, sizeof(HT[2]));
+		memcpy(HT[3], stbiw__jpg_UVAC_HT, sizeof(HT[3]));
+		stbiw__jpg_writeHuffmanTables(s);
+	}
+	for (sc = 0; sc < nscans; ++sc)
+	{
+		int comp = scans[sc][0], ss = scans[sc][1], se = scans[sc][2];
+		int k0 = comp < 0 ? 0 : comp, k1 = comp < 0 ? c->n : comp + 1;
+		if (optimize)
+		{
+			// count the scan's symbols, then give it tables of its own
+			memset(freq, 0, sizeof(freq));
+			e.counting = 1;
+			stbiw__jpg_codeScan(&e, &t, comp, ss, se, progressive, freq, HT);
+			for (m = 0; m < 4; ++m)
+			{
+				unsigned char bits[17], vals[256];
+				for (i = 0; i < 256 && !freq[m][i]; ++i)
+				{
+				}
+				if (i == 256)
+					continue;
+				stbiw__jpg_optimalTable(freq[m], bits, vals, HT[m]);
+				stbiw__jpg_writeDHT(s, ((m >> 1) << 4) | (m & 1), bits, vals);
+			}
+		}
+		stbiw__putc(s, 0xFF);
+		stbiw__putc(s, 0xDA);
+		stbiw__putc(s, 0);
+		stbiw__putc(s, 6 + 2 * (k1 - k0));
+		stbiw__putc(s, k1 - k0);
+		for (k = k0; k < k1; ++k)
+		{
+			stbiw__putc(s, c->id[k]);
+			stbiw__putc(s, k ? 0x11 : 0);
+		}
+		stbiw__putc(s, ss);
+		stbiw__putc(s, se);
+		stbiw__putc(s, 0);
+
+		e.counting = 0;
+		stbiw__jpg_codeScan(&e, &t, comp, ss, se, progressive, freq, HT);
+		// Do the bit alignment of the next marker
+		stbiw__jpg_writeBits(s, &e.bitBuf, &e.bitCnt, fillBits);
+		e.bitBuf = e.bitCnt = 0;
+	}
+
+	// EOI
+	stbiw__putc(s, 0xFF);
+	stbiw__putc(s, 0xD9);
+	return 1;
+}
+
 STBIWDEF int stbi_write_jpg_to_func(stbi_write_func *func, void *context, int x, int y, int comp, const void *data, int quality)
 {
 	stbi__write_context s = {0};
@@ -386,3 +928,58 @@ STBIWDEF int stbi_write_jpg(char const *filename, int x, int y, int comp, const
 		return 0;
 }
 #endif
+
+// losslessly rotate, flip and/or crop a JPEG read with
+// stbi_jpeg_load_coefficients*, with 'transform' one of the
+// STBI_JPEG_TRANSFORM_* values. pass the whole image as the rectangle to
+// only transform it
+STBIWDEF int stbi_write_jpg_transformed_to_func(stbi_write_func *func, void *context, const stbi_jpeg_coefficients *c, int transform, int x, int y, int w, int h)
+{
+	stbi__write_context s = {0};
+	stbi__start_write_callbacks(&s, func, context);
+	return stbi_write_jpg_transformed_core(&s, c, transform, x, y, w, h, 0, 0);
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_jpg_transformed(char const *filename, const stbi_jpeg_coefficients *c, int transform, int x, int y, int w, int h)
+{
+	stbi__write_context s = {0};
+	if (stbi__start_write_file(&s, filename))
+	{
+		int r = stbi_write_jpg_transformed_core(&s, c, transform, x, y, w, h, 0, 0);
+		stbi__end_write_file(&s);
+		return r;
+	}
+	else
+		return 0;
+}
+#endif
+
+// re-encode a JPEG read with stbi_jpeg_load_coefficients* using huffman
+// tables fitted to it, with the pixels left exactly as they were. that
+// usually makes a baseline file written with the standard tables a few
+// percent smaller, but a progressive one that used successive approximation
+// (as libjpeg's do) can come out a few percent bigger, as it isn't written
+// here. a non-zero 'progressive' writes a progressive JPEG by spectral
+// selection only
+STBIWDEF int stbi_write_jpg_optimized_to_func(stbi_write_func *func, void *context, const stbi_jpeg_coefficients *c, int progressive)
+{
+	stbi__write_context s = {0};
+	stbi__start_write_callbacks(&s, func, context);
+	return c && stbi_write_jpg_transformed_core(&s, c, STBI_JPEG_TRANSFORM_NONE, 0, 0, c->x, c->y, 1, progressive);
+}
+
+#ifndef STBI_WRITE_NO_STDIO
+STBIWDEF int stbi_write_jpg_optimized(char const *filename, const stbi_jpeg_coefficients *c, int progressive)
+{
+	stbi__write_context s = {0};
+	if (c && stbi__start_write_file(&s, filename))
+	{
+		int r = stbi_write_jpg_transformed_core(&s, c, STBI_JPEG_TRANSFORM_NONE, 0, 0, c->x, c->y, 1, progressive);
+		stbi__end_write_file(&s);
+		return r;
+	}
+	else
+		return 0;
+}
+#endif
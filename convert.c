@@ -143,6 +143,110 @@ static void stbi__float_postprocess(float *result, int *x, int *y, int *comp, in
 }
 #endif
 
+#ifndef STBI_NO_JPEG
+static stbi_uc *stbi__load_jpeg_region_and_postprocess(stbi__context *s, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	stbi_uc *result = stbi__jpeg_load_region(s, x, y, w, h, out_w, out_h, comp, req_comp);
+	if (result && stbi__vertically_flip_on_load)
+	{
+		int channels = req_comp ? req_comp : *comp;
+		stbi__vertical_flip(result, *out_w, *out_h, channels * sizeof(stbi_uc));
+	}
+	return result;
+}
+
+static stbi_uc *stbi__load_jpeg_profile_and_postprocess(stbi__context *s, int *x, int *y, int *comp, int req_comp, int profile)
+{
+	stbi_uc *result = stbi__jpeg_load_profile(s, x, y, comp, req_comp, profile);
+	if (result && stbi__vertically_flip_on_load)
+	{
+		int channels = req_comp ? req_comp : *comp;
+		stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+	}
+	return result;
+}
+
+static stbi_uc *stbi__load_jpeg_region_indexed_and_postprocess(stbi__context *s, stbi_uc const *index, int index_len, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	stbi_uc *result = stbi__jpeg_load_region_indexed(s, index, index_len, x, y, w, h, out_w, out_h, comp, req_comp);
+	if (result && stbi__vertically_flip_on_load)
+	{
+		int channels = req_comp ? req_comp : *comp;
+		stbi__vertical_flip(result, *out_w, *out_h, channels * sizeof(stbi_uc));
+	}
+	return result;
+}
+
+static stbi_uc *stbi__load_jpeg_planar_and_postprocess(stbi__context *s, stbi_jpeg_planes *planes)
+{
+	stbi_uc *result = stbi__jpeg_load_planar(s, planes);
+	if (result && stbi__vertically_flip_on_load)
+	{
+		int k;
+		for (k = 0; k < planes->n; ++k)
+			stbi__vertical_flip(planes->data[k], planes->stride[k], planes->h[k], 1);
+	}
+	return result;
+}
+
+// previews are flipped in the output image, which is converted again
+// afterwards anyway
+typedef struct
+{
+	stbi_jpeg_scan_callback callback;
+	void *user;
+} stbi__jpeg_scan_flip;
+
+static int stbi__jpeg_scan_flipped(void *user, stbi_uc *pixels, int x, int y, int comp, int scan)
+{
+	stbi__jpeg_scan_flip *f = (stbi__jpeg_scan_flip *)user;
+	stbi__vertical_flip(pixels, x, y, comp);
+	return f->callback(f->user, pixels, x, y, comp, scan);
+}
+
+static stbi_uc *stbi__load_jpeg_progressive_and_postprocess(stbi__context *s, int *x, int *y, int *comp, int req_comp, stbi_jpeg_scan_callback callback, void *user)
+{
+	stbi_uc *result;
+	if (stbi__vertically_flip_on_load)
+	{
+		stbi__jpeg_scan_flip f;
+		f.callback = callback;
+		f.user = user;
+		result = stbi__jpeg_load_progressive(s, x, y, comp, req_comp, stbi__jpeg_scan_flipped, &f);
+	}
+	else
+		result = stbi__jpeg_load_progressive(s, x, y, comp, req_comp, callback, user);
+	if (result && stbi__vertically_flip_on_load)
+	{
+		int channels = req_comp ? req_comp : *comp;
+		stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+	}
+	return result;
+}
+
+static stbi_uc *stbi__load_jpeg_decoder_and_postprocess(stbi_jpeg_decoder *d, int *x, int *y, int *comp, int req_comp)
+{
+	stbi_uc *result = stbi__jpeg_decoder_load(d, x, y, comp, req_comp);
+	if (result && stbi__vertically_flip_on_load)
+	{
+		int channels = req_comp ? req_comp : *comp;
+		stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+	}
+	return result;
+}
+
+static stbi_uc *stbi__load_jpeg_thumbnail_and_postprocess(stbi__context *s, int *x, int *y, int *comp, int req_comp)
+{
+	stbi_uc *result = stbi__jpeg_load_thumbnail(s, x, y, comp, req_comp);
+	if (result && stbi__vertically_flip_on_load)
+	{
+		int channels = req_comp ? req_comp : *comp;
+		stbi__vertical_flip(result, *x, *y, channels * sizeof(stbi_uc));
+	}
+	return result;
+}
+#endif
+
 #ifndef STBI_NO_STDIO
 
 #if defined(_MSC_VER) && defined(STBI_WINDOWS_UTF8)
@@ -196,6 +300,138 @@ STBIDEF stbi_uc *stbi_load(char const *filename, int *x, int *y, int *comp, int
 	return result;
 }
 
+#ifndef STBI_NO_JPEG
+// decode just the w x h rectangle at (x,y) of a JPEG, counting from the top
+// left of the image as stored and at the size stbi_jpeg_set_scale_denom
+// asks for. the rectangle is clipped to the image; *out_w and *out_h give
+// the size of what's returned
+STBIDEF stbi_uc *stbi_jpeg_load_region(char const *filename, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	unsigned char *result;
+	stbi__context s;
+	if (!f)
+		return stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__load_jpeg_region_and_postprocess(&s, x, y, w, h, out_w, out_h, comp, req_comp);
+	fclose(f);
+	return result;
+}
+
+// load a JPEG with the STBI_JPEG_* profile given rather than the one
+// stbi_jpeg_set_profile set for the process, so loads on different threads
+// can each have their own
+STBIDEF stbi_uc *stbi_jpeg_load_profile(char const *filename, int *x, int *y, int *comp, int req_comp, int profile)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	unsigned char *result;
+	stbi__context s;
+	if (!f)
+		return stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__load_jpeg_profile_and_postprocess(&s, x, y, comp, req_comp, profile);
+	fclose(f);
+	return result;
+}
+
+// decode a JPEG into its component planes (Y, Cb and Cr for most files) at
+// their own resolutions, skipping upsampling and colour conversion. returns
+// the block holding every plane, to free with stbi_image_free
+STBIDEF stbi_uc *stbi_jpeg_load_planar(char const *filename, stbi_jpeg_planes *planes)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	unsigned char *result;
+	stbi__context s;
+	if (!f)
+		return stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__load_jpeg_planar_and_postprocess(&s, planes);
+	fclose(f);
+	return result;
+}
+
+// read a JPEG's quantized DCT coefficients without decoding it any
+// further. they're in the file's orientation whatever
+// stbi_set_flip_vertically_on_load says. returns the block holding every
+// array, to free with stbi_image_free
+STBIDEF short *stbi_jpeg_load_coefficients(char const *filename, stbi_jpeg_coefficients *c)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	short *result;
+	stbi__context s;
+	if (!f)
+		return (short *)stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__jpeg_load_coefficients(&s, c);
+	fclose(f);
+	return result;
+}
+
+// load a JPEG as stbi_load does, calling 'callback' with the image as it
+// stands after each scan of a progressive file, e.g. to send out a first
+// approximation after the DC scan
+STBIDEF stbi_uc *stbi_jpeg_load_progressive(char const *filename, int *x, int *y, int *comp, int req_comp, stbi_jpeg_scan_callback callback, void *user)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	unsigned char *result;
+	stbi__context s;
+	if (!f)
+		return stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__load_jpeg_progressive_and_postprocess(&s, x, y, comp, req_comp, callback, user);
+	fclose(f);
+	return result;
+}
+
+// the JPEG thumbnail (usually 160x120) that cameras put in the EXIF data,
+// without decoding the image. stbi_jpeg_exif_thumbnail returns its bytes
+// (*len of them, to free with stbi_image_free) and
+// stbi_jpeg_load_thumbnail decodes it as stbi_load would, turning it
+// upright from the image's EXIF orientation if stbi_jpeg_set_orient_on_load
+// is on (the thumbnail has no EXIF data of its own). both fail if there's
+// no thumbnail
+STBIDEF stbi_uc *stbi_jpeg_exif_thumbnail(char const *filename, int *len)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	unsigned char *result;
+	stbi__context s;
+	if (!f)
+		return stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__jpeg_exif_thumbnail(&s, len, NULL);
+	fclose(f);
+	return result;
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_thumbnail(char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	unsigned char *result;
+	stbi__context s;
+	if (!f)
+		return stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&s, f);
+	result = stbi__load_jpeg_thumbnail_and_postprocess(&s, x, y, comp, req_comp);
+	fclose(f);
+	return result;
+}
+
+// decode the next image with a decoder from stbi_jpeg_decoder_create. the
+// result is freed with stbi_image_free as usual; the decoder keeps only its
+// tables and scratch buffers
+STBIDEF stbi_uc *stbi_jpeg_decoder_load(stbi_jpeg_decoder *d, char const *filename, int *x, int *y, int *comp, int req_comp)
+{
+	FILE *f = stbi__fopen(filename, "rb");
+	unsigned char *result;
+	if (!f)
+		return stbi__errpuc("can't fopen", "Unable to open file");
+	stbi__start_file(&d->s, f);
+	result = stbi__load_jpeg_decoder_and_postprocess(d, x, y, comp, req_comp);
+	fclose(f);
+	return result;
+}
+#endif
+
 STBIDEF stbi_uc *stbi_load_from_file(FILE *f, int *x, int *y, int *comp, int req_comp)
 {
 	unsigned char *result;
@@ -282,6 +518,139 @@ STBIDEF stbi_uc *stbi_load_gif_from_memory(stbi_uc const *buffer, int len, int *
 }
 #endif
 
+#ifndef STBI_NO_JPEG
+STBIDEF stbi_uc *stbi_jpeg_load_region_from_memory(stbi_uc const *buffer, int len, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_jpeg_region_and_postprocess(&s, x, y, w, h, out_w, out_h, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_region_from_callbacks(stbi_io_callbacks const *clbk, void *user, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__load_jpeg_region_and_postprocess(&s, x, y, w, h, out_w, out_h, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_profile_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, int profile)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_jpeg_profile_and_postprocess(&s, x, y, comp, req_comp, profile);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_profile_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp, int profile)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__load_jpeg_profile_and_postprocess(&s, x, y, comp, req_comp, profile);
+}
+
+// index a single-scan baseline JPEG for stbi_jpeg_load_region_indexed_from_memory,
+// with a checkpoint every 'rows' MCU rows (8 or 16 pixels each). the index
+// is *index_len bytes, free it with stbi_image_free; it can be saved next to
+// the file and only matches those exact bytes
+STBIDEF stbi_uc *stbi_jpeg_build_index_from_memory(stbi_uc const *buffer, int len, int rows, int *index_len)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__jpeg_build_index(&s, rows, index_len);
+}
+
+// stbi_jpeg_load_region_from_memory, starting from the checkpoint in the
+// index nearest above the region instead of the top of the image. an index
+// that doesn't match the file is ignored
+STBIDEF stbi_uc *stbi_jpeg_load_region_indexed_from_memory(stbi_uc const *buffer, int len, stbi_uc const *index, int index_len, int x, int y, int w, int h, int *out_w, int *out_h, int *comp, int req_comp)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_jpeg_region_indexed_and_postprocess(&s, index, index_len, x, y, w, h, out_w, out_h, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_planar_from_memory(stbi_uc const *buffer, int len, stbi_jpeg_planes *planes)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_jpeg_planar_and_postprocess(&s, planes);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_planar_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_jpeg_planes *planes)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__load_jpeg_planar_and_postprocess(&s, planes);
+}
+
+STBIDEF short *stbi_jpeg_load_coefficients_from_memory(stbi_uc const *buffer, int len, stbi_jpeg_coefficients *c)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__jpeg_load_coefficients(&s, c);
+}
+
+STBIDEF short *stbi_jpeg_load_coefficients_from_callbacks(stbi_io_callbacks const *clbk, void *user, stbi_jpeg_coefficients *c)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__jpeg_load_coefficients(&s, c);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_progressive_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp, stbi_jpeg_scan_callback callback, void *user)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_jpeg_progressive_and_postprocess(&s, x, y, comp, req_comp, callback, user);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_progressive_from_callbacks(stbi_io_callbacks const *clbk, void *cb_user, int *x, int *y, int *comp, int req_comp, stbi_jpeg_scan_callback callback, void *user)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, cb_user);
+	return stbi__load_jpeg_progressive_and_postprocess(&s, x, y, comp, req_comp, callback, user);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_exif_thumbnail_from_memory(stbi_uc const *buffer, int len, int *thumb_len)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__jpeg_exif_thumbnail(&s, thumb_len, NULL);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_exif_thumbnail_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *len)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__jpeg_exif_thumbnail(&s, len, NULL);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_thumbnail_from_memory(stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+	stbi__context s;
+	stbi__start_mem(&s, buffer, len);
+	return stbi__load_jpeg_thumbnail_and_postprocess(&s, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_load_thumbnail_from_callbacks(stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+	stbi__context s;
+	stbi__start_callbacks(&s, (stbi_io_callbacks *)clbk, user);
+	return stbi__load_jpeg_thumbnail_and_postprocess(&s, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_decoder_load_from_memory(stbi_jpeg_decoder *d, stbi_uc const *buffer, int len, int *x, int *y, int *comp, int req_comp)
+{
+	stbi__start_mem(&d->s, buffer, len);
+	return stbi__load_jpeg_decoder_and_postprocess(d, x, y, comp, req_comp);
+}
+
+STBIDEF stbi_uc *stbi_jpeg_decoder_load_from_callbacks(stbi_jpeg_decoder *d, stbi_io_callbacks const *clbk, void *user, int *x, int *y, int *comp, int req_comp)
+{
+	stbi__start_callbacks(&d->s, (stbi_io_callbacks *)clbk, user);
+	return stbi__load_jpeg_decoder_and_postprocess(d, x, y, comp, req_comp);
+}
+#endif
+
 #ifndef STBI_NO_LINEAR
 static float *stbi__loadf_main(stbi__context *s, int *x, int *y, int *comp, int req_comp)
 {
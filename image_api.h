@@ -0,0 +1,70 @@
+#ifndef STBI_IMAGE_API_H
+#define STBI_IMAGE_API_H
+
+// types shared by the readers and the writers, so that either side builds
+// without the other
+
+// an image's quantized DCT coefficients as coded in the file, from
+// stbi_jpeg_load_coefficients*, e.g. for lossless transforms with
+// stbi_write_jpg_transformed*. every array lives in the one block returned,
+// which is freed with stbi_image_free
+typedef struct
+{
+	int x, y;                      // image size
+	int n;                         // number of components
+	int id[4];                     // component ids from the frame header
+	int h[4], v[4];                // sampling factors
+	int blocks_w[4];               // size of each component in blocks, padded to
+	int blocks_h[4];               // whole MCUs, so the last ones may be past the edge
+	short *coeff[4];               // 64 coefficients a block in natural order (not
+											 // zigzag), blocks_w blocks a row
+	unsigned short quant[4][64];   // each component's quantization table, natural order
+	int jfif;                      // the file had a JFIF marker
+	int transform;                 // Adobe colour transform, -1 without an Adobe marker
+} stbi_jpeg_coefficients;
+
+// lossless transforms for stbi_write_jpg_transformed*. each is a transpose
+// (swapping x and y) if asked for, then the flips
+enum
+{
+	STBI_JPEG_TRANSFORM_NONE = 0,
+	STBI_JPEG_TRANSFORM_FLIP_H = 1,
+	STBI_JPEG_TRANSFORM_FLIP_V = 2,
+	STBI_JPEG_TRANSFORM_ROTATE_180 = 3, // FLIP_H | FLIP_V
+	STBI_JPEG_TRANSFORM_TRANSPOSE = 4,
+	STBI_JPEG_TRANSFORM_ROTATE_90 = 5,  // clockwise: TRANSPOSE | FLIP_H
+	STBI_JPEG_TRANSFORM_ROTATE_270 = 6, // TRANSPOSE | FLIP_V
+	STBI_JPEG_TRANSFORM_TRANSVERSE = 7
+};
+
+// the component planes of an image as they're coded, before upsampling and
+// colour conversion. every plane lives in the one block returned by
+// stbi_jpeg_load_planar*, which is freed with stbi_image_free
+typedef struct
+{
+	int x, y;               // image size, at the size it's decoded at
+	int n;                  // number of planes: 1, 3 or 4
+	int ycc;                // 1 if the planes are YCbCr (YCCK for 4), 0 if they're
+	                        // grey, RGB or CMYK as they stand
+	unsigned char *data[4]; // top left pixel of each plane
+	int w[4], h[4];         // size of each plane; chroma is smaller if subsampled
+	int stride[4];          // bytes from one row of a plane to the next
+} stbi_jpeg_planes;
+
+// a JPEG being decoded a few scanlines at a time, from
+// stbi_jpeg_stream_open_*; read with stbi_jpeg_stream_read_scanlines and
+// freed with stbi_jpeg_stream_close
+typedef struct stbi_jpeg_stream stbi_jpeg_stream;
+
+// called by stbi_jpeg_load_progressive* after each scan of a progressive
+// image, with the whole image as it stands, comp bytes a pixel. scan
+// counts from 1. pixels are only valid during the call; return 0 to stop
+// decoding, which makes the load fail
+typedef int (*stbi_jpeg_scan_callback)(void *user, unsigned char *pixels, int x, int y, int comp, int scan);
+
+// a decoder that keeps its huffman tables and buffers from one JPEG to the
+// next, from stbi_jpeg_decoder_create; load with stbi_jpeg_decoder_load*
+// and free with stbi_jpeg_decoder_free
+typedef struct stbi_jpeg_decoder stbi_jpeg_decoder;
+
+#endif // STBI_IMAGE_API_H